@@ -34,6 +34,8 @@
 #pragma warning(pop)
 #endif
 
+#include "BlkConfig.hpp"
+
 #include <cstdlib>
 #include <mutex>
 
@@ -56,7 +58,66 @@ parseArgs(int argc, char *argv[])
         ("s,windows-svc", "Run as a windows service")
 #endif
         ("p,high-priority", "Run with high priority")
-        ("w,wait", "Wait for xeniface driver");
+        ("w,wait", "Wait for xeniface driver")
+        ("grant-cache-policy", "Default persistent grant cache policy",
+         cxxopts::value<std::string>()->default_value("lru"), "[lru|clock|2q|arc|lfu]")
+        ("grant-trace-dir", "Log each device's grant accesses to this directory",
+         cxxopts::value<std::string>(), "[dir]")
+        ("max-grants", "Persistent grants all devices together may keep mapped",
+         cxxopts::value<uint64_t>()->default_value("8192"), "[grants]")
+        ("linear-map-pages", "Pages kept mapped contiguously for multi-segment requests",
+         cxxopts::value<uint32_t>()->default_value("0"), "[pages]")
+        ("grant-warmup", "Pre-map a reconnecting device's previous grants")
+        ("max-queues", "Rings offered to each frontend (0 = one per cpu)",
+         cxxopts::value<uint32_t>()->default_value("0"), "[queues]")
+        ("max-ring-order", "Largest shared ring offered, 2^order pages",
+         cxxopts::value<uint32_t>()->default_value("4"), "[0-4]")
+        ("max-indirect-segments", "Most segments of an indirect request offered",
+         cxxopts::value<uint32_t>()->default_value("256"), "[11-4096]")
+        ("workers", "Threads per device doing disk I/O (0 = on the ring threads)",
+         cxxopts::value<uint32_t>()->default_value("0"), "[threads]")
+        ("max-in-flight", "Requests a device works on at once (0 = unlimited)",
+         cxxopts::value<uint32_t>()->default_value("0"), "[requests]")
+        ("max-in-flight-total", "Requests all devices together work on at once (0 = unlimited)",
+         cxxopts::value<uint32_t>()->default_value("0"), "[requests]")
+        ("shared-workers", "Threads shared by the devices without --workers of their own",
+         cxxopts::value<uint32_t>()->default_value("0"), "[threads]")
+        ("weight", "Share of the shared workers or reactor threads each device gets",
+         cxxopts::value<uint32_t>()->default_value("1"), "[weight]")
+        ("fair-quantum", "Requests a device of weight 1 runs on the shared workers per round",
+         cxxopts::value<uint32_t>()->default_value("1"), "[requests]")
+        ("work-stealing", "Let idle devices' workers take requests from busy ones")
+        ("reactor-threads", "Threads serving all rings' event channels (0 = one per ring)",
+         cxxopts::value<uint32_t>()->default_value("0"), "[threads]")
+        ("reactor-quantum", "Requests a ring of weight 1 takes per turn on a reactor thread (0 = all)",
+         cxxopts::value<uint32_t>()->default_value("8"), "[requests]")
+        ("poll-us", "Longest a ring spins for more requests (0 = never)",
+         cxxopts::value<uint32_t>()->default_value("0"), "[us]")
+        ("notify-batch", "Responses per frontend notification when coalescing",
+         cxxopts::value<uint32_t>()->default_value("0"), "[responses]")
+        ("notify-delay-us", "Longest a frontend notification is held back",
+         cxxopts::value<uint32_t>()->default_value("0"), "[us]")
+        ("notify-adaptive", "Coalesce notifications only as much as the load allows")
+        ("qos-read-iops", "Read requests per second per device (0 = unlimited)",
+         cxxopts::value<uint32_t>()->default_value("0"), "[iops]")
+        ("qos-write-iops", "Write requests per second per device (0 = unlimited)",
+         cxxopts::value<uint32_t>()->default_value("0"), "[iops]")
+        ("qos-read-bps", "Bytes read per second per device (0 = unlimited)",
+         cxxopts::value<uint64_t>()->default_value("0"), "[bytes]")
+        ("qos-write-bps", "Bytes written per second per device (0 = unlimited)",
+         cxxopts::value<uint64_t>()->default_value("0"), "[bytes]")
+        ("qos-burst-ms", "Burst allowed over the qos limits, in time at the limit",
+         cxxopts::value<uint32_t>()->default_value("100"), "[ms]")
+        ("merge-sectors", "Longest disk operation adjacent requests are merged into (0 = no merging)",
+         cxxopts::value<uint32_t>()->default_value("0"), "[sectors]")
+        ("split-sectors", "Longest read or write one worker does (0 = no splitting)",
+         cxxopts::value<uint32_t>()->default_value("256"), "[sectors]")
+        ("cpus", "CPUs for the devices' threads, instead of pinning the process",
+         cxxopts::value<std::string>(), "[list]")
+        ("cpu-policy", "How threads are placed on --cpus",
+         cxxopts::value<std::string>()->default_value("spread"), "[spread|shared]")
+        ("numa-node", "NUMA node for the devices' threads and buffers",
+         cxxopts::value<std::string>(), "[node|auto]");
 
         auto args = options.parse(argc, argv);
         if (args.count("help")) {
@@ -67,6 +128,80 @@ parseArgs(int argc, char *argv[])
         return args;
 }
 
+inline BlkDeviceConfig
+parseDeviceConfig(const args_type &args)
+{
+        BlkDeviceConfig config;
+
+        const auto policy = args["grant-cache-policy"].as<std::string>();
+        if (!parseGrantCachePolicy(policy, config.grantCachePolicy)) {
+            std::cerr << "Unknown grant cache policy: " << policy << '\n';
+            exit(EXIT_FAILURE);
+        }
+
+        if (args.count("grant-trace-dir")) {
+            config.grantTraceDir = args["grant-trace-dir"].as<std::string>();
+        }
+
+        config.maxGrants = args["max-grants"].as<uint64_t>();
+        config.linearMapPages = args["linear-map-pages"].as<uint32_t>();
+        config.grantWarmup = args.count("grant-warmup") != 0;
+        config.maxQueues = args["max-queues"].as<uint32_t>();
+        config.maxRingPageOrder = args["max-ring-order"].as<uint32_t>();
+        config.maxIndirectSegments = args["max-indirect-segments"].as<uint32_t>();
+        config.workers = args["workers"].as<uint32_t>();
+        config.maxInFlight = args["max-in-flight"].as<uint32_t>();
+        config.maxInFlightTotal = args["max-in-flight-total"].as<uint32_t>();
+        config.sharedWorkers = args["shared-workers"].as<uint32_t>();
+        config.weight = args["weight"].as<uint32_t>();
+        config.fairQuantum = args["fair-quantum"].as<uint32_t>();
+        config.workStealing = args.count("work-stealing") != 0;
+        config.reactorThreads = args["reactor-threads"].as<uint32_t>();
+        config.reactorQuantum = args["reactor-quantum"].as<uint32_t>();
+        config.pollUs = args["poll-us"].as<uint32_t>();
+        config.notifyBatch = args["notify-batch"].as<uint32_t>();
+        config.notifyDelayUs = args["notify-delay-us"].as<uint32_t>();
+        config.notifyAdaptive = args.count("notify-adaptive") != 0;
+        config.mergeSectors = args["merge-sectors"].as<uint32_t>();
+        config.splitSectors = args["split-sectors"].as<uint32_t>();
+        config.qos.readIops = args["qos-read-iops"].as<uint32_t>();
+        config.qos.writeIops = args["qos-write-iops"].as<uint32_t>();
+        config.qos.readBps = args["qos-read-bps"].as<uint64_t>();
+        config.qos.writeBps = args["qos-write-bps"].as<uint64_t>();
+        config.qos.burstMs = args["qos-burst-ms"].as<uint32_t>();
+
+        if (config.weight == 0U) {
+            std::cerr << "Invalid weight: 0\n";
+            exit(EXIT_FAILURE);
+        }
+
+        if (args.count("cpus")) {
+            const auto cpus = args["cpus"].as<std::string>();
+
+            if (!parseCpuList(cpus, config.cpus)) {
+                std::cerr << "Invalid cpu list: " << cpus << '\n';
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        const auto cpuPolicy = args["cpu-policy"].as<std::string>();
+        if (!parseCpuPolicy(cpuPolicy, config.cpuPolicy)) {
+            std::cerr << "Unknown cpu policy: " << cpuPolicy << '\n';
+            exit(EXIT_FAILURE);
+        }
+
+        if (args.count("numa-node")) {
+            const auto node = args["numa-node"].as<std::string>();
+
+            if (!parseNumaNode(node, config.numaNode)) {
+                std::cerr << "Invalid numa node: " << node << '\n';
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        return config;
+}
+
 inline args_type parseOrigArgs()
 {
     std::lock_guard lock(orig_arg_mutex);
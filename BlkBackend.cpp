@@ -18,60 +18,111 @@
  */
 
 #include "BlkBackend.hpp"
-#include "Args.hpp"
-#include "Service.hpp"
 
-#include <csignal>
+#include <algorithm>
 #include <cmath>
-#include <cxxopts.hpp>
+#include <cstdlib>
+#include <iterator>
+#include <thread>
 
-#ifdef _WIN32
-#include <windows.h>
-#else
-#ifndef _GNU_SOURCE
-#define _GNU_SOURCE
-#endif
-#include <sched.h>
-#include <unistd.h>
+#ifndef _WIN32
+#include <xenctrl.h>
 #endif
 
 using XenBackend::FrontendHandlerPtr;
 using XenBackend::RingBufferPtr;
 
-// Total number of (persistent) grants that may be mapped at any given time.
-// On Windows this must be less than the number of grants implied
-// by the size of the FDO hole. This hole currently is 64MB which
-// gives 64K grants available in total. A small (< 128) portion of
-// these are reserved for the shared info and grant table pages.
-// The rest are free to use here.
-constexpr uint64_t MAX_PGRANTS = 8192U;
+// Most persistent grants a device gets however few devices share the
+// budget (BlkDeviceConfig::maxGrants), around what each of the 8 devices a
+// backend used to be limited to got
+constexpr uint64_t MAX_PGRANTS_PER_FRONTEND = 1024U;
 
-// Total number of frontends we can service. This is chosen to
-// keep the maximum number of persistent grants-per-frontend around 1000.
-constexpr uint64_t MAX_FRONTENDS = 8U;
-constexpr uint64_t MAX_PGRANTS_PER_FRONTEND = MAX_PGRANTS / MAX_FRONTENDS;
+// Fewest persistent grants a ring gets however many devices share the
+// budget, enough for a request of the most direct segments and an
+// eviction's worth
+constexpr uint64_t MIN_PGRANTS_PER_RING = 32U;
 
 constexpr uint64_t SECTORS_PER_PAGE = XC_PAGE_SIZE / SECTOR_SIZE;
 constexpr uint64_t SEGMENTS_PER_INDIRECT_PAGE =
     XC_PAGE_SIZE / sizeof(struct blkif_request_segment);
 
-constexpr uint64_t MAX_INDIRECT_SEGMENTS = 256U;
-constexpr uint64_t MAX_INDIRECT_PAGES =
-    div_round_up(MAX_INDIRECT_SEGMENTS, SEGMENTS_PER_INDIRECT_PAGE);
+// Largest shared ring offered (2^4 = 16 pages, 512 slots), which is also
+// the protocol limit
+constexpr uint32_t MAX_RING_PAGE_ORDER = 4U;
+constexpr uint32_t MAX_RING_PAGES = 1U << MAX_RING_PAGE_ORDER;
+
+// Upper bound on the rings (and threads) a frontend may use. Each ring
+// gets an equal share of the frontend's persistent grants.
+constexpr uint32_t MAX_QUEUES = 8U;
+
+// Protocol limit on the segments of an indirect request (4096, 16 MB)
+constexpr uint64_t MAX_INDIRECT_SEGMENTS =
+    SEGMENTS_PER_INDIRECT_PAGE * BLKIF_MAX_INDIRECT_PAGES_PER_REQUEST;
+
+// A device offering more indirect segments than this joins the grant
+// budget with one share for each this many
+constexpr uint64_t INDIRECT_SEGMENTS_PER_SHARE = 256U;
+
+// Indirect segments offered through feature-max-indirect-segments, no fewer
+// than a direct request carries
+static uint32_t maxIndirectSegments(const BlkDeviceConfig &config) noexcept
+{
+    return uint32_t(minimum(maximum(uint64_t(config.maxIndirectSegments),
+                                    uint64_t(BLKIF_MAX_SEGMENTS_PER_REQUEST)),
+                            MAX_INDIRECT_SEGMENTS));
+}
+
+static uint64_t grantBudgetShares(const BlkDeviceConfig &config) noexcept
+{
+    return div_round_up(uint64_t(maxIndirectSegments(config)),
+                        INDIRECT_SEGMENTS_PER_SHARE);
+}
+
+// A ring's part of its device's persistent grants
+static constexpr uint64_t pgrantsPerRing(uint64_t devicePgrants,
+                                         uint32_t nrQueues) noexcept
+{
+    return maximum(devicePgrants / nrQueues, MIN_PGRANTS_PER_RING);
+}
+
+// Indirect descriptor pages are cached apart from data pages so they don't
+// evict each other. Room for every slot of the ring to use its maximum
+// number of descriptor pages twice over covers a frontend that keeps a
+// fixed pool of them, which in practice keeps them all mapped. With many
+// queues, large rings or a small share of the budget it is limited to a
+// quarter of the ring's grants.
+static constexpr uint64_t indirectPgrantsPerRing(uint64_t ringPgrants,
+                                                 uint64_t ringSlots,
+                                                 uint64_t indirectPages) noexcept
+{
+    return minimum(2U * ringSlots * indirectPages, ringPgrants / 4U);
+}
+
+static constexpr uint64_t dataPgrantsPerRing(uint64_t ringPgrants,
+                                             uint64_t ringSlots,
+                                             uint64_t indirectPages) noexcept
+{
+    return ringPgrants - indirectPgrantsPerRing(ringPgrants, ringSlots, indirectPages);
+}
+
+constexpr uint64_t MAX_RING_SLOTS = __CONST_RING_SIZE(blkif, MAX_RING_PAGES * XC_PAGE_SIZE);
+constexpr uint64_t MIN_DATA_PGRANTS_PER_RING =
+    dataPgrantsPerRing(MIN_PGRANTS_PER_RING, MAX_RING_SLOTS,
+                       BLKIF_MAX_INDIRECT_PAGES_PER_REQUEST);
 
 // Evict 5% of existing grants when the persistent limit is full
-constexpr uint64_t GRANT_EVICTION_SIZE =
-    div_round_up(MAX_PGRANTS_PER_FRONTEND * 5, 100);
+static constexpr uint64_t grantEvictionSize(uint64_t capacity) noexcept
+{
+    return div_round_up(capacity * 5, 100);
+}
 
 // Make sure segments-per-page is a positive power of two
 static_assert(SEGMENTS_PER_INDIRECT_PAGE > 0U);
 static_assert((SEGMENTS_PER_INDIRECT_PAGE & (SEGMENTS_PER_INDIRECT_PAGE - 1U)) == 0U);
 
-static_assert(MAX_INDIRECT_PAGES <= BLKIF_MAX_INDIRECT_PAGES_PER_REQUEST);
-static_assert(MAX_PGRANTS_PER_FRONTEND > BLKIF_MAX_SEGMENTS_PER_REQUEST);
-static_assert(MAX_PGRANTS_PER_FRONTEND > GRANT_EVICTION_SIZE);
-
-static std::atomic<uint64_t> frontendCount;
+static_assert(INDIRECT_SEGMENTS_PER_SHARE <= MAX_INDIRECT_SEGMENTS);
+static_assert(MIN_DATA_PGRANTS_PER_RING > BLKIF_MAX_SEGMENTS_PER_REQUEST);
+static_assert(MIN_DATA_PGRANTS_PER_RING > grantEvictionSize(MIN_DATA_PGRANTS_PER_RING));
 
 static bool validSegment(const blkif_request_segment *const seg) noexcept
 {
@@ -94,112 +145,461 @@ static bool validSegment(const blkif_request_segment *const seg) noexcept
     return true;
 }
 
-void BlkCmdRingBuffer::evictGrants()
+BlkCmdRingBuffer::BlkCmdRingBuffer(domid_t domId,
+                                   uint16_t devId,
+                                   uint32_t queue,
+                                   uint32_t nrQueues,
+                                   evtchn_port_t port,
+                                   const std::vector<grant_ref_t> &refs,
+                                   std::shared_ptr<DiskImage> diskImage,
+                                   const BlkDeviceConfig &config,
+                                   std::shared_ptr<WorkerPool> workers,
+                                   std::shared_ptr<QosLimiter> qos,
+                                   uint32_t flow,
+                                   std::shared_ptr<GrantBudget> budget) :
+    mLog("InRingBuffer"),
+    mDomId(domId),
+    mPort(port),
+    mQueue(queue),
+    mBuffer(domId, refs.data(), refs.size()),
+    mImage(diskImage),
+    mGrants(domId, config.grantCachePolicy, 0U, 0U),
+    mIndirectGrants(domId, GrantCachePolicyType::LRU, 0U, 1U),
+    mBudget(budget),
+    mNrQueues(nrQueues),
+    mMergeSectors(config.mergeSectors),
+    mSplitSectors(config.splitSectors),
+    mMaxSegments(maxIndirectSegments(config)),
+    mIndirectPages(div_round_up(mMaxSegments, SEGMENTS_PER_INDIRECT_PAGE)),
+    mBudgetShares(grantBudgetShares(config)),
+    mPoller(config.pollUs),
+    mCoalescer(config.notifyBatch, config.notifyDelayUs, config.notifyAdaptive,
+               [this] { this->onNotifyTimeout(); }),
+    mWorkers(workers),
+    mFlow(flow),
+    mQos(qos),
+    mUnblock([this] { mRetryTimer.arm(DeadlineTimer::clock::now()); }),
+    mRetryTimer([this] { this->onRetry(); })
 {
-    while (mGntLru.size() > (MAX_PGRANTS_PER_FRONTEND - GRANT_EVICTION_SIZE)) {
-        GntPage page = mGntLru.back();
-        page.unmap();
-        mGntMap.erase(page.gref());
-        mGntLru.pop_back();
+    BACK_RING_INIT(&mRing, static_cast<blkif_sring_t *>(mBuffer.get()),
+                   refs.size() * XC_PAGE_SIZE);
+
+    mInFlight.reset(new BlkRequest[RING_SIZE(&mRing)]);
+
+    // A slot is never queued twice, so this never fills up
+    if (mWorkers) {
+        mFinished.reset(new MpscQueue<uint32_t>(RING_SIZE(&mRing)));
+    }
+    mSegments.resize(mMaxSegments);
+    mLinearGrefs.resize(mMaxSegments);
+
+    this->fitGrantBudget();
+
+    for (uint32_t slot = RING_SIZE(&mRing); slot != 0U; slot--) {
+        mFreeSlots.push_back(slot - 1U);
+    }
+
+    if (config.linearMapPages != 0U) {
+        mLinear.reset(new BlkLinearMapCache(domId,
+                                            minimum(config.linearMapPages / nrQueues,
+                                                    mGrants.capacity())));
+    }
+
+    if (!config.grantTrace.empty()) {
+        // Each queue of a multi-queue device gets its own trace
+        const std::string path = nrQueues == 1U ? config.grantTrace :
+            config.grantTrace + "." + std::to_string(queue);
+
+        mTrace.reset(new GrantTraceWriter(path, domId, devId));
+
+        if (!mTrace->good()) {
+            LOG(mLog, ERROR) << "Failed to open grant trace " << path;
+            mTrace.reset();
+        }
     }
+
+    LOG(mLog, DEBUG) << "Created blkif ring: frontend: " << domId
+                     << ", queue: " << queue
+                     << ", ring size: "
+                     << RING_SIZE(&mRing)
+                     << ", grant cache: "
+                     << grantCachePolicyName(config.grantCachePolicy);
 }
 
-void BlkCmdRingBuffer::freeGrants()
+BlkCmdRingBuffer::~BlkCmdRingBuffer()
 {
-    for (auto &page : mGntLru) {
-        page.unmap();
+    // No more indications, whichever thread delivers them
+    this->stop();
+
+    if (mLimit) {
+        mLimit->cancel(&mUnblock);
+    }
+
+    mCoalescer.stop();
+    mRetryTimer.stop();
+
+    if (mWorkers) {
+        this->waitForWorkers();
+
+        // Requests held behind a flush or by the rate limits are dropped
+        // with the ring
+        std::lock_guard<std::mutex> ring(mRingMutex);
+        mHeld.clear();
+        mThrottled.clear();
+        this->completeFinished();
+    }
+
+    // Requests never answered give their room back
+    if (mLimit && mAcquired != 0U) {
+        mLimit->release(mAcquired);
+    }
+
+    const auto &stats = mGrants.stats();
+    const auto &indirect = mIndirectGrants.stats();
+
+    LOG(mLog, INFO) << "Grant cache (" << grantCachePolicyName(mGrants.policy())
+                    << ") for frontend " << mDomId << ": "
+                    << stats.hits << " hits, "
+                    << stats.misses << " misses, "
+                    << stats.evictions << " evictions";
+
+    LOG(mLog, INFO) << "Indirect page cache for frontend " << mDomId << ": "
+                    << indirect.hits << " hits, "
+                    << indirect.misses << " misses, "
+                    << indirect.evictions << " evictions";
+
+    if (mLinear) {
+        const auto &linear = mLinear->stats();
+
+        LOG(mLog, INFO) << "Linear maps for frontend " << mDomId << ": "
+                        << linear.hits << " hits, "
+                        << linear.misses << " misses, "
+                        << linear.evictions << " evictions";
+    }
+
+    if (mNode >= 0) {
+        LOG(mLog, INFO) << "NUMA node " << mNode << " for frontend " << mDomId
+                        << ": request table on node "
+                        << numaNodeOfAddress(mInFlight.get());
+    }
+
+    if (mRemoteMemory) {
+        LOG(mLog, INFO) << "I/O on frontend " << mDomId << " memory off its node: "
+                        << mRemoteBytes.load() << " bytes";
+    }
+
+    const auto &notify = mCoalescer.stats();
+
+    LOG(mLog, INFO) << "Notifications to frontend " << mDomId << ": "
+                    << notify.notifies << " for "
+                    << notify.responses << " responses ("
+                    << notify.timerNotifies << " after a delay)";
+
+    if (mThrottledCount != 0U) {
+        LOG(mLog, INFO) << "Requests throttled for frontend " << mDomId << ": "
+                        << mThrottledCount;
+    }
+
+    if (mBlockedCount != 0U) {
+        LOG(mLog, INFO) << "Ring left full by the in-flight limits for frontend "
+                        << mDomId << ": " << mBlockedCount << " times";
+    }
+
+    if (mMergeSectors != 0U) {
+        LOG(mLog, INFO) << "Requests merged for frontend " << mDomId << ": "
+                        << mMerged;
     }
 
-    mGntLru.clear();
-    mGntMap.clear();
+    if (mSplit != 0U) {
+        LOG(mLog, INFO) << "Requests split for frontend " << mDomId << ": "
+                        << mSplit;
+    }
+
+    if (mPoller.enabled()) {
+        const auto &poll = mPoller.stats();
+        const auto lifetime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - mCreated).count();
+
+        LOG(mLog, INFO) << "Polling for frontend " << mDomId << ": "
+                        << poll.hits << " hits, "
+                        << poll.misses << " misses, "
+                        << poll.spentNs / 1000000U << " ms spinning ("
+                        << (lifetime > 0 ? 100U * poll.spentNs / uint64_t(lifetime) : 0U)
+                        << "% of a cpu)";
+    }
+}
+
+RetainedGrants BlkCmdRingBuffer::retainGrants() const
+{
+    return RetainedGrants{mGrants.resident(), mIndirectGrants.resident()};
+}
+
+void BlkCmdRingBuffer::warmGrants(const RetainedGrants &grants)
+{
+    const uint64_t data = mGrants.warm(grants.data);
+    const uint64_t indirect = mIndirectGrants.warm(grants.indirect);
+
+    LOG(mLog, INFO) << "Warmed grant cache for frontend " << mDomId << ": "
+                    << data << "/" << grants.data.size() << " data, "
+                    << indirect << "/" << grants.indirect.size() << " indirect";
+}
+
+void BlkCmdRingBuffer::placeOn(const std::vector<uint32_t> &cpus, int32_t node)
+{
+    mCpus = cpus;
+    mNode = node;
+    mPlacePending = true;
+}
+
+void BlkCmdRingBuffer::runOn(std::shared_ptr<Reactor> reactor, uint32_t turn)
+{
+    mReactor = reactor;
+    mTurn = turn;
 }
 
-void *BlkCmdRingBuffer::mapGrant(const grant_ref_t gref)
+void BlkCmdRingBuffer::limitInFlight(std::shared_ptr<InFlightLimit> limit)
 {
-    GntPage page{gref};
+    mLimit = limit;
+}
+
+void BlkCmdRingBuffer::start()
+{
+#ifndef _WIN32
+    if (mReactor && !mEventChannel) {
+        if (!mReactorChannel) {
+            mReactorChannel.reset(new ReactorChannel(mReactor, mDomId, mPort,
+                [this] { return this->onReceiveIndication(); }));
+        }
+
+        if (mReactorChannel->start()) {
+            return;
+        }
+
+        LOG(mLog, WARNING) << "Reactor can't wait on port " << mPort
+                           << ", the ring gets a thread of its own";
 
-    if (!page.map(mDomId)) {
-        LOG(mLog, ERROR) << "Failed to map gref " << gref << '\n';
-        return nullptr;
+        mReactorChannel.reset();
     }
+#endif
+
+    if (!mEventChannel) {
+        mEventChannel.reset(new XenBackend::XenEvtchn(mDomId, mPort,
+            [this] { this->onReceiveIndication(); },
+            [this](const std::exception &e) { LOG(mLog, ERROR) << e.what(); }));
+    }
+
+    mEventChannel->start();
+}
 
-    void *virt = page.addr();
+void BlkCmdRingBuffer::stop()
+{
+#ifndef _WIN32
+    if (mReactorChannel) {
+        mReactorChannel->stop();
+    }
+#endif
 
-    mGntLru.push_front(page);
-    auto [_, inserted] = mGntMap.try_emplace(gref, mGntLru.begin());
+    if (mEventChannel) {
+        mEventChannel->stop();
+    }
+}
 
-    if (!inserted) {
-        LOG(mLog, ERROR) << "Failed to emplace gref " << gref << '\n';
-        page.unmap();
-        return nullptr;
+void BlkCmdRingBuffer::notifyFrontend()
+{
+#ifndef _WIN32
+    if (mReactorChannel) {
+        mReactorChannel->notify();
+        return;
     }
+#endif
 
-    return virt;
+    if (mEventChannel) {
+        mEventChannel->notify();
+    }
 }
 
-void *BlkCmdRingBuffer::addGrant(const grant_ref_t gref)
+void *BlkCmdRingBuffer::addGrant(const grant_ref_t gref, bool indirect)
 {
-    auto map_itr = mGntMap.find(gref);
+    if (mTrace) {
+        mTrace->record(gref, indirect);
+    }
+
+    void *addr = indirect ? mIndirectGrants.get(gref) : mGrants.get(gref);
 
-    if (map_itr != mGntMap.end()) {
-        mGntLru.splice(mGntLru.begin(), mGntLru, map_itr->second);
-        return map_itr->second->addr();
+    if (!addr) {
+        LOG(mLog, ERROR) << "Failed to map gref " << gref;
     }
 
-    if (mGntLru.size() == MAX_PGRANTS_PER_FRONTEND) {
-        this->evictGrants();
+    return addr;
+}
+
+// How the segments of a request lie within their pages. Only the first
+// segment of a contiguous request may start inside a page and only the
+// last may end inside one, so the data is one run once mapped linearly.
+enum class SegmentLayout {
+    INVALID,
+    FULL_PAGES,
+    CONTIGUOUS,
+    SCATTERED,
+};
+
+static SegmentLayout segmentLayout(const blkif_request_segment *segments,
+                                   uint32_t nr_segments) noexcept
+{
+    bool full = true;
+    bool contiguous = true;
+
+    for (uint32_t i = 0U; i < nr_segments; i++) {
+        const blkif_request_segment *const seg = &segments[i];
+
+        if (!validSegment(seg)) {
+            return SegmentLayout::INVALID;
+        }
+
+        const bool starts = seg->first_sect == 0U;
+        const bool ends = seg->last_sect == SECTORS_PER_PAGE - 1U;
+
+        full = full && starts && ends;
+        contiguous = contiguous && (starts || i == 0U) &&
+                     (ends || i == nr_segments - 1U);
     }
 
-    return this->mapGrant(gref);
+    return full ? SegmentLayout::FULL_PAGES :
+        contiguous ? SegmentLayout::CONTIGUOUS : SegmentLayout::SCATTERED;
 }
 
-int BlkCmdRingBuffer::processSegment(const blkif_request_segment *const seg,
-                                     const blkif_sector_t start_sector,
-                                     const uint32_t nr_sectors,
-                                     const bool write)
+// Maps the segments of a contiguous request as one linear buffer. Returns
+// false if the request must be handled one segment at a time.
+template <bool FullPages>
+bool BlkCmdRingBuffer::prepareLinear(const blkif_request_segment *segments,
+                                     uint32_t nr_segments,
+                                     blkif_sector_t sector_number,
+                                     BlkRequest &request)
 {
-    auto buffer = reinterpret_cast<uint8_t *>(this->addGrant(seg->gref));
+    grant_ref_t *const grefs = mLinearGrefs.data();
+    uint64_t nr_sectors = FullPages ? nr_segments * SECTORS_PER_PAGE : 0U;
+
+    if (!mLinear || nr_segments < 2U || nr_segments > mMaxSegments) {
+        return false;
+    }
+
+    for (uint32_t i = 0U; i < nr_segments; i++) {
+        grefs[i] = segments[i].gref;
+
+        if (!FullPages) {
+            nr_sectors += segments[i].last_sect - segments[i].first_sect + 1U;
+        }
+
+        if (mTrace) {
+            mTrace->record(segments[i].gref, false);
+        }
+    }
+
+    auto buffer = reinterpret_cast<uint8_t *>(mLinear->get(grefs, nr_segments));
 
     if (!buffer) {
-        LOG(mLog, ERROR) << "Failed to add grant with gref " << seg->gref;
-        return BLKIF_RSP_ERROR;
+        return false;
     }
 
-    buffer += SECTOR_SIZE * seg->first_sect;
+    mLinear->pin(buffer);
+    request.linear = buffer;
+    request.sector = sector_number;
+    request.nrSectors = nr_sectors;
 
-    if (write) {
-        return mImage->writeSectors(start_sector, nr_sectors, buffer);
-    } else {
-        return mImage->readSectors(start_sector, nr_sectors, buffer);
+    if (!FullPages) {
+        buffer += SECTOR_SIZE * segments[0].first_sect;
     }
+
+    request.io.push_back(DiskIoVec{buffer, nr_sectors});
+
+    return true;
 }
 
-int BlkCmdRingBuffer::handleReadWrite(const blkif_request_t &req)
+// Maps each segment on its own. Segments of whole pages skip the sector
+// arithmetic.
+template <bool FullPages>
+int BlkCmdRingBuffer::mapSegments(const blkif_request_segment *segments,
+                                  uint32_t nr_segments,
+                                  blkif_sector_t sector_number,
+                                  BlkRequest &request)
 {
-    const bool write = req.operation == BLKIF_OP_WRITE;
-    const uint8_t nr_segs = req.nr_segments;
-    uint64_t start_sector = req.sector_number;
+    request.sector = sector_number;
+    request.io.reserve(nr_segments);
+    request.pinned.reserve(nr_segments);
 
-    if (nr_segs == 0U || nr_segs > BLKIF_MAX_SEGMENTS_PER_REQUEST) {
-        return BLKIF_RSP_ERROR;
-    }
+    for (uint32_t i = 0U; i < nr_segments; i++) {
+        const blkif_request_segment *const seg = &segments[i];
+        auto buffer = reinterpret_cast<uint8_t *>(this->addGrant(seg->gref));
+
+        if (!buffer) {
+            LOG(mLog, ERROR) << "Failed to add grant with gref " << seg->gref;
+            return BLKIF_RSP_ERROR;
+        }
+
+        mGrants.pin(seg->gref);
+        request.pinned.push_back(seg->gref);
 
-    for (uint32_t i = 0U; i < nr_segs; i++) {
-        const blkif_request_segment *const seg = &req.seg[i];
-        const uint32_t nr_sectors = seg->last_sect - seg->first_sect + 1U;
+        if (FullPages) {
+            request.io.push_back(DiskIoVec{buffer, SECTORS_PER_PAGE});
+        } else {
+            const uint32_t nr_sectors = seg->last_sect - seg->first_sect + 1U;
 
-        const int rc = this->processSegment(seg, start_sector, nr_sectors, write);
-        if (rc != BLKIF_RSP_OKAY) {
-            return rc;
+            request.io.push_back(DiskIoVec{buffer + SECTOR_SIZE * seg->first_sect,
+                                           nr_sectors});
+            request.nrSectors += nr_sectors;
         }
+    }
 
-        start_sector += nr_sectors;
+    if (FullPages) {
+        request.nrSectors = nr_segments * SECTORS_PER_PAGE;
     }
 
     return BLKIF_RSP_OKAY;
 }
 
-int BlkCmdRingBuffer::handleIndirect(const blkif_request_indirect_t *indirect)
+int BlkCmdRingBuffer::prepareSegments(const blkif_request_segment *segments,
+                                      uint32_t nr_segments,
+                                      blkif_sector_t sector_number,
+                                      BlkRequest &request)
+{
+    switch (segmentLayout(segments, nr_segments)) {
+    case SegmentLayout::FULL_PAGES:
+        if (this->prepareLinear<true>(segments, nr_segments, sector_number, request)) {
+            return BLKIF_RSP_OKAY;
+        }
+
+        return this->mapSegments<true>(segments, nr_segments, sector_number, request);
+    case SegmentLayout::CONTIGUOUS:
+        if (this->prepareLinear<false>(segments, nr_segments, sector_number, request)) {
+            return BLKIF_RSP_OKAY;
+        }
+
+        return this->mapSegments<false>(segments, nr_segments, sector_number, request);
+    case SegmentLayout::SCATTERED:
+        return this->mapSegments<false>(segments, nr_segments, sector_number, request);
+    case SegmentLayout::INVALID:
+        break;
+    }
+
+    LOG(mLog, ERROR) << "Request has an invalid segment";
+
+    return BLKIF_RSP_ERROR;
+}
+
+int BlkCmdRingBuffer::prepareReadWrite(const blkif_request_t &req,
+                                       BlkRequest &request)
+{
+    const uint8_t nr_segs = req.nr_segments;
+
+    if (nr_segs == 0U || nr_segs > BLKIF_MAX_SEGMENTS_PER_REQUEST) {
+        return BLKIF_RSP_ERROR;
+    }
+
+    return this->prepareSegments(req.seg, nr_segs, req.sector_number, request);
+}
+
+int BlkCmdRingBuffer::prepareIndirect(const blkif_request_indirect_t *indirect,
+                                      BlkRequest &request)
 {
     const uint16_t op = indirect->indirect_op;
     const uint16_t total_segments = indirect->nr_segments;
@@ -214,21 +614,22 @@ int BlkCmdRingBuffer::handleIndirect(const blkif_request_indirect_t *indirect)
         return BLKIF_RSP_ERROR;
     }
 
-    if (total_segments > MAX_INDIRECT_SEGMENTS) {
+    if (total_segments > mMaxSegments) {
         LOG(mLog, ERROR) << "Indirect request has too many segments ("
                          << total_segments << ")";
         return BLKIF_RSP_ERROR;
     }
 
-    blkif_sector_t start_sector = indirect->sector_number;
+    // Copy the descriptors out of the indirect pages so the frontend can't
+    // change them while the request is processed
+    blkif_request_segment *const segments = mSegments.data();
     uint64_t segments_done = 0U;
-    const bool write = (op == BLKIF_OP_WRITE);
     const uint64_t nr_indirect_grefs = div_round_up(total_segments,
                                                     SEGMENTS_PER_INDIRECT_PAGE);
 
     for (uint64_t i = 0U; i < nr_indirect_grefs; i++) {
         const grant_ref_t gref = indirect->indirect_grefs[i];
-        auto seg = reinterpret_cast<const blkif_request_segment *const>(this->addGrant(gref));
+        auto seg = reinterpret_cast<const blkif_request_segment *>(this->addGrant(gref, true));
 
         if (!seg) {
             return BLKIF_RSP_ERROR;
@@ -238,55 +639,54 @@ int BlkCmdRingBuffer::handleIndirect(const blkif_request_indirect_t *indirect)
         const uint64_t nr_segs = minimum(total_segments - segments_done,
                                          SEGMENTS_PER_INDIRECT_PAGE);
 
-        for (uint64_t n = 0U; n < nr_segs; n++) {
-            const uint32_t nr_sectors = seg[n].last_sect - seg[n].first_sect + 1U;
-            const int rc = this->processSegment(&seg[n],
-                                                start_sector,
-                                                nr_sectors,
-                                                write);
-            if (rc != BLKIF_RSP_OKAY) {
-                return rc;
-            }
-
-            start_sector += nr_sectors;
-        }
-
+        memcpy(&segments[segments_done], seg, nr_segs * sizeof(*seg));
         segments_done += nr_segs;
     }
 
-    return BLKIF_RSP_OKAY;
+    return this->prepareSegments(segments,
+                                 total_segments,
+                                 indirect->sector_number,
+                                 request);
 }
 
 static uint64_t cmd_count = 0;
 
-void BlkCmdRingBuffer::processRequest(const blkif_request& req)
+void BlkCmdRingBuffer::prepareRequest(const blkif_request& req,
+                                      BlkRequest &request)
 {
-    blkif_response rsp;
+    blkif_response_t &rsp = request.rsp;
     memset(&rsp, 0x00, sizeof(rsp));
 
     rsp.id = req.id;
     rsp.operation = req.operation;
     rsp.status = BLKIF_RSP_OKAY;
 
+    request.sector = 0U;
+    request.nrSectors = 0U;
+    request.io.clear();
+    request.pinned.clear();
+    request.linear = nullptr;
+    request.next = BlkRequest::NO_SLOT;
+
     switch (req.operation) {
     case BLKIF_OP_READ:
     case BLKIF_OP_WRITE:
-        rsp.status = this->handleReadWrite(req);
+        rsp.status = this->prepareReadWrite(req, request);
         break;
     case BLKIF_OP_WRITE_BARRIER:
     case BLKIF_OP_FLUSH_DISKCACHE:
-        mImage->flushBackingFile();
         break;
     case BLKIF_OP_DISCARD:
     {
         auto discard = reinterpret_cast<const blkif_request_discard_t *>(&req);
-        rsp.status = mImage->discard(discard->sector_number, discard->nr_sectors);
+        request.sector = discard->sector_number;
+        request.nrSectors = discard->nr_sectors;
         break;
     }
     case BLKIF_OP_INDIRECT:
     {
         auto indirect = reinterpret_cast<const blkif_request_indirect_t *>(&req);
-        rsp.status = this->handleIndirect(indirect);
+        rsp.status = this->prepareIndirect(indirect, request);
         rsp.operation = indirect->indirect_op;
         break;
     }
@@ -297,194 +697,1300 @@ void BlkCmdRingBuffer::processRequest(const blkif_request& req)
         rsp.status = BLKIF_RSP_EOPNOTSUPP;
         break;
     }
-
-    sendResponse(rsp);
 }
 
+void BlkCmdRingBuffer::executeRequest(BlkRequest &request)
+{
+    blkif_response_t &rsp = request.rsp;
 
-//! [onBind]
-void BlkFrontendHandler::onBind()
+    if (rsp.status != BLKIF_RSP_OKAY) {
+        return;
+    }
+
+    switch (rsp.operation) {
+    case BLKIF_OP_READ:
+    case BLKIF_OP_WRITE:
+        rsp.status = this->transfer(request, request.sector, request.io.data(),
+                                    request.io.size());
+        break;
+    case BLKIF_OP_WRITE_BARRIER:
+    case BLKIF_OP_FLUSH_DISKCACHE:
+        mImage->flushBackingFile();
+        break;
+    case BLKIF_OP_DISCARD:
+        rsp.status = mImage->discard(request.sector, request.nrSectors);
+        break;
+    }
+}
+
+int16_t BlkCmdRingBuffer::transfer(const BlkRequest &request,
+                                   blkif_sector_t sector,
+                                   const DiskIoVec *io,
+                                   size_t count)
 {
-    // get out ring buffer event channel port
-    evtchn_port_t port = getXenStore().readInt(getXsFrontendPath() + "/event-channel");
+    int16_t status;
 
-    // get out ring buffer grant table reference
-    uint32_t ref = getXenStore().readInt(getXsFrontendPath() + "/ring-ref");
+    if (request.rsp.operation == BLKIF_OP_WRITE) {
+        status = mImage->writeSectorsv(sector, io, count);
+    } else {
+        status = mImage->readSectorsv(sector, io, count);
+    }
 
-    std::string path = getXenStore().readString(getXsBackendPath() + "/params");
-    LOG(mLog, DEBUG) << "open image file: " << path;
+    if (mRemoteMemory && status == BLKIF_RSP_OKAY) {
+        uint64_t nr_sectors = 0U;
 
-    if (path.front() == '\'' && path.back() == '\'') {
-        if (path.size() > 2) {
-            path = path.substr(1, path.size() - 2);
+        for (size_t i = 0U; i < count; i++) {
+            nr_sectors += io[i].nr_sectors;
         }
+
+        mRemoteBytes.fetch_add(nr_sectors * SECTOR_SIZE, std::memory_order_relaxed);
     }
 
-    mImage = std::make_shared<DiskImage>(path);
+    return status;
+}
 
-    if (!mImage) {
-        LOG(mLog, ERROR) << "Failed to open image file: " << path;
-        throw;
+bool BlkCmdRingBuffer::splitRequest(BlkRequest &request)
+{
+    const uint16_t op = request.rsp.operation;
+
+    request.chunks.clear();
+    request.chunkIo.clear();
+
+    if (mSplitSectors == 0U || mWorkers->size() < 2U ||
+        (op != BLKIF_OP_READ && op != BLKIF_OP_WRITE) ||
+        request.nrSectors <= mSplitSectors) {
+        return false;
     }
 
-    getXenStore().writeInt(getXsBackendPath() + "/feature-max-indirect-segments", MAX_INDIRECT_SEGMENTS);
-    getXenStore().writeInt(getXsBackendPath() + "/feature-discard", 0);
-    getXenStore().writeInt(getXsBackendPath() + "/feature-persistent", 1);
-    getXenStore().writeInt(getXsBackendPath() + "/feature-flush-cache", 1);
-    getXenStore().writeInt(getXsBackendPath() + "/feature-barrier", 1);
+    // Cut the vectors at every mSplitSectors sectors, splitting those that
+    // straddle a cut in two
+    BlkChunk chunk{request.sector, 0U, 0U};
+    uint64_t room = mSplitSectors;
+
+    for (const DiskIoVec &vec : request.io) {
+        uint8_t *buffer = vec.buffer;
+        uint64_t left = vec.nr_sectors;
+
+        while (left != 0U) {
+            const uint64_t take = minimum(left, room);
+
+            request.chunkIo.push_back(DiskIoVec{buffer, take});
+            chunk.count++;
+            buffer += take * SECTOR_SIZE;
+            left -= take;
+            room -= take;
+
+            if (room == 0U) {
+                request.chunks.push_back(chunk);
+                chunk = BlkChunk{chunk.sector + mSplitSectors,
+                                 uint32_t(request.chunkIo.size()), 0U};
+                room = mSplitSectors;
+            }
+        }
+    }
 
-    getXenStore().writeInt(getXsBackendPath() + "/sectors", mImage->getSectorCount());
-    getXenStore().writeInt(getXsBackendPath() + "/sector-size", mImage->getSectorSize());
-    getXenStore().writeInt(getXsBackendPath() + "/info", 0);
+    if (chunk.count != 0U) {
+        request.chunks.push_back(chunk);
+    }
 
-    // create command ring buffer
-    mCmdRingBuffer.reset(new BlkCmdRingBuffer(getDomId(), port, ref, mImage));
+    request.chunksLeft.store(uint32_t(request.chunks.size()), std::memory_order_relaxed);
+    request.chunkStatus.store(BLKIF_RSP_OKAY, std::memory_order_relaxed);
+    mSplit++;
 
-    // add ring buffer
-    addRingBuffer(mCmdRingBuffer);
+    return true;
 }
-//! [onBind]
 
-//! [onClosing]
-void BlkFrontendHandler::onClosing()
+void BlkCmdRingBuffer::executeChunk(uint32_t slot, uint32_t chunk)
 {
-    LOG(mLog, DEBUG) << "onClosing called, freeing resources...";
+    BlkRequest &request = mInFlight[slot];
+    const BlkChunk &part = request.chunks[chunk];
+    const int16_t status = this->transfer(request, part.sector,
+                                          &request.chunkIo[part.first],
+                                          part.count);
 
-    // free allocate on bind resources
-    mCmdRingBuffer.reset();
-}
+    // The first chunk to fail answers for the whole request
+    if (status != BLKIF_RSP_OKAY) {
+        int16_t okay = BLKIF_RSP_OKAY;
 
-//! [onNewFrontend]
-void BlkBackend::onNewFrontend(domid_t domId, uint16_t devId)
-{
-    if (frontendCount >= MAX_FRONTENDS) {
-        LOG(mLog, ERROR) << "Unable to create new frontend (MAX_FRONTENDS="
-                         << MAX_FRONTENDS << ")\n";
-        return;
-    } else {
-        frontendCount++;
-        LOG(mLog, DEBUG) << "New frontend, dom id: " << domId;
+        request.chunkStatus.compare_exchange_strong(okay, status);
     }
 
-    // create new blk frontend handler
-    addFrontendHandler(FrontendHandlerPtr(new BlkFrontendHandler(getDeviceName(), domId, devId)));
+    if (request.chunksLeft.fetch_sub(1U, std::memory_order_acq_rel) == 1U) {
+        request.rsp.status = request.chunkStatus.load(std::memory_order_relaxed);
+        this->workerFinished(slot);
+    } else {
+        this->workerDone();
+    }
 }
-//! [onNewFrontend]
 
-void waitSignals()
+static bool isFence(const BlkRequest &request) noexcept
 {
-#ifndef _WIN32
-    sigset_t set;
-    int signal;
+    return request.rsp.operation == BLKIF_OP_FLUSH_DISKCACHE ||
+           request.rsp.operation == BLKIF_OP_WRITE_BARRIER;
+}
 
-    sigemptyset(&set);
-    sigaddset(&set, SIGINT);
-    sigaddset(&set, SIGTERM);
-    sigprocmask(SIG_BLOCK, &set, nullptr);
+void BlkCmdRingBuffer::admitRequest(uint32_t slot)
+{
+    // Nothing overtakes a deferred request
+    if (mQos && (!mThrottled.empty() || !this->takeTokens(slot))) {
+        mThrottled.push_back(slot);
+        mThrottledCount++;
+        return;
+    }
 
-    sigwait(&set,&signal);
-#else
-    HANDLE h = CreateEvent(NULL, FALSE, FALSE, TEXT("STOPTHREAD"));
-    WaitForSingleObject(h, INFINITE);
-#endif
+    this->submitRequest(slot);
 }
 
-static inline int set_affinity(uint64_t core)
+bool BlkCmdRingBuffer::takeTokens(uint32_t slot)
 {
-#ifdef _WIN32
-    if (SetProcessAffinityMask(GetCurrentProcess(), 1ULL << core) == 0) {
-        return -1;
+    const BlkRequest &request = mInFlight[slot];
+    const uint16_t op = request.rsp.operation;
+
+    if (!mQos->limited() || request.rsp.status != BLKIF_RSP_OKAY ||
+        (op != BLKIF_OP_READ && op != BLKIF_OP_WRITE)) {
+        return true;
     }
 
-    return 0;
-#else
-    cpu_set_t  mask;
+    uint32_t requests = 0U;
 
-    CPU_ZERO(&mask);
-    CPU_SET(core, &mask);
+    for (uint32_t merged = slot; merged != BlkRequest::NO_SLOT;
+         merged = mInFlight[merged].next) {
+        requests++;
+    }
+
+    const auto wait = mQos->admit(op == BLKIF_OP_WRITE, requests,
+                                  request.nrSectors * SECTOR_SIZE);
 
-    if (sched_setaffinity(0, sizeof(mask), &mask) != 0) {
-        return -1;
+    if (wait.count() == 0) {
+        return true;
     }
 
-    return 0;
-#endif
+    mRetryTimer.arm(DeadlineTimer::clock::now() + wait);
+
+    return false;
+}
+
+void BlkCmdRingBuffer::releaseThrottled()
+{
+    while (!mThrottled.empty() && this->takeTokens(mThrottled.front())) {
+        const uint32_t slot = mThrottled.front();
+
+        mThrottled.pop_front();
+        this->submitRequest(slot);
+    }
 }
 
-//! [main]
-int main(int argc, char *argv[])
+void BlkCmdRingBuffer::onRetry()
 {
-    try
+    bool blocked;
+
     {
-        frontendCount = 0;
+        std::lock_guard<std::mutex> ring(mRingMutex);
 
-        auto args = parseArgs(argc, argv);
-        if (args.count("affinity")) {
-                uint64_t cpu = args["affinity"].as<uint64_t>();
+        this->releaseThrottled();
 
-                if (set_affinity(cpu)) {
-                        LOG("Main", ERROR) << "Failed to set affinity to cpu "
-                                           << cpu;
-                        throw;
-                }
-        } else {
-#ifdef _WIN32
-                SYSTEM_INFO info;
-                ZeroMemory(&info, sizeof(SYSTEM_INFO));
-                GetSystemInfo(&info);
-                auto nr_cpus = info.dwNumberOfProcessors;
-#else
-                auto nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
-#endif
-                if (set_affinity(nr_cpus - 1)) {
-                        LOG("Main", ERROR) << "Failed to set affinity to cpu "
-                                           << nr_cpus - 1;
-                        throw;
-                }
+        if (mWorkers) {
+            this->completeFinished();
         }
 
-#ifdef _WIN32
-        if (args.count("windows-svc")) {
-            if (copyArgs(argc, argv)) {
-                LOG("Main", ERROR) << "Failed to copy args for Windows service\n";
-                exit(EXIT_FAILURE);
+        this->publishResponses();
+        blocked = mBlocked;
+    }
+
+    // As onReceiveIndication() would have if the limits hadn't stopped it
+    int more_to_do = blocked ? 1 : 0;
+
+    while (more_to_do && !this->consumeRequests()) {
+        std::lock_guard<std::mutex> ring(mRingMutex);
+        RING_FINAL_CHECK_FOR_REQUESTS(&mRing, more_to_do);
+    }
+
+    if (mWorkers) {
+        this->drainCompletions();
+    }
+}
+
+void BlkCmdRingBuffer::submitRequest(uint32_t slot)
+{
+    BlkRequest &request = mInFlight[slot];
+
+    // Errors are answered straight away, nothing to order them against
+    if (request.rsp.status != BLKIF_RSP_OKAY) {
+        this->completeRequest(slot);
+        return;
+    }
+
+    // A flush or barrier waits for everything before it to finish, and
+    // everything after it waits for it
+    if (!mHeld.empty() || mFenceRunning || (isFence(request) && mRunning != 0U)) {
+        mHeld.push_back(slot);
+        return;
+    }
+
+    this->startRequest(slot);
+}
+
+void BlkCmdRingBuffer::startRequest(uint32_t slot)
+{
+    BlkRequest &request = mInFlight[slot];
+
+    mRunning++;
+    mFenceRunning = isFence(request);
+
+    if (!mWorkers) {
+        this->executeRequest(request);
+        this->finishRequest(slot);
+        return;
+    }
+
+    if (this->splitRequest(request)) {
+        const uint32_t chunks = uint32_t(request.chunks.size());
+
+        mOutstanding.fetch_add(chunks, std::memory_order_relaxed);
+
+        for (uint32_t chunk = 0U; chunk < chunks; chunk++) {
+            mWorkers->submit(mFlow, [this, slot, chunk] {
+                this->executeChunk(slot, chunk);
+            });
+        }
+
+        return;
+    }
+
+    mOutstanding.fetch_add(1U, std::memory_order_relaxed);
+
+    mWorkers->submit(mFlow, [this, slot] {
+        this->executeRequest(mInFlight[slot]);
+        this->workerFinished(slot);
+    });
+}
+
+void BlkCmdRingBuffer::startHeld()
+{
+    while (!mHeld.empty() && !mFenceRunning) {
+        const uint32_t slot = mHeld.front();
+
+        if (isFence(mInFlight[slot]) && mRunning != 0U) {
+            break;
+        }
+
+        mHeld.pop_front();
+        this->startRequest(slot);
+    }
+}
+
+void BlkCmdRingBuffer::finishRequest(uint32_t slot)
+{
+    if (isFence(mInFlight[slot])) {
+        mFenceRunning = false;
+    }
+
+    mRunning--;
+    this->completeRequest(slot);
+}
+
+void BlkCmdRingBuffer::completeRequest(uint32_t slot)
+{
+    const int16_t status = mInFlight[slot].rsp.status;
+
+    while (slot != BlkRequest::NO_SLOT) {
+        BlkRequest &request = mInFlight[slot];
+        const uint32_t next = request.next;
+
+        for (const grant_ref_t gref : request.pinned) {
+            mGrants.unpin(gref);
+        }
+
+        if (request.linear) {
+            mLinear->unpin(request.linear);
+        }
+
+        request.rsp.status = status;
+        request.next = BlkRequest::NO_SLOT;
+
+        this->queueResponse(request.rsp);
+        mFreeSlots.push_back(slot);
+
+        if (mLimit) {
+            mLimit->release();
+            mAcquired--;
+        }
+
+        slot = next;
+    }
+}
+
+void BlkCmdRingBuffer::waitForWorkers()
+{
+    std::unique_lock<std::mutex> lock(mIdleMutex);
+
+    mIdle.wait(lock, [this] { return mOutstanding == 0U; });
+}
+
+void BlkCmdRingBuffer::completeFinished()
+{
+    const size_t finished = mFinished->drain([this](uint32_t slot) {
+        this->finishRequest(slot);
+    });
+
+    if (finished != 0U) {
+        this->startHeld();
+    }
+}
+
+void BlkCmdRingBuffer::workerFinished(uint32_t slot)
+{
+    while (!mFinished->push(slot)) {
+        std::this_thread::yield();
+    }
+
+    // Pairs with the fence in drainCompletions(): either this thread gets
+    // the ring lock or the holder sees the slot once it lets go
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    this->drainCompletions();
+    this->workerDone();
+}
+
+void BlkCmdRingBuffer::workerDone()
+{
+    uint32_t outstanding = mOutstanding.load(std::memory_order_relaxed);
+
+    // Anything but the last task leaves without the lock, waitForWorkers()
+    // can't return before the last one is done
+    while (outstanding > 1U &&
+           !mOutstanding.compare_exchange_weak(outstanding, outstanding - 1U,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+    }
+
+    if (outstanding > 1U) {
+        return;
+    }
+
+    // Last use of this ring by the worker, it may be destroyed as soon as
+    // the lock is released
+    std::lock_guard<std::mutex> lock(mIdleMutex);
+    mOutstanding.fetch_sub(1U, std::memory_order_release);
+    mIdle.notify_all();
+}
+
+void BlkCmdRingBuffer::drainCompletions()
+{
+    while (true) {
+        {
+            std::unique_lock<std::mutex> ring(mRingMutex, std::try_to_lock);
+
+            // The holder checks for finished requests after releasing the
+            // lock, so it will see any queued before this attempt
+            if (!ring.owns_lock()) {
+                return;
             }
 
-            serviceStart();
-            freeArgs();
+            this->completeFinished();
+            this->publishResponses();
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (mFinished->empty()) {
+            return;
+        }
+    }
+}
+
+void BlkCmdRingBuffer::queueResponse(const blkif_response_t &rsp)
+{
+    *RING_GET_RESPONSE(&mRing, mRing.rsp_prod_pvt) = rsp;
+    mRing.rsp_prod_pvt++;
+}
+
+void BlkCmdRingBuffer::publishResponses()
+{
+    const RING_IDX count = mRing.rsp_prod_pvt - mRing.sring->rsp_prod;
+    int notify = 0;
+
+    RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(&mRing, notify);
+
+    if (mCoalescer.published(count, notify != 0,
+                             mRing.req_cons - mRing.rsp_prod_pvt)) {
+        this->notifyFrontend();
+    }
+}
+
+void BlkCmdRingBuffer::onNotifyTimeout()
+{
+    {
+        std::lock_guard<std::mutex> ring(mRingMutex);
+
+        if (mCoalescer.expired()) {
+            this->notifyFrontend();
+        }
+    }
+
+    // A worker finishing while the lock was held here left its request
+    if (mWorkers) {
+        this->drainCompletions();
+    }
+}
+
+bool BlkCmdRingBuffer::mergeRequest(uint32_t head, uint32_t tail, uint32_t slot)
+{
+    BlkRequest &first = mInFlight[head];
+    const BlkRequest &request = mInFlight[slot];
+    const uint16_t op = first.rsp.operation;
+
+    if ((op != BLKIF_OP_READ && op != BLKIF_OP_WRITE) ||
+        request.rsp.operation != op ||
+        first.rsp.status != BLKIF_RSP_OKAY ||
+        request.rsp.status != BLKIF_RSP_OKAY ||
+        request.sector != first.sector + first.nrSectors ||
+        first.nrSectors + request.nrSectors > mMergeSectors) {
+        return false;
+    }
+
+    // Past the end of the image the chain stops, so only the request that
+    // runs off it fails
+    const uint64_t sectors = mImage->getSectorCount();
+
+    if (first.nrSectors + request.nrSectors > sectors ||
+        first.sector > sectors - first.nrSectors - request.nrSectors) {
+        return false;
+    }
+
+    first.io.insert(first.io.end(), request.io.begin(), request.io.end());
+    first.nrSectors += request.nrSectors;
+    mInFlight[tail].next = slot;
+    mMerged++;
 
-            exit(EXIT_SUCCESS);
+    return true;
+}
+
+void BlkCmdRingBuffer::fitGrantBudget()
+{
+    // Read before the share so a change in between is caught next time
+    mBudgetGeneration = mBudget ? mBudget->generation() : 0U;
+
+    const uint64_t devicePgrants = mBudget ? mBudget->share(mBudgetShares) :
+        mBudgetShares * MAX_PGRANTS_PER_FRONTEND;
+    const uint64_t pgrants = pgrantsPerRing(devicePgrants, mNrQueues);
+    const uint64_t data = dataPgrantsPerRing(pgrants, RING_SIZE(&mRing), mIndirectPages);
+
+    mGrants.resize(data, grantEvictionSize(data));
+    mIndirectGrants.resize(indirectPgrantsPerRing(pgrants, RING_SIZE(&mRing),
+                                                  mIndirectPages), 1U);
+}
+
+bool BlkCmdRingBuffer::consumeRequests(uint32_t limit)
+{
+    std::lock_guard<std::mutex> ring(mRingMutex);
+
+    // Other devices may have come or gone since the last batch
+    if (mBudget && mBudget->generation() != mBudgetGeneration) {
+        this->fitGrantBudget();
+    }
+
+    RING_IDX rc = mRing.req_cons;
+    const RING_IDX rp = mRing.sring->req_prod;
+
+    // The request adjacent ones are being merged into, and the last of
+    // them
+    uint32_t head = BlkRequest::NO_SLOT;
+    uint32_t tail = BlkRequest::NO_SLOT;
+
+    // Requests the limits held back go before anything new
+    if (!mThrottled.empty()) {
+        this->releaseThrottled();
+    }
+
+    // Read the requests only after seeing req_prod
+    xen_rmb();
+
+    for (uint32_t consumed = 0U; rc != rp && (limit == 0U || consumed < limit); consumed++) {
+        if (RING_REQUEST_CONS_OVERFLOW(&mRing, rc)) {
+            break;
         }
 
-        if (args.count("high-priority")) {
-            if (!SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS)) {
-                LOG("Main", INFO) << "Failed to set high priority\n";
+        // Over the limits the rest stays on the ring until a request
+        // completes, and the frontend finds the ring full
+        if (mLimit) {
+            if (!mLimit->acquire(&mUnblock)) {
+                if (!mBlocked) {
+                    mBlockedCount++;
+                }
+
+                mBlocked = true;
+                break;
             }
+
+            mAcquired++;
+        }
+
+        mBlocked = false;
+
+        const blkif_request_t req = *RING_GET_REQUEST(&mRing, rc);
+        mRing.req_cons = ++rc;
+
+        // Never runs dry: a slot is used per request consumed and freed
+        // when its response is written, and the ring can't hold more
+        // unanswered requests than it has slots
+        const uint32_t slot = mFreeSlots.back();
+        mFreeSlots.pop_back();
+
+        this->prepareRequest(req, mInFlight[slot]);
+
+        if (head != BlkRequest::NO_SLOT && this->mergeRequest(head, tail, slot)) {
+            tail = slot;
+            continue;
+        }
+
+        if (head != BlkRequest::NO_SLOT) {
+            this->admitRequest(head);
+        }
+
+        head = slot;
+        tail = slot;
+    }
+
+    if (head != BlkRequest::NO_SLOT) {
+        this->admitRequest(head);
+    }
+
+    // One push and at most one kick for everything completed above
+    if (mWorkers) {
+        this->completeFinished();
+    }
+
+    this->publishResponses();
+
+    return rc != rp && mBlocked;
+}
+
+bool BlkCmdRingBuffer::onReceiveIndication()
+{
+    int more_to_do = 0;
+    bool yielded = false;
+
+    // The event channel thread is only ours once it calls in
+    if (mPlacePending) {
+        if (!mCpus.empty() && !setThreadAffinity(mCpus)) {
+            LOG(mLog, ERROR) << "Failed to place queue " << mQueue
+                             << " on cpus " << cpuListString(mCpus);
+        }
+
+        if (mNode >= 0 && !setThreadMemoryNode(mNode)) {
+            LOG(mLog, ERROR) << "Failed to allocate queue " << mQueue
+                             << " memory from NUMA node " << mNode;
+        }
+
+        mPlacePending = false;
+    }
+
+    mPoller.woken();
+
+    const RING_IDX start = mRing.req_cons;
+
+    do {
+        const uint32_t taken = mRing.req_cons - start;
+
+        // Turn used up with requests left: the other rings on the reactor
+        // thread go next, and this one comes back for the rest
+        if (mTurn != 0U && taken >= mTurn) {
+            yielded = true;
+            break;
+        }
+
+        // Blocked by the in-flight limits: the retry timer carries on
+        if (this->consumeRequests(mTurn != 0U ? mTurn - taken : 0U)) {
+            break;
+        }
+
+        // Without re-arming req_event, so the frontend doesn't kick the
+        // event channel for requests found by polling
+        if (mPoller.poll([this] { return RING_HAS_UNCONSUMED_REQUESTS(&mRing) != 0; })) {
+            more_to_do = 1;
+            continue;
+        }
+
+        std::lock_guard<std::mutex> ring(mRingMutex);
+        RING_FINAL_CHECK_FOR_REQUESTS(&mRing, more_to_do);
+    } while (more_to_do);
+
+    mPoller.sleeping();
+
+    // Pick up whatever the workers finished while the lock was held
+    if (mWorkers) {
+        this->drainCompletions();
+    }
+
+    return yielded;
+}
+
+
+BlkDeviceConfig BlkFrontendHandler::readConfig()
+{
+    BlkDeviceConfig config = mDefaults;
+    const std::string path = getXsBackendPath();
+
+    if (getXenStore().checkIfExist(path + "/grant-cache-policy")) {
+        const auto name = getXenStore().readString(path + "/grant-cache-policy");
+
+        if (!parseGrantCachePolicy(name, config.grantCachePolicy)) {
+            LOG(mLog, WARNING) << "Unknown grant cache policy " << name
+                               << ", using "
+                               << grantCachePolicyName(config.grantCachePolicy);
+        }
+    }
+
+    if (getXenStore().checkIfExist(path + "/grant-trace")) {
+        config.grantTrace = getXenStore().readString(path + "/grant-trace");
+    } else if (!config.grantTraceDir.empty()) {
+        config.grantTrace = config.grantTraceDir + "/grants-" +
+                            std::to_string(getDomId()) + "-" +
+                            std::to_string(getDevId()) + ".trace";
+    }
+
+    if (getXenStore().checkIfExist(path + "/linear-map-pages")) {
+        config.linearMapPages = getXenStore().readUint(path + "/linear-map-pages");
+    }
+
+    if (getXenStore().checkIfExist(path + "/grant-warmup")) {
+        config.grantWarmup = getXenStore().readInt(path + "/grant-warmup") != 0;
+    }
+
+    if (getXenStore().checkIfExist(path + "/max-queues")) {
+        config.maxQueues = getXenStore().readUint(path + "/max-queues");
+    }
+
+    if (getXenStore().checkIfExist(path + "/max-ring-order")) {
+        config.maxRingPageOrder = getXenStore().readUint(path + "/max-ring-order");
+    }
+
+    if (getXenStore().checkIfExist(path + "/max-indirect-segments")) {
+        config.maxIndirectSegments = getXenStore().readUint(path + "/max-indirect-segments");
+    }
+
+    if (getXenStore().checkIfExist(path + "/workers")) {
+        config.workers = getXenStore().readUint(path + "/workers");
+    }
+
+    if (getXenStore().checkIfExist(path + "/max-in-flight")) {
+        config.maxInFlight = getXenStore().readUint(path + "/max-in-flight");
+    }
+
+    if (getXenStore().checkIfExist(path + "/weight")) {
+        const unsigned int weight = getXenStore().readUint(path + "/weight");
+
+        // A turn of 0 would let the device take everything
+        if (weight == 0U) {
+            LOG(mLog, WARNING) << "Invalid weight 0, ignored";
+        } else {
+            config.weight = weight;
         }
+    }
+
+    if (getXenStore().checkIfExist(path + "/poll-us")) {
+        config.pollUs = getXenStore().readUint(path + "/poll-us");
+    }
+
+    if (getXenStore().checkIfExist(path + "/notify-batch")) {
+        config.notifyBatch = getXenStore().readUint(path + "/notify-batch");
+    }
+
+    if (getXenStore().checkIfExist(path + "/notify-delay-us")) {
+        config.notifyDelayUs = getXenStore().readUint(path + "/notify-delay-us");
+    }
+
+    if (getXenStore().checkIfExist(path + "/notify-adaptive")) {
+        config.notifyAdaptive = getXenStore().readInt(path + "/notify-adaptive") != 0;
+    }
+
+    if (getXenStore().checkIfExist(path + "/merge-sectors")) {
+        config.mergeSectors = getXenStore().readUint(path + "/merge-sectors");
+    }
+
+    if (getXenStore().checkIfExist(path + "/split-sectors")) {
+        config.splitSectors = getXenStore().readUint(path + "/split-sectors");
+    }
+
+    if (getXenStore().checkIfExist(path + "/cpus")) {
+        const auto cpus = getXenStore().readString(path + "/cpus");
+
+        if (!parseCpuList(cpus, config.cpus)) {
+            LOG(mLog, WARNING) << "Invalid cpu list " << cpus << ", using "
+                               << cpuListString(mDefaults.cpus);
+            config.cpus = mDefaults.cpus;
+        }
+    }
+
+    if (getXenStore().checkIfExist(path + "/numa-node")) {
+        const auto node = getXenStore().readString(path + "/numa-node");
+
+        if (!parseNumaNode(node, config.numaNode)) {
+            LOG(mLog, WARNING) << "Invalid numa node " << node << ", ignored";
+        }
+    }
+
+    if (getXenStore().checkIfExist(path + "/cpu-policy")) {
+        const auto name = getXenStore().readString(path + "/cpu-policy");
+
+        if (!parseCpuPolicy(name, config.cpuPolicy)) {
+            LOG(mLog, WARNING) << "Unknown cpu policy " << name << ", using "
+                               << cpuPolicyName(config.cpuPolicy);
+        }
+    }
+
+    this->readQos(config.qos);
+
+    return config;
+}
+
+static const char *const QOS_KEYS[] = {
+    "qos-read-iops", "qos-write-iops", "qos-read-bps", "qos-write-bps", "qos-burst-ms"
+};
+
+void BlkFrontendHandler::readQos(QosLimits &limits)
+{
+    const std::string path = getXsBackendPath();
+
+    if (getXenStore().checkIfExist(path + "/qos-read-iops")) {
+        limits.readIops = getXenStore().readUint(path + "/qos-read-iops");
+    }
+
+    if (getXenStore().checkIfExist(path + "/qos-write-iops")) {
+        limits.writeIops = getXenStore().readUint(path + "/qos-write-iops");
+    }
+
+    // Byte rates may not fit an int
+    if (getXenStore().checkIfExist(path + "/qos-read-bps")) {
+        limits.readBps = strtoull(getXenStore().readString(path + "/qos-read-bps").c_str(),
+                                  nullptr, 0);
+    }
+
+    if (getXenStore().checkIfExist(path + "/qos-write-bps")) {
+        limits.writeBps = strtoull(getXenStore().readString(path + "/qos-write-bps").c_str(),
+                                   nullptr, 0);
+    }
+
+    if (getXenStore().checkIfExist(path + "/qos-burst-ms")) {
+        limits.burstMs = getXenStore().readUint(path + "/qos-burst-ms");
+    }
+}
+
+void BlkFrontendHandler::onQosChanged()
+{
+    QosLimits limits = mDefaults.qos;
+
+    this->readQos(limits);
+    mQos->setLimits(limits);
+
+    LOG(mLog, INFO) << "QoS limits of frontend " << getDomId() << ": "
+                    << limits.readIops << "/" << limits.writeIops << " iops, "
+                    << limits.readBps << "/" << limits.writeBps << " bytes/s "
+                    << "read/write, " << limits.burstMs << " ms burst";
+}
+
+uint32_t BlkFrontendHandler::maxQueues(const BlkDeviceConfig &config)
+{
+    uint32_t queues = config.maxQueues;
+
+    if (queues == 0U) {
+        queues = std::thread::hardware_concurrency();
+    }
+
+    return uint32_t(minimum(maximum(queues, 1U), MAX_QUEUES));
+}
+
+uint32_t BlkFrontendHandler::maxRingPageOrder(const BlkDeviceConfig &config)
+{
+    return uint32_t(minimum(config.maxRingPageOrder, MAX_RING_PAGE_ORDER));
+}
+
+void BlkFrontendHandler::advertiseFeatures()
+{
+    const BlkDeviceConfig config = this->readConfig();
+
+    getXenStore().writeInt(getXsBackendPath() + "/multi-queue-max-queues",
+                           maxQueues(config));
+    getXenStore().writeInt(getXsBackendPath() + "/max-ring-page-order",
+                           maxRingPageOrder(config));
+    getXenStore().writeInt(getXsBackendPath() + "/feature-max-indirect-segments",
+                           maxIndirectSegments(config));
+}
+
+std::vector<grant_ref_t> BlkFrontendHandler::readRingRefs(const std::string &queuePath,
+                                                          uint32_t order)
+{
+    std::vector<grant_ref_t> refs;
+
+    // A single page ring may be published the legacy way
+    if (order == 0U && getXenStore().checkIfExist(queuePath + "/ring-ref")) {
+        refs.push_back(getXenStore().readUint(queuePath + "/ring-ref"));
+        return refs;
+    }
+
+    for (uint32_t i = 0U; i < (1U << order); i++) {
+        refs.push_back(getXenStore().readUint(queuePath + "/ring-ref" +
+                                              std::to_string(i)));
+    }
+
+    return refs;
+}
+
+#ifndef _WIN32
+// NUMA nodes a domain's memory comes from, which are those of its node
+// affinity. Empty if they can't be told.
+static std::vector<uint32_t> domainNumaNodes(domid_t domId)
+{
+    std::vector<uint32_t> nodes;
+    xc_interface *xch = xc_interface_open(nullptr, nullptr, 0);
+
+    if (!xch) {
+        return nodes;
+    }
+
+    const int maxNodes = xc_get_max_nodes(xch);
+    xc_nodemap_t nodemap = xc_nodemap_alloc(xch);
+
+    if (nodemap && maxNodes > 0 &&
+        xc_domain_node_getaffinity(xch, domId, nodemap) == 0) {
+        for (int node = 0; node < maxNodes; node++) {
+            if (nodemap[node / 8] & (1U << (node % 8))) {
+                nodes.push_back(uint32_t(node));
+            }
+        }
+    }
+
+    free(nodemap);
+    xc_interface_close(xch);
+
+    return nodes;
+}
+#else
+static std::vector<uint32_t> domainNumaNodes(domid_t domId)
+{
+    (void)domId;
+    return {};
+}
 #endif
 
+int32_t BlkFrontendHandler::placeOnNode()
+{
+    int32_t node = mConfig.numaNode;
+
+    mRemoteMemory = false;
 
-        // Spin until XcOpen succeeds. Useful if this program may
-        // be started before the xeniface driver is loaded.
-        bool wait = args.count("wait") != 0;
+    if (node == NUMA_NODE_NONE) {
+        return NUMA_NODE_NONE;
+    }
 
-        // Create backend
-        BlkBackend blkBackend(wait);
-        LOG("Main", INFO) << "Starting block backend";
-        blkBackend.start();
+    const std::vector<uint32_t> memory = domainNumaNodes(getDomId());
 
-        waitSignals();
+    if (node == NUMA_NODE_AUTO) {
+        if (memory.size() == 1U) {
+            node = int32_t(memory.front());
+        } else {
+            LOG(mLog, WARNING) << "Memory of frontend " << getDomId()
+                               << " isn't on a single NUMA node";
+            node = NUMA_NODE_NONE;
+        }
+    }
 
-        blkBackend.stop();
+    if (node < 0) {
+        return NUMA_NODE_NONE;
     }
-    catch(const std::exception& e)
-    {
-        LOG("Main", ERROR) << e.what();
+
+    std::vector<uint32_t> cpus;
+
+    if (!numaNodeCpus(uint32_t(node), cpus)) {
+        LOG(mLog, WARNING) << "NUMA node " << node << " has no cpus";
+        return NUMA_NODE_NONE;
+    }
+
+    if (!mConfig.cpus.empty()) {
+        std::vector<uint32_t> both;
+
+        std::set_intersection(mConfig.cpus.begin(), mConfig.cpus.end(),
+                              cpus.begin(), cpus.end(),
+                              std::back_inserter(both));
+
+        if (both.empty()) {
+            LOG(mLog, WARNING) << "None of cpus " << cpuListString(mConfig.cpus)
+                               << " are on NUMA node " << node;
+            both = mConfig.cpus;
+        }
+
+        cpus = both;
+    }
+
+    mConfig.cpus = cpus;
+
+    mRemoteMemory = !memory.empty() &&
+                    std::find(memory.begin(), memory.end(), uint32_t(node)) == memory.end();
+
+    LOG(mLog, INFO) << "Frontend " << getDomId() << " is placed on NUMA node "
+                    << node << ", cpus " << cpuListString(cpus)
+                    << (mRemoteMemory ? ", its memory is off the node" : "");
+
+    return node;
+}
+
+std::vector<uint32_t> BlkFrontendHandler::placeThread()
+{
+    if (mConfig.cpus.empty() || mConfig.cpuPolicy == CpuPolicyType::SHARED) {
+        return mConfig.cpus;
     }
 
-    return 0;
+    const uint32_t cpu = mPlacement->acquire(mConfig.cpus);
+    mPlacedCpus.push_back(cpu);
+
+    return {cpu};
+}
+
+void BlkFrontendHandler::releaseCpus()
+{
+    for (const uint32_t cpu : mPlacedCpus) {
+        mPlacement->release(cpu);
+    }
+
+    mPlacedCpus.clear();
 }
-//! [main]
+
+void BlkFrontendHandler::createWorkers(int32_t node)
+{
+    if (mConfig.workers == 0U) {
+        // Devices without workers of their own share the backend's, in
+        // proportion to their weights
+        if (mSharedWorkers) {
+            mWorkers = mSharedWorkers;
+            mFlow = mWorkers->addFlow(mConfig.weight);
+        }
+
+        return;
+    }
+
+    std::vector<std::vector<uint32_t>> workerCpus;
+
+    for (uint32_t i = 0U; i < mConfig.workers; i++) {
+        workerCpus.push_back(this->placeThread());
+    }
+
+    mWorkers = std::make_shared<WorkerPool>(mConfig.workers,
+        [workerCpus, node](uint32_t index) {
+            if (!workerCpus[index].empty()) {
+                setThreadAffinity(workerCpus[index]);
+            }
+
+            if (node >= 0) {
+                setThreadMemoryNode(node);
+            }
+        }, 1U, mWorkerGroup, node);
+}
+
+void BlkFrontendHandler::releaseWorkers()
+{
+    if (mWorkers && mFlow != 0U) {
+        mWorkers->removeFlow(mFlow);
+    }
+
+    if (mWorkers && mWorkerGroup && mWorkers != mSharedWorkers) {
+        LOG(mLog, INFO) << "Tasks stolen by the workers of frontend "
+                        << getDomId() << ": " << mWorkers->stolen();
+    }
+
+    mWorkers.reset();
+    mFlow = 0U;
+}
+
+void BlkFrontendHandler::leaveGrantBudget()
+{
+    if (mInBudget) {
+        mBudget->leave(mBudgetShares, mBudgetFloor);
+        mInBudget = false;
+    }
+}
+
+BlkFrontendHandler::~BlkFrontendHandler()
+{
+    // A failed bind leaves the device counted without a close to undo it
+    this->leaveGrantBudget();
+}
+
+//! [onBind]
+void BlkFrontendHandler::onBind()
+{
+    std::string path = getXenStore().readString(getXsBackendPath() + "/params");
+    LOG(mLog, DEBUG) << "open image file: " << path;
+
+    if (path.front() == '\'' && path.back() == '\'') {
+        if (path.size() > 2) {
+            path = path.substr(1, path.size() - 2);
+        }
+    }
+
+    mImage = std::make_shared<DiskImage>(path);
+
+    if (!mImage) {
+        LOG(mLog, ERROR) << "Failed to open image file: " << path;
+        throw;
+    }
+
+    getXenStore().writeInt(getXsBackendPath() + "/feature-discard", 0);
+    getXenStore().writeInt(getXsBackendPath() + "/feature-persistent", 1);
+    getXenStore().writeInt(getXsBackendPath() + "/feature-flush-cache", 1);
+    getXenStore().writeInt(getXsBackendPath() + "/feature-barrier", 1);
+
+    getXenStore().writeInt(getXsBackendPath() + "/sectors", mImage->getSectorCount());
+    getXenStore().writeInt(getXsBackendPath() + "/sector-size", mImage->getSectorSize());
+    getXenStore().writeInt(getXsBackendPath() + "/info", 0);
+
+    mConfig = this->readConfig();
+
+    // A frontend that doesn't know about multiple queues uses one ring
+    // published directly under its path
+    uint32_t nrQueues = 1U;
+
+    if (getXenStore().checkIfExist(getXsFrontendPath() + "/multi-queue-num-queues")) {
+        nrQueues = getXenStore().readUint(getXsFrontendPath() + "/multi-queue-num-queues");
+    }
+
+    if (nrQueues == 0U || nrQueues > maxQueues(mConfig)) {
+        LOG(mLog, ERROR) << "Frontend asked for " << nrQueues << " queues, "
+                         << "at most " << maxQueues(mConfig) << " are offered";
+        throw XenBackend::Exception("invalid multi-queue-num-queues", EINVAL);
+    }
+
+    uint32_t order = 0U;
+
+    if (getXenStore().checkIfExist(getXsFrontendPath() + "/ring-page-order")) {
+        order = getXenStore().readUint(getXsFrontendPath() + "/ring-page-order");
+    }
+
+    if (order > maxRingPageOrder(mConfig)) {
+        LOG(mLog, ERROR) << "Frontend asked for ring page order " << order
+                         << ", at most " << maxRingPageOrder(mConfig)
+                         << " is offered";
+        throw XenBackend::Exception("invalid ring-page-order", EINVAL);
+    }
+
+    // map what the device was using when it last disconnected
+    const std::vector<RetainedGrants> retained =
+        mRetention->take(getDomId(), getDevId());
+
+    mCmdRingBuffers.clear();
+    this->releaseWorkers();
+    this->releaseCpus();
+
+    // The rings are sized from the device's share, so it must count first
+    if (!mInBudget) {
+        mBudgetShares = grantBudgetShares(mConfig);
+        mBudgetFloor = nrQueues * MIN_PGRANTS_PER_RING;
+        mInBudget = true;
+
+        if (!mBudget->join(mBudgetShares, mBudgetFloor)) {
+#ifdef _WIN32
+            // Refuse the device rather than overcommit
+            LOG(mLog, ERROR) << "Devices need at least " << mBudget->floor()
+                             << " persistent grants, --max-grants is "
+                             << mBudget->total();
+
+            this->leaveGrantBudget();
+            throw XenBackend::Exception("grant budget exhausted", ENOSPC);
+#else
+            LOG(mLog, WARNING) << "Devices need at least " << mBudget->floor()
+                               << " persistent grants, --max-grants "
+                               << mBudget->total() << " is overcommitted";
+#endif
+        }
+    }
+
+    // Limits follow the qos keys for as long as the frontend is connected
+    mQos->setLimits(mConfig.qos);
+
+    for (const char *key : QOS_KEYS) {
+        getXenStore().clearWatch(getXsBackendPath() + "/" + key);
+        getXenStore().setWatch(getXsBackendPath() + "/" + key,
+                               [this] { this->onQosChanged(); });
+    }
+
+    const int32_t node = this->placeOnNode();
+
+    this->createWorkers(node);
+
+    // Shared by the rings so the device's limit covers all of them
+    std::shared_ptr<InFlightLimit> limit;
+
+    if (mConfig.maxInFlight != 0U || mTotalInFlight) {
+        limit = std::make_shared<InFlightLimit>(mConfig.maxInFlight, mTotalInFlight);
+    }
+
+    // A ring spinning on a shared reactor thread would hold up every other
+    // ring on that thread
+    if (mReactor && mConfig.pollUs != 0U) {
+        LOG(mLog, WARNING) << "Rings of frontend " << getDomId()
+                           << " are on the reactor, ignoring poll-us";
+        mConfig.pollUs = 0U;
+    }
+
+    // The rings' request tables and caches come from the node too
+    const ScopedMemoryNode memoryNode(node);
+
+    for (uint32_t queue = 0U; queue < nrQueues; queue++) {
+        const std::string queuePath = nrQueues == 1U ? getXsFrontendPath() :
+            getXsFrontendPath() + "/queue-" + std::to_string(queue);
+
+        // get out ring buffer event channel port
+        evtchn_port_t port = getXenStore().readInt(queuePath + "/event-channel");
+
+        // get out ring buffer grant table references
+        const std::vector<grant_ref_t> refs = this->readRingRefs(queuePath, order);
+
+        // create command ring buffer
+        auto ring = std::make_shared<BlkCmdRingBuffer>(getDomId(), getDevId(),
+                                                       queue, nrQueues,
+                                                       port, refs, mImage,
+                                                       mConfig, mWorkers, mQos,
+                                                       mFlow, mBudget);
+
+        if (mConfig.grantWarmup && queue < retained.size()) {
+            ring->warmGrants(retained[queue]);
+        }
+
+        if (limit) {
+            ring->limitInFlight(limit);
+        }
+
+        ring->setRemoteMemory(mRemoteMemory);
+
+        // Reactor threads are shared, so they aren't placed per ring
+        std::vector<uint32_t> cpus;
+
+        if (mReactor) {
+            ring->runOn(mReactor, mConfig.reactorQuantum * mConfig.weight);
+        } else {
+            cpus = this->placeThread();
+            ring->placeOn(cpus, node);
+        }
+
+        if (!cpus.empty()) {
+
+            LOG(mLog, INFO) << "Queue " << queue << " of frontend " << getDomId()
+                            << " runs on cpus " << cpuListString(cpus);
+        }
+
+        mCmdRingBuffers.push_back(ring);
+    }
+
+    // add ring buffers, each served by its own event channel thread or
+    // by the reactor
+    for (auto &ring : mCmdRingBuffers) {
+        addRingBuffer(ring);
+    }
+
+    LOG(mLog, INFO) << "Frontend " << getDomId() << " connected with "
+                    << nrQueues << " queue(s) of " << (1U << order)
+                    << " ring page(s), " << mConfig.workers << " worker(s)";
+}
+//! [onBind]
+
+//! [onClosing]
+void BlkFrontendHandler::onClosing()
+{
+    LOG(mLog, DEBUG) << "onClosing called, freeing resources...";
+
+    if (!mCmdRingBuffers.empty() && mConfig.grantWarmup) {
+        std::vector<RetainedGrants> retained;
+
+        for (auto &ring : mCmdRingBuffers) {
+            retained.push_back(ring->retainGrants());
+        }
+
+        mRetention->save(getDomId(), getDevId(), std::move(retained));
+    }
+
+    // Grants of domains that have been destroyed can't come back
+    auto &xenStore = getXenStore();
+
+    mRetention->prune([&xenStore](uint16_t domId) {
+        return xenStore.checkIfExist(xenStore.getDomainPath(domId));
+    });
+
+    for (const char *key : QOS_KEYS) {
+        getXenStore().clearWatch(getXsBackendPath() + "/" + key);
+    }
+
+    // free allocate on bind resources
+    mCmdRingBuffers.clear();
+    this->releaseWorkers();
+    this->releaseCpus();
+    this->leaveGrantBudget();
+}
+
+BlkBackend::BlkBackend(bool wait, const BlkDeviceConfig &defaults) :
+    BackendBase("BlkBackend", "vbd", wait),
+    mLog("BlkBackend"),
+    mDefaults(defaults),
+    mBudget(std::make_shared<GrantBudget>(defaults.maxGrants,
+                                          MAX_PGRANTS_PER_FRONTEND,
+                                          MIN_PGRANTS_PER_RING))
+{
+    LOG(mLog, DEBUG) << "Create vbd backend";
+
+    if (defaults.sharedWorkers != 0U) {
+        mSharedWorkers = std::make_shared<WorkerPool>(defaults.sharedWorkers,
+                                                      nullptr,
+                                                      defaults.fairQuantum);
+    }
+
+    if (defaults.workStealing) {
+        mWorkerGroup = std::make_shared<WorkerGroup>();
+    }
+
+    if (defaults.maxInFlightTotal != 0U) {
+        mTotalInFlight = std::make_shared<InFlightLimit>(defaults.maxInFlightTotal);
+    }
+
+    if (defaults.reactorThreads != 0U) {
+#ifndef _WIN32
+        auto placement = mPlacement;
+        const std::vector<uint32_t> cpus = defaults.cpus;
+
+        // The cpu each thread took, handed back as it exits
+        auto taken = std::make_shared<std::vector<uint32_t>>(defaults.reactorThreads);
+
+        mReactor = std::make_shared<Reactor>(defaults.reactorThreads,
+            [placement, cpus, taken](uint32_t index) {
+                if (!cpus.empty()) {
+                    (*taken)[index] = placement->acquire(cpus);
+                    setThreadAffinity({(*taken)[index]});
+                }
+            },
+            [placement, cpus, taken](uint32_t index) {
+                if (!cpus.empty()) {
+                    placement->release((*taken)[index]);
+                }
+            });
+#else
+        LOG(mLog, WARNING) << "No reactor on Windows, "
+                           << "each ring keeps a thread of its own";
+#endif
+    }
+}
+
+//! [onNewFrontend]
+void BlkBackend::onNewFrontend(domid_t domId, uint16_t devId)
+{
+    LOG(mLog, DEBUG) << "New frontend, dom id: " << domId
+                     << ", devices: " << mBudget->devices();
+
+    // create new blk frontend handler
+    addFrontendHandler(FrontendHandlerPtr(new BlkFrontendHandler(getDeviceName(), domId, devId, mDefaults, mRetention, mPlacement,
+                                                                 mSharedWorkers, mWorkerGroup,
+                                                                 mBudget, mReactor,
+                                                                 mTotalInFlight)));
+}
+//! [onNewFrontend]
+
 /*
  * Local variables:
  * mode: C
@@ -21,7 +21,14 @@
 #ifndef BLKBACKEND_HPP_
 #define BLKBACKEND_HPP_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #define _WINDLL 1
 #define __x86_64__ 1
 //#define __XEN_TOOLS__ 1
@@ -29,13 +36,32 @@
 #include <xen/be/FrontendHandlerBase.hpp>
 #include <xen/be/RingBufferBase.hpp>
 #include <xen/be/XenGnttab.hpp>
+#include "BlkConfig.hpp"
+#include "CpuAffinity.hpp"
 #include "DiskImage.h"
+#include "GrantCache.hpp"
+#include "GrantTrace.hpp"
+#include "InFlightLimit.hpp"
+#include "MpscQueue.hpp"
+#include "NotifyCoalescer.hpp"
+#include "QosLimiter.hpp"
+#include "Reactor.hpp"
+#ifndef _WIN32
+#include "ReactorChannel.hpp"
+#endif
+#include "RingPoller.hpp"
+#include "WorkerPool.hpp"
 
 static constexpr inline uint64_t minimum(uint64_t left, uint64_t right) noexcept
 {
     return (left < right) ? left : right;
 }
 
+static constexpr inline uint64_t maximum(uint64_t left, uint64_t right) noexcept
+{
+    return (left > right) ? left : right;
+}
+
 static constexpr inline uint64_t div_round_up(uint64_t n, uint64_t d) noexcept
 {
     return (n + d - 1U) / d;
@@ -89,67 +115,428 @@ struct GntPage {
     }
 };
 
+class BlkGrantCache final : public GrantCache
+{
+public:
+    BlkGrantCache(domid_t domId,
+                  GrantCachePolicyType policy,
+                  uint64_t capacity,
+                  uint64_t evictionSize) :
+        GrantCache(policy, capacity, evictionSize),
+        mDomId(domId)
+    { }
+
+    ~BlkGrantCache()
+    {
+        this->clear();
+    }
+
+private:
+    void *map(grant_ref_t gref) override
+    {
+        GntPage page{gref};
+        return page.map(mDomId);
+    }
+
+    void unmap(grant_ref_t gref, void *addr) override
+    {
+        (void)gref;
+        xengnttab_unmap(nullptr, addr, 1);
+    }
+
+    void *mapBatch(const grant_ref_t *grefs, uint32_t count, void **addrs) override
+    {
+        auto base = static_cast<uint8_t *>(
+            xengnttab_map_domain_grant_refs(nullptr,
+                                            count,
+                                            mDomId,
+                                            const_cast<grant_ref_t *>(grefs),
+                                            PROT_READ | PROT_WRITE));
+
+        for (uint32_t i = 0U; base && i < count; i++) {
+            addrs[i] = base + size_t(i) * XC_PAGE_SIZE;
+        }
+
+        return base;
+    }
+
+    void unmapBatch(void *batch, uint32_t count) override
+    {
+        xengnttab_unmap(nullptr, batch, count);
+    }
+
+    domid_t mDomId;
+};
+
+class BlkLinearMapCache final : public LinearMapCache
+{
+public:
+    BlkLinearMapCache(domid_t domId, uint64_t capacity) :
+        LinearMapCache(capacity),
+        mDomId(domId)
+    { }
+
+    ~BlkLinearMapCache()
+    {
+        this->clear();
+    }
+
+private:
+    void *map(const grant_ref_t *grefs, uint32_t count) override
+    {
+        return xengnttab_map_domain_grant_refs(nullptr,
+                                               count,
+                                               mDomId,
+                                               const_cast<grant_ref_t *>(grefs),
+                                               PROT_READ | PROT_WRITE);
+    }
+
+    void unmap(void *addr, uint32_t count) override
+    {
+        xengnttab_unmap(nullptr, addr, count);
+    }
+
+    domid_t mDomId;
+};
+
+
+// Part of a read or write done by a worker of its own, covering chunkIo
+// entries [first, first + count) of its request from sector on
+struct BlkChunk {
+    blkif_sector_t sector;
+    uint32_t first;
+    uint32_t count;
+};
+
+// A request parsed and mapped by its ring's thread, ready for whichever
+// thread does the I/O. The response holds its id, operation and status.
+// The grants it uses stay pinned until it completes.
+//
+// Adjacent reads or writes consumed together are merged into the first of
+// them: its sectors and buffers grow to cover the others, which are
+// chained through next and answered with its status.
+struct BlkRequest {
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+    blkif_response_t rsp;
+    blkif_sector_t sector{0};
+    uint64_t nrSectors{0};
+    std::vector<DiskIoVec> io;
+    std::vector<grant_ref_t> pinned;
+    void *linear{nullptr};
+    uint32_t next{NO_SLOT};
+
+    // Set by splitRequest(). The workers doing the chunks count them down
+    // and keep the first failure.
+    std::vector<BlkChunk> chunks;
+    std::vector<DiskIoVec> chunkIo;
+    std::atomic<uint32_t> chunksLeft{0};
+    std::atomic<int16_t> chunkStatus{BLKIF_RSP_OKAY};
+};
 
 //! [BlkCmdRingBuffer]
-class BlkCmdRingBuffer : public XenBackend::RingBufferInBase<blkif_back_ring_t, blkif_sring_t,
-							     blkif_request_t, blkif_response_t>
+// Consumes the blkif ring itself rather than through RingBufferInBase so
+// responses can be written as requests complete and published once per
+// batch, with at most one event channel kick for the whole batch.
+//
+// Kicks may be coalesced across batches, see NotifyCoalescer.
+//
+// With a worker pool the ring's thread only parses and maps requests and
+// the workers do the I/O. Finished requests are queued back to the ring,
+// and whichever thread holds the ring lock (the ring's own thread during a
+// sweep, otherwise a worker) writes their responses and publishes them.
+class BlkCmdRingBuffer : public XenBackend::RingBufferItf
 {
 public:
 
 	BlkCmdRingBuffer(domid_t domId,
+			 uint16_t devId,
+			 uint32_t queue,
+			 uint32_t nrQueues,
 			 evtchn_port_t port,
-			 grant_ref_t ref,
-			 std::shared_ptr<DiskImage> diskImage) :
-	  XenBackend::RingBufferInBase<blkif_back_ring_t,
-				       blkif_sring_t,
-				       blkif_request_t,
-				       blkif_response_t>(domId, port, ref,
-                                                         __CONST_RING_SIZE(blkif, XC_PAGE_SIZE),
-                                                         XC_PAGE_SIZE),
-	  mLog("InRingBuffer"),
-	  mDomId(domId),
-	  mImage(diskImage)
-	{
-		LOG(mLog, DEBUG) << "Created blkif ring: frontend: " << domId
-                                 << ", ring size: "
-                                 << __CONST_RING_SIZE(blkif, XC_PAGE_SIZE);
-	}
-
-        ~BlkCmdRingBuffer()
-        {
-            this->freeGrants();
-        }
+			 const std::vector<grant_ref_t> &refs,
+			 std::shared_ptr<DiskImage> diskImage,
+			 const BlkDeviceConfig &config,
+			 std::shared_ptr<WorkerPool> workers = nullptr,
+			 std::shared_ptr<QosLimiter> qos = nullptr,
+			 uint32_t flow = 0U,
+			 std::shared_ptr<GrantBudget> budget = nullptr);
+
+        // Waits for requests still with the workers
+        ~BlkCmdRingBuffer();
+
+        // Grants to carry over to the device's next connection
+        RetainedGrants retainGrants() const;
+
+        // Maps grants carried over from the previous connection. Must be
+        // called before the ring is started.
+        void warmGrants(const RetainedGrants &grants);
+
+        // Keeps the ring's thread on cpus, allocating from node, once it
+        // runs. Must be called before the ring is started.
+        void placeOn(const std::vector<uint32_t> &cpus,
+                     int32_t node = NUMA_NODE_NONE);
+
+        // Counts the bytes of I/O done on the frontend's pages when they
+        // are off the device's NUMA node. Must be called before the ring
+        // is started.
+        void setRemoteMemory(bool remote) { mRemoteMemory = remote; }
+
+        // Has the ring served by one of reactor's threads instead of an
+        // event channel thread of its own, taking up to turn requests off
+        // the ring before the other rings of the thread get a turn (0 for
+        // all it finds). Must be called before the ring is started.
+        void runOn(std::shared_ptr<Reactor> reactor, uint32_t turn = 0U);
+
+        // Counts the ring's requests against limit, leaving them on the
+        // ring while it is reached. Must be called before the ring is
+        // started.
+        void limitInFlight(std::shared_ptr<InFlightLimit> limit);
+
+        void start() override;
+        void stop() override;
 
 private:
 
-        int processSegments(const struct blkif_request_segment *segments,
+        // Validates the segments of a read or write and maps them the
+        // fastest way their layout allows
+        int prepareSegments(const struct blkif_request_segment *segments,
 			    uint32_t nr_segments,
 			    blkif_sector_t sector_number,
-			    bool write);
+			    BlkRequest &request);
+
+        // Specialized for requests of whole pages, see prepareSegments()
+        template <bool FullPages>
+        bool prepareLinear(const struct blkif_request_segment *segments,
+                           uint32_t nr_segments,
+                           blkif_sector_t sector_number,
+                           BlkRequest &request);
+
+        template <bool FullPages>
+        int mapSegments(const struct blkif_request_segment *segments,
+                        uint32_t nr_segments,
+                        blkif_sector_t sector_number,
+                        BlkRequest &request);
+
+        int prepareReadWrite(const blkif_request_t &req, BlkRequest &request);
+        int prepareIndirect(const blkif_request_indirect_t *indirect,
+                            BlkRequest &request);
+
+        void *addGrant(const grant_ref_t gref, bool indirect = false);
+
+	// Drains the ring when the frontend kicks the event channel, then
+	// polls it for a while if polling is enabled. Returns true if the
+	// reactor turn ran out with requests left on the ring.
+	bool onReceiveIndication();
+
+	// Kicks the frontend through whichever channel the ring is bound with
+	void notifyFrontend();
+
+	// Consumes and starts the requests currently on the ring, up to limit
+	// of them unless it is 0. Returns true if the in-flight limits stopped
+	// it with requests left on the ring.
+	bool consumeRequests(uint32_t limit = 0U);
+
+	// Sizes the grant caches to the ring's part of the device's share of
+	// the grant budget
+	void fitGrantBudget();
 
-        int processSegment(const blkif_request_segment *const seg,
-			   const blkif_sector_t start_sector,
-			   const uint32_t nr_sectors,
-			   bool write);
+	// Parses req and maps its buffers into request
+	void prepareRequest(const blkif_request& req, BlkRequest &request);
 
-        int handleReadWrite(const blkif_request_t &req);
-        int handleIndirect(const blkif_request_indirect_t *indirect);
+	// Chains the request in slot behind head, whose chain ends at tail,
+	// if it carries on where head leaves off. Returns false if it can't
+	// be merged.
+	bool mergeRequest(uint32_t head, uint32_t tail, uint32_t slot);
 
-        void freeGrants();
-        void evictGrants();
-        void *mapGrant(const grant_ref_t gref);
-        void *addGrant(const grant_ref_t gref);
+	// Does the disk I/O of a prepared request. Safe on any thread.
+	void executeRequest(BlkRequest &request);
 
-	// Override receiving requests
-	virtual void processRequest(const blkif_request& req) override;
+	// Reads or writes count vectors from sector on for request
+	int16_t transfer(const BlkRequest &request, blkif_sector_t sector,
+			 const DiskIoVec *io, size_t count);
+
+	// Cuts a read or write longer than mSplitSectors into chunks the
+	// workers can do at once. Returns false if it is done whole.
+	bool splitRequest(BlkRequest &request);
+
+	// Runs one chunk of the request in slot on a worker, finishing the
+	// request with the first error once its last chunk is done
+	void executeChunk(uint32_t slot, uint32_t chunk);
+
+	// Submits a prepared request once the device's rate limits let it
+	// through, deferring it until then. Called with the ring lock held, as
+	// are the functions below unless noted.
+	void admitRequest(uint32_t slot);
+
+	// Takes the rate limit tokens for a request, or arms the QoS timer
+	// for when they will be there
+	bool takeTokens(uint32_t slot);
+
+	// Submits deferred requests the limits now let through
+	void releaseThrottled();
+
+	// Retries requests deferred by the rate limits and resumes consuming
+	// if the in-flight limits stopped it. Called from the retry timer's
+	// thread without the ring lock.
+	void onRetry();
+
+	// Starts a prepared request, or holds it back if it has to wait for a
+	// flush or barrier
+	void submitRequest(uint32_t slot);
+
+	// Does the request's I/O inline or hands it to the workers
+	void startRequest(uint32_t slot);
+
+	// Starts held requests that no longer have to wait
+	void startHeld();
+
+	// Ends a started request once its I/O is done
+	void finishRequest(uint32_t slot);
+
+	// Releases the grants of the request and those merged into it, queues
+	// their responses and frees their slots
+	void completeRequest(uint32_t slot);
+
+	// Completes requests the workers have finished
+	void completeFinished();
+
+	// Hands the request in slot back from a worker, then lets go of the
+	// ring. Called on a worker without the ring lock; the ring may be
+	// destroyed as soon as it returns.
+	void workerFinished(uint32_t slot);
+	void workerDone();
+
+	// Blocks until the workers have finished every request handed to
+	// them. Called without the ring lock.
+	void waitForWorkers();
+
+	// Completes and publishes what the workers have finished, unless
+	// another thread holds the ring lock and will do it instead. Called
+	// without the ring lock.
+	void drainCompletions();
+
+	// Writes a response to the ring without making it visible
+	void queueResponse(const blkif_response_t &rsp);
+
+	// Makes queued responses visible, kicking the frontend if it asked
+	// and the coalescer agrees
+	void publishResponses();
+
+	// Sends a kick the coalescer held back for too long. Called from the
+	// coalescer's timer thread.
+	void onNotifyTimeout();
 
 	// XenBackend::Log can be used by backend
 	XenBackend::Log mLog;
 
         domid_t mDomId;
+        evtchn_port_t mPort;
+        uint32_t mQueue;
+        XenBackend::XenGnttabBuffer mBuffer;
+        blkif_back_ring_t mRing;
         std::shared_ptr<DiskImage> mImage{nullptr};
-        std::list<GntPage> mGntLru;
-        std::unordered_map<grant_ref_t, decltype(mGntLru)::iterator> mGntMap;
+        BlkGrantCache mGrants;
+        BlkGrantCache mIndirectGrants;
+        std::unique_ptr<BlkLinearMapCache> mLinear{nullptr};
+        std::unique_ptr<GrantTraceWriter> mTrace{nullptr};
+
+        // Serializes the ring, the grant caches and the requests below
+        std::mutex mRingMutex;
+
+        // Budget the grant caches are sized from, the device's number of
+        // rings, and the budget's generation they were last sized for
+        std::shared_ptr<GrantBudget> mBudget;
+        uint32_t mNrQueues;
+        uint64_t mBudgetGeneration{0};
+
+        // Longest merged request in sectors, and requests merged so far
+        uint64_t mMergeSectors;
+        uint64_t mMerged{0};
+
+        // Longest read or write one worker does, and requests split so far
+        uint64_t mSplitSectors;
+        uint64_t mSplit{0};
+
+        // Most segments of an indirect request, the descriptor pages they
+        // take, and the device's shares of the grant budget
+        uint64_t mMaxSegments;
+        uint64_t mIndirectPages;
+        uint64_t mBudgetShares;
+
+        // Scratch space for a request's segments, used by the ring's thread
+        std::vector<blkif_request_segment> mSegments;
+        std::vector<grant_ref_t> mLinearGrefs;
+
+        // Set before the ring is started
+        int32_t mNode{NUMA_NODE_NONE};
+        bool mRemoteMemory{false};
+
+        // Bytes of I/O done on frontend pages off the device's node
+        std::atomic<uint64_t> mRemoteBytes{0};
+
+        // Threads waiting on the event channel if it has none of its own,
+        // and the requests taken per turn on them. Set before the ring is
+        // started.
+        std::shared_ptr<Reactor> mReactor;
+        uint32_t mTurn{0};
+
+        // The frontend's event channel, bound when the ring is first
+        // started: with a thread of its own, or waited on by mReactor
+        std::unique_ptr<XenBackend::XenEvtchn> mEventChannel;
+#ifndef _WIN32
+        std::unique_ptr<ReactorChannel> mReactorChannel;
+#endif
+
+        // Only used by the ring's thread
+        std::vector<uint32_t> mCpus;
+        bool mPlacePending{false};
+        RingPoller mPoller;
+        std::chrono::steady_clock::time_point mCreated{std::chrono::steady_clock::now()};
+
+        // Used with the ring lock held
+        NotifyCoalescer mCoalescer;
+
+        // Worker pool shared by the device's rings, if any, and the
+        // device's flow in it
+        std::shared_ptr<WorkerPool> mWorkers;
+        uint32_t mFlow;
+
+        // Rate limits shared by the device's rings, and the requests they
+        // hold back, in ring order
+        std::shared_ptr<QosLimiter> mQos;
+        std::deque<uint32_t> mThrottled;
+        uint64_t mThrottledCount{0};
+
+        // In-flight limits of the device and backend, if any, the requests
+        // taken from them, and whether they stopped the ring being consumed
+        std::shared_ptr<InFlightLimit> mLimit;
+        InFlightLimit::Waiter mUnblock;
+        uint32_t mAcquired{0};
+        bool mBlocked{false};
+        uint64_t mBlockedCount{0};
+
+        // Runs onRetry() for both of the above
+        DeadlineTimer mRetryTimer;
+
+        // Requests between being consumed and answered, one entry per ring
+        // slot. Entries are handed out from mFreeSlots rather than by ring
+        // index since requests complete out of order.
+        std::unique_ptr<BlkRequest[]> mInFlight;
+        std::vector<uint32_t> mFreeSlots;
+
+        // Requests waiting on a flush or barrier, in ring order
+        std::deque<uint32_t> mHeld;
+        uint32_t mRunning{0};
+        bool mFenceRunning{false};
+
+        // Requests the workers have finished, drained with the ring lock
+        // held, and how many tasks they still have. The lock is only taken
+        // by the task that leaves the workers idle.
+        std::unique_ptr<MpscQueue<uint32_t>> mFinished;
+        std::atomic<uint32_t> mOutstanding{0};
+        std::mutex mIdleMutex;
+        std::condition_variable mIdle;
 };
 //! [BlkInRingBuffer]
 
@@ -159,16 +546,37 @@ class BlkFrontendHandler : public XenBackend::FrontendHandlerBase
 public:
   BlkFrontendHandler(const std::string& devName,
 		     domid_t feDomId,
-		     uint16_t devId) : FrontendHandlerBase("FrontendHandler",
+		     uint16_t devId,
+		     const BlkDeviceConfig &defaults,
+		     std::shared_ptr<GrantRetention> retention,
+		     std::shared_ptr<CpuPlacement> placement,
+		     std::shared_ptr<WorkerPool> sharedWorkers,
+		     std::shared_ptr<WorkerGroup> workerGroup,
+		     std::shared_ptr<GrantBudget> budget,
+		     std::shared_ptr<Reactor> reactor,
+		     std::shared_ptr<InFlightLimit> totalInFlight) : FrontendHandlerBase("FrontendHandler",
 							   "vbd",
 							   feDomId,
 							   devId),
-				       mLog("FrontendHandler")
+				       mLog("FrontendHandler"),
+				       mDefaults(defaults),
+				       mRetention(retention),
+				       mPlacement(placement),
+				       mSharedWorkers(sharedWorkers),
+				       mWorkerGroup(workerGroup),
+				       mBudget(budget),
+				       mReactor(reactor),
+				       mTotalInFlight(totalInFlight)
   {
     LOG(mLog, DEBUG) << "Create blk frontend handler, dom id: "
 		     << feDomId;
+
+    // must be visible before the frontend sees InitWait
+    this->advertiseFeatures();
   }
 
+  ~BlkFrontendHandler();
+
 private:
 
 	// Override onBind method
@@ -177,14 +585,99 @@ private:
 	// Override onClosing method
 	void onClosing() override;
 
+	// Apply this device's xenstore overrides to the backend defaults
+	BlkDeviceConfig readConfig();
+
+	// Applies the device's qos keys over limits
+	void readQos(QosLimits &limits);
+
+	// Picks up a change to the qos keys. Called from the xenstore watch.
+	void onQosChanged();
+
+	// Write the features the frontend negotiates before connecting
+	void advertiseFeatures();
+
+	// Number of rings offered to the frontend
+	static uint32_t maxQueues(const BlkDeviceConfig &config);
+
+	// Largest ring offered to the frontend, as a page order
+	static uint32_t maxRingPageOrder(const BlkDeviceConfig &config);
+
+	// Grant references of a queue's shared ring
+	std::vector<grant_ref_t> readRingRefs(const std::string &queuePath,
+					      uint32_t order);
+
+	// Narrows mConfig.cpus to the device's NUMA node and returns the
+	// node, or NUMA_NODE_NONE if it isn't placed on one. Sets
+	// mRemoteMemory if the frontend's memory is off that node.
+	int32_t placeOnNode();
+
+	// CPUs for the next of the device's threads, empty if unrestricted
+	std::vector<uint32_t> placeThread();
+
+	// Returns the CPUs taken by placeThread()
+	void releaseCpus();
+
+	// Sets mWorkers up to do the device's I/O, if it isn't done inline
+	void createWorkers(int32_t node);
+
+	// Drops the device's workers, or its flow in the shared pool. The
+	// rings must be gone.
+	void releaseWorkers();
+
+	// Gives the device's share of the grant budget back, if it has one
+	void leaveGrantBudget();
+
 	// XenBackend::Log can be used by backend
 	XenBackend::Log mLog;
 
-	// Store out ring buffer
-    std::shared_ptr<BlkCmdRingBuffer> mCmdRingBuffer{nullptr};
+    // Settings inherited from the backend
+    BlkDeviceConfig mDefaults;
+
+    // Settings of the current connection
+    BlkDeviceConfig mConfig;
+
+    // Grants kept across connections, shared by all devices
+    std::shared_ptr<GrantRetention> mRetention;
+
+    // Rate limits of the device, changed when its qos keys are
+    std::shared_ptr<QosLimiter> mQos{std::make_shared<QosLimiter>()};
+
+    // CPU use of all devices' threads, and the CPUs taken by this one's
+    std::shared_ptr<CpuPlacement> mPlacement;
+    std::vector<uint32_t> mPlacedCpus;
+
+    // Pool shared by devices without workers of their own, and this
+    // device's flow in it while it uses it
+    std::shared_ptr<WorkerPool> mSharedWorkers;
+    uint32_t mFlow{0};
+
+    // Pools of all devices stealing each other's tasks, if enabled
+    std::shared_ptr<WorkerGroup> mWorkerGroup;
+
+    // Whether none of the frontend's memory is on the device's node
+    bool mRemoteMemory{false};
+
+    // Persistent grants of all devices, and whether this one has a share
+    std::shared_ptr<GrantBudget> mBudget;
+    bool mInBudget{false};
+    uint64_t mBudgetShares{1};
+    uint64_t mBudgetFloor{0};
+
+    // Threads serving the rings of all devices, if they don't have their own
+    std::shared_ptr<Reactor> mReactor;
+
+    // Requests in flight on all devices, if limited
+    std::shared_ptr<InFlightLimit> mTotalInFlight;
+
+	// Store out ring buffers, one per queue
+    std::vector<std::shared_ptr<BlkCmdRingBuffer>> mCmdRingBuffers;
 
     // The backing store for this device
     std::shared_ptr<DiskImage> mImage{nullptr};
+
+    // Threads doing the disk I/O of the device's rings, if configured
+    std::shared_ptr<WorkerPool> mWorkers;
 };
 //! [BlkFrontend]
 
@@ -193,12 +686,14 @@ class BlkBackend : public XenBackend::BackendBase
 {
 public:
 
-	BlkBackend(bool wait = false) :
-		BackendBase("BlkBackend", "vbd", wait),
-		mLog("BlkBackend")
-	{
-		LOG(mLog, DEBUG) << "Create vbd backend";
-	}
+	BlkBackend(bool wait = false,
+		   const BlkDeviceConfig &defaults = BlkDeviceConfig());
+
+	// Persistent grants of all devices and how they are split
+	std::shared_ptr<const GrantBudget> grantBudget() const { return mBudget; }
+
+	// How many of the devices' threads are on each CPU
+	std::shared_ptr<CpuPlacement> cpuPlacement() const { return mPlacement; }
 
 private:
 
@@ -207,6 +702,30 @@ private:
 
 	// XenBackend::Log can be used by backend
 	XenBackend::Log mLog;
+
+	// Settings given to every new frontend
+	BlkDeviceConfig mDefaults;
+
+	// Grants of disconnected devices, waiting for them to reconnect
+	std::shared_ptr<GrantRetention> mRetention{std::make_shared<GrantRetention>()};
+
+	// Spreads the devices' threads over their CPUs
+	std::shared_ptr<CpuPlacement> mPlacement{std::make_shared<CpuPlacement>()};
+
+	// Workers for devices that don't have their own, if any
+	std::shared_ptr<WorkerPool> mSharedWorkers;
+
+	// Lets devices' workers steal from each other, if enabled
+	std::shared_ptr<WorkerGroup> mWorkerGroup;
+
+	// Split between the devices connected
+	std::shared_ptr<GrantBudget> mBudget;
+
+	// Serves every ring's event channel, if configured
+	std::shared_ptr<Reactor> mReactor;
+
+	// Bounds the requests in flight on all devices, if configured
+	std::shared_ptr<InFlightLimit> mTotalInFlight;
 };
 //! [BlkBackend]
 
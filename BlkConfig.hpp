@@ -0,0 +1,163 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef BLKBACK_CONFIG_HPP
+#define BLKBACK_CONFIG_HPP
+
+#include <string>
+#include <vector>
+
+#include "CpuAffinity.hpp"
+#include "GrantCache.hpp"
+#include "QosLimiter.hpp"
+
+//
+// Per-device settings. The backend is started with defaults (normally from
+// the command line) and a device may override them with keys of the same
+// name in its xenstore backend directory, read when the frontend binds.
+//
+struct BlkDeviceConfig {
+    // "grant-cache-policy": lru, clock, 2q, arc or lfu
+    GrantCachePolicyType grantCachePolicy{GrantCachePolicyType::LRU};
+
+    // "grant-trace": file persistent grant accesses are logged to. If unset
+    // and grantTraceDir is set, <grantTraceDir>/grants-<domid>-<devid>.trace
+    // is used.
+    std::string grantTrace;
+    std::string grantTraceDir;
+
+    // Backend wide, not read from xenstore: persistent grants all devices
+    // together may have mapped, split evenly between them. On Windows this
+    // must be less than the number of grants implied by the size of the
+    // FDO hole. This hole currently is 64MB which gives 64K grants
+    // available in total. A small (< 128) portion of these are reserved
+    // for the shared info and grant table pages.
+    uint64_t maxGrants{8192};
+
+    // "linear-map-pages": pages of gref sequences kept mapped contiguously
+    // so multi-segment requests are served with a single I/O call; 0 maps
+    // each segment on its own
+    uint32_t linearMapPages{0};
+
+    // "grant-warmup": 1 to map the grants a device had resident when it
+    // disconnected as soon as it reconnects, 0 to start with an empty cache.
+    // Off by default: a reconnecting frontend may have revoked them.
+    bool grantWarmup{false};
+
+    // "max-queues": rings offered to the frontend through
+    // multi-queue-max-queues, each served by its own thread; 0 offers one
+    // per CPU
+    uint32_t maxQueues{0};
+
+    // "max-ring-order": largest shared ring offered through
+    // max-ring-page-order, 2^order pages
+    uint32_t maxRingPageOrder{4};
+
+    // "max-indirect-segments": most segments of an indirect request offered
+    // through feature-max-indirect-segments, up to the protocol limit of
+    // 4096 (16 MB). Devices offering more than 256 get a larger part of the
+    // grant budget.
+    uint32_t maxIndirectSegments{256};
+
+    // "workers": threads per device doing the disk I/O of its requests,
+    // shared by all its rings; 0 does it on the ring threads themselves
+    uint32_t workers{0};
+
+    // "max-in-flight": requests of the device, over all its rings, being
+    // worked on at once; more are left on the rings until some complete.
+    // 0 is unlimited.
+    uint32_t maxInFlight{0};
+
+    // "weight": share of a shared worker pool or reactor thread the device
+    // gets when devices compete for it, relative to the other devices'
+    // weights. At least 1; a weight of 0 is ignored.
+    uint32_t weight{1};
+
+    // Backend wide, not read from xenstore: threads of a pool shared by
+    // the devices without workers of their own, and the tasks a device of
+    // weight 1 runs on it per round
+    uint32_t sharedWorkers{0};
+    uint32_t fairQuantum{1};
+
+    // Backend wide: idle workers of one device take queued requests from
+    // the workers of busy ones
+    bool workStealing{false};
+
+    // Backend wide: requests of all devices together being worked on at
+    // once, 0 for unlimited
+    uint32_t maxInFlightTotal{0};
+
+    // Backend wide: threads waiting on the event channels of all rings
+    // together; 0 gives each ring a thread of its own
+    uint32_t reactorThreads{0};
+
+    // Backend wide: requests a ring of a device of weight 1 takes per turn
+    // on a reactor thread before the thread's other rings go; 0 takes all
+    // it finds
+    uint32_t reactorQuantum{8};
+
+    // "poll-us": longest a ring's thread spins on the ring for more
+    // requests before waiting on the event channel again; the actual
+    // window adapts to how often polling finds work. 0 disables polling.
+    uint32_t pollUs{0};
+
+    // "notify-batch", "notify-delay-us": hold a kick to the frontend back
+    // until this many responses are published or this long has passed.
+    // Both must be set for kicks to be coalesced.
+    uint32_t notifyBatch{0};
+    uint32_t notifyDelayUs{0};
+
+    // "notify-adaptive": 1 to scale notify-batch down to the recent
+    // response rate, so kicks aren't delayed under light load
+    bool notifyAdaptive{false};
+
+    // "merge-sectors": adjacent reads or writes consumed together are
+    // merged into one disk operation of up to this many sectors; 0 does
+    // each request on its own
+    uint32_t mergeSectors{0};
+
+    // "split-sectors": with more than one worker, reads and writes longer
+    // than this are split into chunks done by several workers at once;
+    // 0 never splits them
+    uint32_t splitSectors{256};
+
+    // "qos-read-iops", "qos-write-iops", "qos-read-bps", "qos-write-bps",
+    // "qos-burst-ms": rate limits of the device, 0 for none. Requests over
+    // the limits wait their turn. These keys are watched, so limits can be
+    // changed while the frontend is connected.
+    QosLimits qos;
+
+    // "cpus": CPU list such as "2-5,8" the device's ring and worker threads
+    // are kept on; empty leaves them where the process runs
+    std::vector<uint32_t> cpus;
+
+    // "cpu-policy": spread gives each thread the least used CPU of the
+    // list, shared lets every thread use all of them
+    CpuPolicyType cpuPolicy{CpuPolicyType::SPREAD};
+
+    // "numa-node": node the device's threads run on and allocate from,
+    // narrowing cpus to its CPUs; "auto" takes the node of the frontend's
+    // ring pages. Unset leaves NUMA placement alone.
+    int32_t numaNode{NUMA_NODE_NONE};
+};
+
+#endif
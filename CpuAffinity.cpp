@@ -0,0 +1,386 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "CpuAffinity.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// From linux/mempolicy.h, which libc doesn't wrap
+static constexpr int MPOL_DEFAULT_MODE = 0;
+static constexpr int MPOL_PREFERRED_MODE = 1;
+static constexpr unsigned long MPOL_F_NODE_FLAG = 1UL << 0;
+static constexpr unsigned long MPOL_F_ADDR_FLAG = 1UL << 1;
+
+// Nodes in the masks passed to the mempolicy calls
+static constexpr uint32_t MEMPOLICY_NODES = 1024U;
+static constexpr uint32_t MASK_BITS = sizeof(unsigned long) * 8U;
+#endif
+
+bool parseCpuPolicy(const std::string &name, CpuPolicyType &type)
+{
+    if (name == "spread") {
+        type = CpuPolicyType::SPREAD;
+    } else if (name == "shared") {
+        type = CpuPolicyType::SHARED;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+const char *cpuPolicyName(CpuPolicyType type) noexcept
+{
+    switch (type) {
+    case CpuPolicyType::SPREAD:
+        return "spread";
+    case CpuPolicyType::SHARED:
+        return "shared";
+    }
+
+    return "unknown";
+}
+
+static bool parseCpu(const std::string &text, uint32_t &cpu)
+{
+    char *end = nullptr;
+
+    if (text.empty()) {
+        return false;
+    }
+
+    const unsigned long value = strtoul(text.c_str(), &end, 10);
+
+    if (*end != '\0' || value >= 1024U) {
+        return false;
+    }
+
+    cpu = uint32_t(value);
+
+    return true;
+}
+
+bool parseCpuList(const std::string &list, std::vector<uint32_t> &cpus)
+{
+    std::istringstream stream(list);
+    std::string range;
+
+    cpus.clear();
+
+    while (std::getline(stream, range, ',')) {
+        const auto dash = range.find('-');
+        uint32_t first;
+        uint32_t last;
+
+        if (dash == std::string::npos) {
+            if (!parseCpu(range, first)) {
+                return false;
+            }
+
+            last = first;
+        } else if (!parseCpu(range.substr(0, dash), first) ||
+                   !parseCpu(range.substr(dash + 1), last) ||
+                   last < first) {
+            return false;
+        }
+
+        for (uint32_t cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+
+    return !cpus.empty();
+}
+
+std::string cpuListString(const std::vector<uint32_t> &cpus)
+{
+    std::string list;
+
+    for (const uint32_t cpu : cpus) {
+        if (!list.empty()) {
+            list += ",";
+        }
+
+        list += std::to_string(cpu);
+    }
+
+    return list;
+}
+
+bool setThreadAffinity(const std::vector<uint32_t> &cpus)
+{
+#ifdef _WIN32
+    DWORD_PTR mask = 0;
+
+    for (const uint32_t cpu : cpus) {
+        if (cpu < sizeof(mask) * 8U) {
+            mask |= DWORD_PTR(1) << cpu;
+        }
+    }
+
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    cpu_set_t mask;
+
+    CPU_ZERO(&mask);
+
+    for (const uint32_t cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &mask);
+        }
+    }
+
+    return CPU_COUNT(&mask) != 0 &&
+           pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+#endif
+}
+
+uint32_t CpuPlacement::acquire(const std::vector<uint32_t> &cpus)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    uint32_t best = cpus.front();
+
+    for (const uint32_t cpu : cpus) {
+        if (mUsers[cpu] < mUsers[best]) {
+            best = cpu;
+        }
+    }
+
+    mUsers[best]++;
+
+    return best;
+}
+
+void CpuPlacement::release(uint32_t cpu)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto itr = mUsers.find(cpu);
+
+    if (itr != mUsers.end() && itr->second != 0U) {
+        itr->second--;
+    }
+}
+
+uint32_t CpuPlacement::users(uint32_t cpu)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    return mUsers[cpu];
+}
+
+bool parseNumaNode(const std::string &text, int32_t &node)
+{
+    uint32_t value;
+
+    if (text == "auto") {
+        node = NUMA_NODE_AUTO;
+    } else if (parseCpu(text, value)) {
+        node = int32_t(value);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool numaNodeCpus(uint32_t node, std::vector<uint32_t> &cpus)
+{
+#ifdef _WIN32
+    ULONGLONG mask = 0;
+
+    cpus.clear();
+
+    if (node > 0xFFU || !GetNumaNodeProcessorMask(UCHAR(node), &mask)) {
+        return false;
+    }
+
+    for (uint32_t cpu = 0U; cpu < sizeof(mask) * 8U; cpu++) {
+        if (mask & (ULONGLONG(1) << cpu)) {
+            cpus.push_back(cpu);
+        }
+    }
+
+    return !cpus.empty();
+#else
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) +
+                       "/cpulist");
+    std::string list;
+
+    cpus.clear();
+
+    return std::getline(file, list) && parseCpuList(list, cpus);
+#endif
+}
+
+int32_t numaNodeOfAddress(const void *addr)
+{
+#ifdef _WIN32
+    PSAPI_WORKING_SET_EX_INFORMATION info = {};
+
+    info.VirtualAddress = const_cast<void *>(addr);
+
+    if (!QueryWorkingSetEx(GetCurrentProcess(), &info, sizeof(info)) ||
+        !info.VirtualAttributes.Valid) {
+        return NUMA_NODE_NONE;
+    }
+
+    return int32_t(info.VirtualAttributes.Node);
+#else
+    int node = NUMA_NODE_NONE;
+
+    if (syscall(SYS_get_mempolicy, &node, nullptr, 0UL, addr,
+                MPOL_F_NODE_FLAG | MPOL_F_ADDR_FLAG) != 0) {
+        return NUMA_NODE_NONE;
+    }
+
+    return node;
+#endif
+}
+
+int32_t currentNumaNode()
+{
+#ifdef _WIN32
+    PROCESSOR_NUMBER processor;
+    USHORT node;
+
+    GetCurrentProcessorNumberEx(&processor);
+
+    if (!GetNumaProcessorNodeEx(&processor, &node)) {
+        return NUMA_NODE_NONE;
+    }
+
+    return int32_t(node);
+#else
+    unsigned cpu;
+    unsigned node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return NUMA_NODE_NONE;
+    }
+
+    return int32_t(node);
+#endif
+}
+
+bool setThreadMemoryNode(int32_t node)
+{
+#ifdef _WIN32
+    // Windows allocates from the node of the CPU the thread runs on
+    (void)node;
+    return true;
+#else
+    unsigned long mask[1024U / (sizeof(unsigned long) * 8U)] = {};
+    const uint32_t bits = sizeof(unsigned long) * 8U;
+
+    if (node < 0) {
+        return syscall(SYS_set_mempolicy, MPOL_DEFAULT_MODE, nullptr, 0UL) == 0;
+    }
+
+    if (uint32_t(node) >= sizeof(mask) * 8U) {
+        return false;
+    }
+
+    mask[node / bits] |= 1UL << (node % bits);
+
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED_MODE, mask,
+                   sizeof(mask) * 8U + 1U) == 0;
+#endif
+}
+
+#ifndef _WIN32
+static bool getThreadMemoryPolicy(int &mode, std::vector<unsigned long> &mask)
+{
+    mask.assign(MEMPOLICY_NODES / MASK_BITS, 0UL);
+
+    return syscall(SYS_get_mempolicy, &mode, mask.data(), MEMPOLICY_NODES,
+                   nullptr, 0UL) == 0;
+}
+#endif
+
+int32_t threadMemoryNode()
+{
+#ifdef _WIN32
+    return NUMA_NODE_NONE;
+#else
+    std::vector<unsigned long> mask;
+    int mode;
+
+    if (!getThreadMemoryPolicy(mode, mask) || mode != MPOL_PREFERRED_MODE) {
+        return NUMA_NODE_NONE;
+    }
+
+    for (uint32_t node = 0U; node < MEMPOLICY_NODES; node++) {
+        if (mask[node / MASK_BITS] & (1UL << (node % MASK_BITS))) {
+            return int32_t(node);
+        }
+    }
+
+    return NUMA_NODE_NONE;
+#endif
+}
+
+ScopedMemoryNode::ScopedMemoryNode(int32_t node)
+{
+#ifndef _WIN32
+    if (node < 0 || !getThreadMemoryPolicy(mMode, mMask)) {
+        return;
+    }
+
+    mSet = setThreadMemoryNode(node);
+#else
+    (void)node;
+#endif
+}
+
+ScopedMemoryNode::~ScopedMemoryNode()
+{
+#ifndef _WIN32
+    if (!mSet) {
+        return;
+    }
+
+    // The default policy takes no nodes
+    syscall(SYS_set_mempolicy, mMode,
+            mMode == MPOL_DEFAULT_MODE ? nullptr : mMask.data(),
+            mMode == MPOL_DEFAULT_MODE ? 0UL : MEMPOLICY_NODES + 1UL);
+#endif
+}
@@ -0,0 +1,113 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef BLKBACK_CPUAFFINITY_HPP
+#define BLKBACK_CPUAFFINITY_HPP
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class CpuPolicyType {
+    // Each thread gets a CPU of its own from the set, the least used one
+    SPREAD,
+    // Every thread may run on any CPU of the set
+    SHARED
+};
+
+bool parseCpuPolicy(const std::string &name, CpuPolicyType &type);
+const char *cpuPolicyName(CpuPolicyType type) noexcept;
+
+// Parses a CPU list such as "0-3,8,10-11". Returns false if it is malformed
+// or empty.
+bool parseCpuList(const std::string &list, std::vector<uint32_t> &cpus);
+
+std::string cpuListString(const std::vector<uint32_t> &cpus);
+
+// Restricts the calling thread to cpus
+bool setThreadAffinity(const std::vector<uint32_t> &cpus);
+
+// Values of a numa-node setting besides a node number
+static constexpr int32_t NUMA_NODE_NONE = -1;
+static constexpr int32_t NUMA_NODE_AUTO = -2;
+
+// Parses a node number or "auto"
+bool parseNumaNode(const std::string &text, int32_t &node);
+
+// CPUs of a NUMA node. Returns false if the node doesn't exist.
+bool numaNodeCpus(uint32_t node, std::vector<uint32_t> &cpus);
+
+// Node of the memory at addr, or NUMA_NODE_NONE if it can't be told
+int32_t numaNodeOfAddress(const void *addr);
+
+// Node the calling thread is running on, or NUMA_NODE_NONE
+int32_t currentNumaNode();
+
+// Makes the calling thread allocate memory from node where it can, or as
+// it did before with NUMA_NODE_NONE
+bool setThreadMemoryNode(int32_t node);
+
+// Node the calling thread prefers to allocate memory from, or
+// NUMA_NODE_NONE if it has no preference
+int32_t threadMemoryNode();
+
+//
+// Makes the calling thread allocate memory from a node for as long as it
+// lives, then puts back whatever policy the thread had. Does nothing for
+// NUMA_NODE_NONE.
+//
+class ScopedMemoryNode
+{
+public:
+    explicit ScopedMemoryNode(int32_t node);
+    ~ScopedMemoryNode();
+
+    ScopedMemoryNode(const ScopedMemoryNode &) = delete;
+    ScopedMemoryNode &operator=(const ScopedMemoryNode &) = delete;
+
+private:
+    bool mSet{false};
+    int mMode{0};
+    std::vector<unsigned long> mMask;
+};
+
+//
+// Hands out CPUs to backend threads under the spread policy, keeping count
+// of how many threads each CPU has so new ones go to the least used CPU of
+// their set. Shared by all devices.
+//
+class CpuPlacement
+{
+public:
+    uint32_t acquire(const std::vector<uint32_t> &cpus);
+    void release(uint32_t cpu);
+
+    uint32_t users(uint32_t cpu);
+
+private:
+    std::mutex mMutex;
+    std::map<uint32_t, uint32_t> mUsers;
+};
+
+#endif
@@ -0,0 +1,93 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "DeadlineTimer.hpp"
+
+DeadlineTimer::DeadlineTimer(std::function<void()> onExpiry) :
+    mOnExpiry(onExpiry)
+{
+}
+
+DeadlineTimer::~DeadlineTimer()
+{
+    this->stop();
+}
+
+void DeadlineTimer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+
+    mCond.notify_all();
+
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+void DeadlineTimer::arm(clock::time_point deadline)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if (mStopping || (mArmed && mDeadline <= deadline)) {
+            return;
+        }
+
+        mArmed = true;
+        mDeadline = deadline;
+
+        if (!mThread.joinable()) {
+            mThread = std::thread(&DeadlineTimer::run, this);
+        }
+    }
+
+    mCond.notify_one();
+}
+
+void DeadlineTimer::run()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    while (!mStopping) {
+        if (!mArmed) {
+            mCond.wait(lock);
+            continue;
+        }
+
+        if (mCond.wait_until(lock, mDeadline) != std::cv_status::timeout) {
+            continue;
+        }
+
+        if (!mArmed || clock::now() < mDeadline) {
+            continue;
+        }
+
+        mArmed = false;
+
+        lock.unlock();
+        mOnExpiry();
+        lock.lock();
+    }
+}
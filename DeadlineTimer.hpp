@@ -0,0 +1,67 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef BLKBACK_DEADLINETIMER_HPP
+#define BLKBACK_DEADLINETIMER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+//
+// Calls onExpiry from a thread of its own once the earliest armed deadline
+// has passed. The thread is started by the first arm(), so a timer that is
+// never used costs nothing.
+//
+class DeadlineTimer
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit DeadlineTimer(std::function<void()> onExpiry);
+    ~DeadlineTimer();
+
+    DeadlineTimer(const DeadlineTimer &) = delete;
+    DeadlineTimer &operator=(const DeadlineTimer &) = delete;
+
+    // Makes onExpiry run at deadline, unless it is already due earlier
+    void arm(clock::time_point deadline);
+
+    // Stops the thread. onExpiry isn't called once this returns.
+    void stop();
+
+private:
+    void run();
+
+    std::function<void()> mOnExpiry;
+
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    bool mArmed{false};
+    bool mStopping{false};
+    clock::time_point mDeadline{};
+    std::thread mThread;
+};
+
+#endif
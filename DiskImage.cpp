@@ -1,4 +1,5 @@
 #include "DiskImage.h"
+#include <climits>
 #include <cstring>
 
 #ifndef _WIN32
@@ -132,10 +133,75 @@ DiskImage::writeSectors(blkif_sector_t start_sector,
     return BLKIF_RSP_OKAY;
 }
 
+static uint64_t
+totalSectors(const DiskIoVec *vecs, size_t count)
+{
+    uint64_t nr_sectors = 0U;
+
+    for (size_t i = 0U; i < count; i++) {
+        nr_sectors += vecs[i].nr_sectors;
+    }
+
+    return nr_sectors;
+}
+
+int
+DiskImage::readSectorsv(blkif_sector_t start_sector,
+                        const DiskIoVec *vecs,
+                        size_t count)
+{
+    const uint64_t nr_sectors = totalSectors(vecs, count);
+
+    if (nr_sectors == 0U || nr_sectors > this->getSectorCount() ||
+        start_sector > this->getSectorCount() - nr_sectors) {
+        std::cerr << "readSectorsv failed, start_sector = " << start_sector
+                  << ", nr_sectors = " << nr_sectors
+                  << ", sector_count = " << this->getSectorCount();
+        return BLKIF_RSP_ERROR;
+    }
+
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(mFile->get()) +
+                         uintptr_t(start_sector * this->getSectorSize());
+
+    for (size_t i = 0U; i < count; i++) {
+        memcpy(vecs[i].buffer, src, vecs[i].nr_sectors * this->getSectorSize());
+        src += vecs[i].nr_sectors * this->getSectorSize();
+    }
+
+    return BLKIF_RSP_OKAY;
+}
+
+int
+DiskImage::writeSectorsv(blkif_sector_t start_sector,
+                         const DiskIoVec *vecs,
+                         size_t count)
+{
+    const uint64_t nr_sectors = totalSectors(vecs, count);
+
+    if (nr_sectors == 0U || nr_sectors > this->getSectorCount() ||
+        start_sector > this->getSectorCount() - nr_sectors) {
+        std::cerr << "writeSectorsv failed, start_sector = " << start_sector
+                  << ", nr_sectors = " << nr_sectors
+                  << ", sector_count = " << this->getSectorCount();
+        return BLKIF_RSP_ERROR;
+    }
+
+    uint8_t *dst = reinterpret_cast<uint8_t *>(mFile->get()) +
+                   uintptr_t(start_sector * this->getSectorSize());
+
+    for (size_t i = 0U; i < count; i++) {
+        memcpy(dst, vecs[i].buffer, vecs[i].nr_sectors * this->getSectorSize());
+        dst += vecs[i].nr_sectors * this->getSectorSize();
+    }
+
+    return BLKIF_RSP_OKAY;
+}
+
 int
 DiskImage::discard(blkif_sector_t start_sector, uint64_t nr_sectors)
 {
-    if (start_sector + nr_sectors > this->getSectorCount()) {
+    if (nr_sectors > this->getSectorCount() ||
+        start_sector > this->getSectorCount() - nr_sectors) {
         return BLKIF_RSP_ERROR;
     }
 
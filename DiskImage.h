@@ -13,6 +13,13 @@ extern "C" {
 
 #define SECTOR_SIZE 512
 
+// One buffer of a vectored read or write, covering the sectors after the
+// previous one
+struct DiskIoVec {
+    uint8_t *buffer;
+    uint64_t nr_sectors;
+};
+
 class DiskImage {
 public:
     DiskImage(const std::string &path);
@@ -27,6 +34,8 @@ public:
 
     int writeSectors(blkif_sector_t start_sector, uint64_t nr_sectors, const uint8_t *buffer);
     int readSectors(blkif_sector_t start_sector, uint64_t nr_sectors, uint8_t *buffer);
+    int writeSectorsv(blkif_sector_t start_sector, const DiskIoVec *vecs, size_t count);
+    int readSectorsv(blkif_sector_t start_sector, const DiskIoVec *vecs, size_t count);
     int discard(blkif_sector_t start_sector, uint64_t nr_sectors);
 
     void flushBackingFile();
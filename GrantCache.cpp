@@ -0,0 +1,864 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "GrantCache.hpp"
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+// Policies
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Recency list with O(1) lookup, most recently used at the front
+class RecencyList
+{
+public:
+    bool contains(grant_ref_t gref) const { return mMap.count(gref) != 0U; }
+    bool empty() const noexcept { return mList.empty(); }
+    uint64_t size() const noexcept { return mList.size(); }
+
+    void pushFront(grant_ref_t gref)
+    {
+        mList.push_front(gref);
+        mMap[gref] = mList.begin();
+    }
+
+    void moveToFront(grant_ref_t gref)
+    {
+        mList.splice(mList.begin(), mList, mMap[gref]);
+    }
+
+    grant_ref_t popBack()
+    {
+        const grant_ref_t gref = mList.back();
+
+        mMap.erase(gref);
+        mList.pop_back();
+
+        return gref;
+    }
+
+    bool erase(grant_ref_t gref)
+    {
+        auto itr = mMap.find(gref);
+        if (itr == mMap.end()) {
+            return false;
+        }
+
+        mList.erase(itr->second);
+        mMap.erase(itr);
+
+        return true;
+    }
+
+    void clear()
+    {
+        mList.clear();
+        mMap.clear();
+    }
+
+private:
+    std::list<grant_ref_t> mList;
+    std::unordered_map<grant_ref_t, std::list<grant_ref_t>::iterator> mMap;
+};
+
+class LruPolicy final : public GrantCachePolicy
+{
+public:
+    void hit(grant_ref_t gref) override { mLru.moveToFront(gref); }
+    void miss(grant_ref_t) override { }
+    void insert(grant_ref_t gref) override { mLru.pushFront(gref); }
+    grant_ref_t evict() override { return mLru.popBack(); }
+    void clear() override { mLru.clear(); }
+
+private:
+    RecencyList mLru;
+};
+
+// Second chance: a referenced grant survives one sweep of the hand
+class ClockPolicy final : public GrantCachePolicy
+{
+public:
+    void hit(grant_ref_t gref) override
+    {
+        mSlots[mIndex[gref]].referenced = true;
+    }
+
+    void miss(grant_ref_t) override { }
+
+    void insert(grant_ref_t gref) override
+    {
+        uint64_t index;
+
+        if (!mFree.empty()) {
+            index = mFree.back();
+            mFree.pop_back();
+        } else {
+            index = mSlots.size();
+            mSlots.emplace_back();
+        }
+
+        mSlots[index] = {gref, true, true};
+        mIndex[gref] = index;
+    }
+
+    grant_ref_t evict() override
+    {
+        while (true) {
+            Slot &slot = mSlots[mHand];
+            const uint64_t index = mHand;
+
+            mHand = (mHand + 1U) % mSlots.size();
+
+            if (!slot.used) {
+                continue;
+            }
+
+            if (slot.referenced) {
+                slot.referenced = false;
+                continue;
+            }
+
+            slot.used = false;
+            mFree.push_back(index);
+            mIndex.erase(slot.gref);
+
+            return slot.gref;
+        }
+    }
+
+    void clear() override
+    {
+        mSlots.clear();
+        mFree.clear();
+        mIndex.clear();
+        mHand = 0U;
+    }
+
+private:
+    struct Slot {
+        grant_ref_t gref;
+        bool referenced;
+        bool used;
+    };
+
+    std::vector<Slot> mSlots;
+    std::vector<uint64_t> mFree;
+    std::unordered_map<grant_ref_t, uint64_t> mIndex;
+    uint64_t mHand{0};
+};
+
+// Full 2Q (Johnson & Shasha): first-time grants go through a FIFO and only
+// graduate to the LRU when they are seen again after leaving it, so a scan
+// over a large buffer pool cannot flush the hot set.
+class TwoQPolicy final : public GrantCachePolicy
+{
+public:
+    TwoQPolicy(uint64_t capacity) :
+        mKin(std::max<uint64_t>(capacity / 4U, 1U)),
+        mKout(std::max<uint64_t>(capacity / 2U, 1U))
+    { }
+
+    void hit(grant_ref_t gref) override
+    {
+        if (mAm.contains(gref)) {
+            mAm.moveToFront(gref);
+        }
+    }
+
+    void miss(grant_ref_t) override { }
+
+    void insert(grant_ref_t gref) override
+    {
+        if (mA1out.erase(gref)) {
+            mAm.pushFront(gref);
+        } else {
+            mA1in.pushFront(gref);
+        }
+    }
+
+    grant_ref_t evict() override
+    {
+        if (mAm.empty() || (!mA1in.empty() && mA1in.size() > mKin)) {
+            const grant_ref_t gref = mA1in.popBack();
+
+            mA1out.pushFront(gref);
+            if (mA1out.size() > mKout) {
+                mA1out.popBack();
+            }
+
+            return gref;
+        }
+
+        return mAm.popBack();
+    }
+
+    void clear() override
+    {
+        mA1in.clear();
+        mA1out.clear();
+        mAm.clear();
+    }
+
+    void resize(uint64_t capacity) override
+    {
+        mKin = std::max<uint64_t>(capacity / 4U, 1U);
+        mKout = std::max<uint64_t>(capacity / 2U, 1U);
+
+        while (mA1out.size() > mKout) {
+            mA1out.popBack();
+        }
+    }
+
+private:
+    uint64_t mKin;
+    uint64_t mKout;
+    RecencyList mA1in;
+    RecencyList mA1out;
+    RecencyList mAm;
+};
+
+// Adaptive Replacement Cache (Megiddo & Modha). T1/T2 hold resident grants
+// seen once/more than once, B1/B2 remember what was recently evicted from
+// each and steer the target size of T1.
+class ArcPolicy final : public GrantCachePolicy
+{
+public:
+    ArcPolicy(uint64_t capacity) : mCapacity(capacity) { }
+
+    void hit(grant_ref_t gref) override
+    {
+        if (mT1.erase(gref)) {
+            mT2.pushFront(gref);
+        } else {
+            mT2.moveToFront(gref);
+        }
+    }
+
+    void miss(grant_ref_t gref) override
+    {
+        mGhostHitB2 = false;
+
+        if (mB1.contains(gref)) {
+            const uint64_t delta = std::max<uint64_t>(mB2.size() / mB1.size(), 1U);
+            mTarget = std::min(mCapacity, mTarget + delta);
+        } else if (mB2.contains(gref)) {
+            const uint64_t delta = std::max<uint64_t>(mB1.size() / mB2.size(), 1U);
+            mTarget = mTarget > delta ? mTarget - delta : 0U;
+            mGhostHitB2 = true;
+        } else if (mT1.size() + mB1.size() >= mCapacity && !mB1.empty()) {
+            mB1.popBack();
+        } else if (mT1.size() + mT2.size() + mB1.size() + mB2.size() >= 2U * mCapacity &&
+                   !mB2.empty()) {
+            mB2.popBack();
+        }
+    }
+
+    void insert(grant_ref_t gref) override
+    {
+        if (mB1.erase(gref) || mB2.erase(gref)) {
+            mT2.pushFront(gref);
+        } else {
+            mT1.pushFront(gref);
+        }
+    }
+
+    grant_ref_t evict() override
+    {
+        grant_ref_t gref;
+
+        if (!mT1.empty() &&
+            (mT2.empty() || mT1.size() > mTarget ||
+             (mGhostHitB2 && mT1.size() == mTarget))) {
+            gref = mT1.popBack();
+            mB1.pushFront(gref);
+        } else {
+            gref = mT2.popBack();
+            mB2.pushFront(gref);
+        }
+
+        while (mB1.size() + mB2.size() > mCapacity) {
+            if (mB1.size() > mB2.size()) {
+                mB1.popBack();
+            } else {
+                mB2.popBack();
+            }
+        }
+
+        return gref;
+    }
+
+    void clear() override
+    {
+        mT1.clear();
+        mT2.clear();
+        mB1.clear();
+        mB2.clear();
+        mTarget = 0U;
+    }
+
+    void resize(uint64_t capacity) override
+    {
+        // The ghost lists are trimmed to the new capacity by evict()
+        mCapacity = capacity;
+        mTarget = std::min(mTarget, capacity);
+    }
+
+private:
+    uint64_t mCapacity;
+    uint64_t mTarget{0};
+    bool mGhostHitB2{false};
+    RecencyList mT1;
+    RecencyList mT2;
+    RecencyList mB1;
+    RecencyList mB2;
+};
+
+// Least frequently used, least recently used among equals
+class LfuPolicy final : public GrantCachePolicy
+{
+public:
+    void hit(grant_ref_t gref) override
+    {
+        auto &entry = mEntries[gref];
+
+        this->unlink(gref, entry);
+        entry.count++;
+        this->link(gref, entry);
+    }
+
+    void miss(grant_ref_t) override { }
+
+    void insert(grant_ref_t gref) override
+    {
+        auto &entry = mEntries[gref];
+
+        entry.count = 1U;
+        this->link(gref, entry);
+    }
+
+    grant_ref_t evict() override
+    {
+        auto bucket = mBuckets.begin();
+        const grant_ref_t gref = bucket->second.back();
+
+        bucket->second.pop_back();
+        if (bucket->second.empty()) {
+            mBuckets.erase(bucket);
+        }
+
+        mEntries.erase(gref);
+
+        return gref;
+    }
+
+    void clear() override
+    {
+        mEntries.clear();
+        mBuckets.clear();
+    }
+
+private:
+    struct Entry {
+        uint64_t count;
+        std::list<grant_ref_t>::iterator pos;
+    };
+
+    void link(grant_ref_t gref, Entry &entry)
+    {
+        auto &bucket = mBuckets[entry.count];
+
+        bucket.push_front(gref);
+        entry.pos = bucket.begin();
+    }
+
+    void unlink(grant_ref_t gref, Entry &entry)
+    {
+        auto bucket = mBuckets.find(entry.count);
+
+        bucket->second.erase(entry.pos);
+        if (bucket->second.empty()) {
+            mBuckets.erase(bucket);
+        }
+    }
+
+    std::unordered_map<grant_ref_t, Entry> mEntries;
+    std::map<uint64_t, std::list<grant_ref_t>> mBuckets;
+};
+
+struct PolicyName {
+    GrantCachePolicyType type;
+    const char *name;
+};
+
+constexpr PolicyName POLICY_NAMES[] = {
+    {GrantCachePolicyType::LRU, "lru"},
+    {GrantCachePolicyType::CLOCK, "clock"},
+    {GrantCachePolicyType::TWO_Q, "2q"},
+    {GrantCachePolicyType::ARC, "arc"},
+    {GrantCachePolicyType::LFU, "lfu"},
+};
+
+}
+
+bool parseGrantCachePolicy(const std::string &name, GrantCachePolicyType &type)
+{
+    for (const auto &policy : POLICY_NAMES) {
+        if (name == policy.name) {
+            type = policy.type;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *grantCachePolicyName(GrantCachePolicyType type) noexcept
+{
+    for (const auto &policy : POLICY_NAMES) {
+        if (type == policy.type) {
+            return policy.name;
+        }
+    }
+
+    return "unknown";
+}
+
+std::unique_ptr<GrantCachePolicy>
+GrantCachePolicy::create(GrantCachePolicyType type, uint64_t capacity)
+{
+    switch (type) {
+    case GrantCachePolicyType::CLOCK:
+        return std::unique_ptr<GrantCachePolicy>(new ClockPolicy());
+    case GrantCachePolicyType::TWO_Q:
+        return std::unique_ptr<GrantCachePolicy>(new TwoQPolicy(capacity));
+    case GrantCachePolicyType::ARC:
+        return std::unique_ptr<GrantCachePolicy>(new ArcPolicy(capacity));
+    case GrantCachePolicyType::LFU:
+        return std::unique_ptr<GrantCachePolicy>(new LfuPolicy());
+    case GrantCachePolicyType::LRU:
+    default:
+        return std::unique_ptr<GrantCachePolicy>(new LruPolicy());
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// GrantCache
+////////////////////////////////////////////////////////////////////////////////
+
+GrantCache::GrantCache(GrantCachePolicyType policy,
+                       uint64_t capacity,
+                       uint64_t evictionSize) :
+    mPolicyType(policy),
+    mPolicy(GrantCachePolicy::create(policy, capacity)),
+    mCapacity(capacity),
+    mEvictionSize(std::max<uint64_t>(std::min(evictionSize, capacity), 1U))
+{ }
+
+void *GrantCache::get(grant_ref_t gref)
+{
+    auto itr = mPages.find(gref);
+
+    if (itr != mPages.end()) {
+        mStats.hits++;
+        mPolicy->hit(gref);
+        return itr->second;
+    }
+
+    mStats.misses++;
+    mPolicy->miss(gref);
+
+    if (mPages.size() >= mCapacity) {
+        this->evict(mEvictionSize);
+    }
+
+    void *addr = this->map(gref);
+
+    if (!addr) {
+        mStats.mapFailures++;
+        return nullptr;
+    }
+
+    mPages.emplace(gref, addr);
+    mPolicy->insert(gref);
+
+    return addr;
+}
+
+uint64_t GrantCache::warm(const std::vector<grant_ref_t> &grefs)
+{
+    std::vector<grant_ref_t> batch;
+
+    for (const grant_ref_t gref : grefs) {
+        if (mPages.size() + batch.size() >= mCapacity) {
+            break;
+        }
+
+        if (mPages.count(gref) == 0U) {
+            batch.push_back(gref);
+        }
+    }
+
+    if (batch.empty()) {
+        return 0U;
+    }
+
+    const uint32_t count = uint32_t(batch.size());
+    std::vector<void *> addrs(count);
+    uint64_t mapped = 0U;
+
+    if (void *base = this->mapBatch(batch.data(), count, addrs.data())) {
+        mBatches.emplace(base, Batch{count, count});
+
+        for (uint32_t i = 0U; i < count; i++) {
+            mPages.emplace(batch[i], addrs[i]);
+            mBatchPages.emplace(addrs[i], base);
+            mPolicy->insert(batch[i]);
+        }
+
+        mapped = count;
+    } else {
+        // One stale gref fails the whole batch, so map what still can be
+        for (const grant_ref_t gref : batch) {
+            void *addr = this->map(gref);
+
+            if (!addr) {
+                mStats.mapFailures++;
+                continue;
+            }
+
+            mPages.emplace(gref, addr);
+            mPolicy->insert(gref);
+            mapped++;
+        }
+    }
+
+    mStats.warmed += mapped;
+
+    return mapped;
+}
+
+std::vector<grant_ref_t> GrantCache::resident() const
+{
+    std::vector<grant_ref_t> grefs;
+
+    grefs.reserve(mPages.size());
+
+    for (const auto &page : mPages) {
+        grefs.push_back(page.first);
+    }
+
+    return grefs;
+}
+
+void GrantCache::release(grant_ref_t gref, void *addr)
+{
+    auto page = mBatchPages.find(addr);
+
+    if (page == mBatchPages.end()) {
+        this->unmap(gref, addr);
+        return;
+    }
+
+    auto batch = mBatches.find(page->second);
+
+    if (--batch->second.mapped == 0U) {
+        this->unmapBatch(batch->first, batch->second.count);
+        mBatches.erase(batch);
+    }
+
+    mBatchPages.erase(page);
+}
+
+void GrantCache::evict(uint64_t count)
+{
+    for (uint64_t i = 0U; i < count && !mPages.empty(); i++) {
+        const grant_ref_t gref = mPolicy->evict();
+        auto itr = mPages.find(gref);
+
+        if (mPins.count(gref) != 0U) {
+            mEvicted.emplace(gref, itr->second);
+        } else {
+            this->release(gref, itr->second);
+        }
+
+        mPages.erase(itr);
+        mStats.evictions++;
+    }
+}
+
+void GrantCache::pin(grant_ref_t gref)
+{
+    mPins[gref]++;
+}
+
+void GrantCache::unpin(grant_ref_t gref)
+{
+    auto itr = mPins.find(gref);
+
+    if (itr == mPins.end() || --itr->second != 0U) {
+        return;
+    }
+
+    mPins.erase(itr);
+
+    const auto range = mEvicted.equal_range(gref);
+
+    for (auto evicted = range.first; evicted != range.second; ++evicted) {
+        this->release(gref, evicted->second);
+    }
+
+    mEvicted.erase(range.first, range.second);
+}
+
+void GrantCache::clear()
+{
+    for (auto &page : mPages) {
+        this->release(page.first, page.second);
+    }
+
+    for (auto &page : mEvicted) {
+        this->release(page.first, page.second);
+    }
+
+    mPages.clear();
+    mPins.clear();
+    mEvicted.clear();
+    mPolicy->clear();
+}
+
+void GrantCache::resize(uint64_t capacity, uint64_t evictionSize)
+{
+    mCapacity = capacity;
+    mEvictionSize = std::max<uint64_t>(std::min(evictionSize, capacity), 1U);
+    mPolicy->resize(capacity);
+
+    if (mPages.size() > mCapacity) {
+        this->evict(mPages.size() - mCapacity);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// GrantRetention
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t retentionKey(uint16_t domId, uint16_t devId) noexcept
+{
+    return (uint32_t(domId) << 16) | devId;
+}
+
+void GrantRetention::save(uint16_t domId,
+                          uint16_t devId,
+                          std::vector<RetainedGrants> queues)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mGrants[retentionKey(domId, devId)] = std::move(queues);
+}
+
+std::vector<RetainedGrants> GrantRetention::take(uint16_t domId, uint16_t devId)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::vector<RetainedGrants> grants;
+
+    auto itr = mGrants.find(retentionKey(domId, devId));
+    if (itr != mGrants.end()) {
+        grants = std::move(itr->second);
+        mGrants.erase(itr);
+    }
+
+    return grants;
+}
+
+void GrantRetention::prune(const std::function<bool(uint16_t)> &alive)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    for (auto itr = mGrants.begin(); itr != mGrants.end();) {
+        if (alive(uint16_t(itr->first >> 16))) {
+            ++itr;
+        } else {
+            itr = mGrants.erase(itr);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// GrantBudget
+////////////////////////////////////////////////////////////////////////////////
+
+GrantBudget::GrantBudget(uint64_t total, uint64_t perDevice, uint64_t minPerDevice) :
+    mTotal(total),
+    mPerDevice(perDevice),
+    mMinPerDevice(minPerDevice)
+{ }
+
+bool GrantBudget::join(uint64_t shares, uint64_t floor)
+{
+    const uint64_t total = mFloor += deviceFloor(shares, floor);
+
+    mDevices++;
+    mShares += shares;
+    mGeneration++;
+
+    return total <= mTotal;
+}
+
+void GrantBudget::leave(uint64_t shares, uint64_t floor)
+{
+    mFloor -= deviceFloor(shares, floor);
+    mDevices--;
+    mShares -= shares;
+    mGeneration++;
+}
+
+uint64_t GrantBudget::deviceFloor(uint64_t shares, uint64_t floor) const noexcept
+{
+    return std::max(shares * mMinPerDevice, floor);
+}
+
+uint64_t GrantBudget::share(uint64_t shares) const noexcept
+{
+    const uint64_t total = std::max<uint64_t>(mShares, 1U);
+
+    return shares * std::max(std::min(mTotal / total, mPerDevice), mMinPerDevice);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// LinearMapCache
+////////////////////////////////////////////////////////////////////////////////
+
+size_t LinearMapCache::SequenceHash::operator()(
+    const std::vector<grant_ref_t> &grefs) const noexcept
+{
+    // FNV-1a over the references
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (const grant_ref_t gref : grefs) {
+        hash ^= gref;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return size_t(hash);
+}
+
+LinearMapCache::LinearMapCache(uint64_t capacity) :
+    mCapacity(capacity)
+{ }
+
+void *LinearMapCache::get(const grant_ref_t *grefs, uint32_t count)
+{
+    if (count == 0U || count > mCapacity) {
+        return nullptr;
+    }
+
+    mKey.assign(grefs, grefs + count);
+
+    auto itr = mExtents.find(mKey);
+
+    if (itr != mExtents.end()) {
+        mStats.hits++;
+        mLru.splice(mLru.begin(), mLru, itr->second);
+        return itr->second->addr;
+    }
+
+    mStats.misses++;
+
+    while (mPages + count > mCapacity) {
+        this->evictOne();
+    }
+
+    void *addr = this->map(grefs, count);
+
+    if (!addr) {
+        mStats.mapFailures++;
+        return nullptr;
+    }
+
+    mLru.push_front(Extent{mKey, addr});
+    mExtents.emplace(mKey, mLru.begin());
+    mPages += count;
+
+    return addr;
+}
+
+void LinearMapCache::evictOne()
+{
+    const Extent &extent = mLru.back();
+    const uint32_t count = uint32_t(extent.grefs.size());
+
+    if (mPins.count(extent.addr) != 0U) {
+        mEvicted.emplace(extent.addr, count);
+    } else {
+        this->unmap(extent.addr, count);
+    }
+
+    mExtents.erase(extent.grefs);
+    mLru.pop_back();
+    mPages -= count;
+    mStats.evictions++;
+}
+
+void LinearMapCache::pin(void *addr)
+{
+    mPins[addr]++;
+}
+
+void LinearMapCache::unpin(void *addr)
+{
+    auto itr = mPins.find(addr);
+
+    if (itr == mPins.end() || --itr->second != 0U) {
+        return;
+    }
+
+    mPins.erase(itr);
+
+    auto evicted = mEvicted.find(addr);
+
+    if (evicted != mEvicted.end()) {
+        this->unmap(evicted->first, evicted->second);
+        mEvicted.erase(evicted);
+    }
+}
+
+void LinearMapCache::clear()
+{
+    for (auto &extent : mLru) {
+        this->unmap(extent.addr, uint32_t(extent.grefs.size()));
+    }
+
+    for (auto &extent : mEvicted) {
+        this->unmap(extent.first, extent.second);
+    }
+
+    mPins.clear();
+    mEvicted.clear();
+    mExtents.clear();
+    mLru.clear();
+    mPages = 0U;
+}
@@ -0,0 +1,315 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef BLKBACK_GRANTCACHE_HPP
+#define BLKBACK_GRANTCACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <xen/grant_table.h>
+}
+
+enum class GrantCachePolicyType {
+    LRU,
+    CLOCK,
+    TWO_Q,
+    ARC,
+    LFU
+};
+
+bool parseGrantCachePolicy(const std::string &name, GrantCachePolicyType &type);
+const char *grantCachePolicyName(GrantCachePolicyType type) noexcept;
+
+//
+// Decides which persistent grants stay mapped. A policy only tracks grant
+// references; mapping and unmapping is left to the GrantCache using it.
+//
+class GrantCachePolicy
+{
+public:
+    virtual ~GrantCachePolicy() = default;
+
+    // A resident gref was accessed
+    virtual void hit(grant_ref_t gref) = 0;
+
+    // A non-resident gref was accessed. Called before any evictions needed
+    // to make room for it, so history-based policies can adapt.
+    virtual void miss(grant_ref_t gref) = 0;
+
+    // A gref was mapped and is now resident
+    virtual void insert(grant_ref_t gref) = 0;
+
+    // Chooses a resident gref to unmap and stops tracking it as resident
+    virtual grant_ref_t evict() = 0;
+
+    virtual void clear() = 0;
+
+    // The cache's capacity changed. Resident grants over it are evicted by
+    // the cache afterwards.
+    virtual void resize(uint64_t capacity) { (void)capacity; }
+
+    static std::unique_ptr<GrantCachePolicy> create(GrantCachePolicyType type,
+                                                    uint64_t capacity);
+};
+
+struct GrantCacheStats {
+    uint64_t hits{0};
+    uint64_t misses{0};
+    uint64_t evictions{0};
+    uint64_t mapFailures{0};
+    uint64_t warmed{0};
+};
+
+//
+// Bounded set of mapped grants. When full, evictionSize grants are unmapped
+// at once so the cost of eviction is amortized over several misses.
+// Derived classes provide the mapping and must call clear() from their
+// destructor.
+//
+class GrantCache
+{
+public:
+    GrantCache(GrantCachePolicyType policy,
+               uint64_t capacity,
+               uint64_t evictionSize);
+    virtual ~GrantCache() = default;
+
+    GrantCache(const GrantCache &) = delete;
+    GrantCache &operator=(const GrantCache &) = delete;
+
+    // Returns the address gref is mapped at, mapping it if needed
+    void *get(grant_ref_t gref);
+
+    // Maps grefs ahead of use while there is free room, skipping any that
+    // are already resident. The rest are mapped with one mapBatch() call,
+    // or one at a time, skipping those that fail, if that fails. Returns
+    // how many were mapped.
+    uint64_t warm(const std::vector<grant_ref_t> &grefs);
+
+    // The currently mapped grefs
+    std::vector<grant_ref_t> resident() const;
+
+    // Keeps gref's mapping valid until a matching unpin(), even if the
+    // policy evicts it meanwhile; an evicted mapping is then unmapped by
+    // the last unpin(). Lets requests still in flight use grants the cache
+    // has moved on from.
+    void pin(grant_ref_t gref);
+    void unpin(grant_ref_t gref);
+
+    // Unmaps everything, pinned or not
+    void clear();
+
+    // Changes the capacity, evicting down to it if it shrank
+    void resize(uint64_t capacity, uint64_t evictionSize);
+
+    uint64_t size() const noexcept { return mPages.size(); }
+    uint64_t capacity() const noexcept { return mCapacity; }
+    GrantCachePolicyType policy() const noexcept { return mPolicyType; }
+    const GrantCacheStats &stats() const noexcept { return mStats; }
+
+protected:
+    virtual void *map(grant_ref_t gref) = 0;
+    virtual void unmap(grant_ref_t gref, void *addr) = 0;
+
+    // Maps count grefs with a single call, storing each one's address in
+    // addrs, and returns what to pass to unmapBatch(); nullptr if they
+    // couldn't all be mapped. A page mapped this way stays mapped until
+    // every page of its batch has been unmapped. Not supported by default.
+    virtual void *mapBatch(const grant_ref_t *grefs, uint32_t count, void **addrs)
+    {
+        (void)grefs;
+        (void)count;
+        (void)addrs;
+        return nullptr;
+    }
+
+    virtual void unmapBatch(void *batch, uint32_t count)
+    {
+        (void)batch;
+        (void)count;
+    }
+
+private:
+    struct Batch {
+        uint32_t count;
+        uint32_t mapped;
+    };
+
+    void evict(uint64_t count);
+
+    // Unmaps a page, or drops it from its batch
+    void release(grant_ref_t gref, void *addr);
+
+    GrantCachePolicyType mPolicyType;
+    std::unique_ptr<GrantCachePolicy> mPolicy;
+    uint64_t mCapacity;
+    uint64_t mEvictionSize;
+    GrantCacheStats mStats;
+    std::unordered_map<grant_ref_t, void *> mPages;
+    std::unordered_map<grant_ref_t, uint32_t> mPins;
+    std::unordered_multimap<grant_ref_t, void *> mEvicted;
+
+    // Pages mapped by warm(), by address, and the batches they belong to
+    std::unordered_map<void *, void *> mBatchPages;
+    std::unordered_map<void *, Batch> mBatches;
+};
+
+//
+// Grant sets kept by the backend across a device's connections. When a
+// device's rings are torn down their resident grants are saved here, one
+// entry per queue, and the next rings for the same domain and device map
+// them up front instead of faulting them back in one miss at a time.
+//
+struct RetainedGrants {
+    std::vector<grant_ref_t> data;
+    std::vector<grant_ref_t> indirect;
+};
+
+class GrantRetention
+{
+public:
+    void save(uint16_t domId, uint16_t devId, std::vector<RetainedGrants> queues);
+
+    // Removes and returns what was saved for the device, if anything
+    std::vector<RetainedGrants> take(uint16_t domId, uint16_t devId);
+
+    // Removes what was saved for domains alive() says no longer exist,
+    // whose grants can't come back
+    void prune(const std::function<bool(uint16_t)> &alive);
+
+private:
+    std::mutex mMutex;
+    std::unordered_map<uint32_t, std::vector<RetainedGrants>> mGrants;
+};
+
+//
+// Backend wide number of persistent grants, split evenly between the
+// devices connected. A device's share is capped at perDevice so a few
+// devices don't map more than they did with a fixed split, and never goes
+// below minPerDevice; past total / minPerDevice devices the total is
+// overcommitted rather than turning devices away. The generation changes
+// whenever devices come or go, telling them to size their caches again.
+//
+// A device may also need a floor of its own, e.g. a minimum per ring.
+// join() returns false when the floors of all devices joined add up to more
+// than the total, leaving it to the caller to warn or refuse the device.
+//
+// A device that needs more grants than most, e.g. for larger requests,
+// joins with several shares and gets that many times the share of one.
+//
+class GrantBudget
+{
+public:
+    GrantBudget(uint64_t total, uint64_t perDevice, uint64_t minPerDevice);
+
+    bool join(uint64_t shares = 1U, uint64_t floor = 0U);
+    void leave(uint64_t shares = 1U, uint64_t floor = 0U);
+
+    uint64_t share(uint64_t shares = 1U) const noexcept;
+    uint64_t total() const noexcept { return mTotal; }
+    uint64_t floor() const noexcept { return mFloor; }
+    uint64_t devices() const noexcept { return mDevices; }
+    uint64_t generation() const noexcept { return mGeneration; }
+
+private:
+    const uint64_t mTotal;
+    const uint64_t mPerDevice;
+    const uint64_t mMinPerDevice;
+    std::atomic<uint64_t> mDevices{0};
+    std::atomic<uint64_t> mShares{0};
+    std::atomic<uint64_t> mFloor{0};
+    std::atomic<uint64_t> mGeneration{0};
+
+    uint64_t deviceFloor(uint64_t shares, uint64_t floor) const noexcept;
+};
+
+//
+// Bounded set of multi-page mappings, each mapping a sequence of grants at
+// consecutive addresses so a request spanning them is one linear buffer.
+// Frontends with a stable buffer pool submit the same gref sequences over
+// and over, so mappings are kept and reused until capacity (in pages) runs
+// out and the least recently used ones are unmapped. Derived classes provide
+// the mapping and must call clear() from their destructor.
+//
+class LinearMapCache
+{
+public:
+    explicit LinearMapCache(uint64_t capacity);
+    virtual ~LinearMapCache() = default;
+
+    LinearMapCache(const LinearMapCache &) = delete;
+    LinearMapCache &operator=(const LinearMapCache &) = delete;
+
+    // Returns the base of a linear mapping of grefs, mapping it if needed.
+    // Returns nullptr if the sequence can't be mapped or is larger than
+    // the cache.
+    void *get(const grant_ref_t *grefs, uint32_t count);
+
+    // As GrantCache::pin(), for the mapping at addr returned by get()
+    void pin(void *addr);
+    void unpin(void *addr);
+
+    // Unmaps everything, pinned or not
+    void clear();
+
+    uint64_t pages() const noexcept { return mPages; }
+    uint64_t capacity() const noexcept { return mCapacity; }
+    const GrantCacheStats &stats() const noexcept { return mStats; }
+
+protected:
+    virtual void *map(const grant_ref_t *grefs, uint32_t count) = 0;
+    virtual void unmap(void *addr, uint32_t count) = 0;
+
+private:
+    struct Extent {
+        std::vector<grant_ref_t> grefs;
+        void *addr;
+    };
+
+    struct SequenceHash {
+        size_t operator()(const std::vector<grant_ref_t> &grefs) const noexcept;
+    };
+
+    using ExtentList = std::list<Extent>;
+
+    void evictOne();
+
+    uint64_t mCapacity;
+    uint64_t mPages{0};
+    GrantCacheStats mStats;
+    std::vector<grant_ref_t> mKey;
+    ExtentList mLru;
+    std::unordered_map<std::vector<grant_ref_t>, ExtentList::iterator, SequenceHash> mExtents;
+    std::unordered_map<void *, uint32_t> mPins;
+    std::unordered_map<void *, uint32_t> mEvicted;
+};
+
+#endif
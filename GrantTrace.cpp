@@ -0,0 +1,125 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "GrantTrace.hpp"
+
+#include <cstring>
+#include <iterator>
+
+static constexpr size_t TRACE_BUFFER_SIZE = 64U * 1024U;
+
+GrantTraceWriter::GrantTraceWriter(const std::string &path,
+                                   uint16_t domId,
+                                   uint16_t devId) :
+    mFile(path, std::ios::binary | std::ios::out | std::ios::trunc)
+{
+    GrantTraceHeader header;
+
+    memcpy(header.magic, GRANT_TRACE_MAGIC, sizeof(header.magic));
+    header.version = GRANT_TRACE_VERSION;
+    header.domId = domId;
+    header.devId = devId;
+
+    mFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    mBuffer.reserve(TRACE_BUFFER_SIZE);
+}
+
+GrantTraceWriter::~GrantTraceWriter()
+{
+    this->flush();
+}
+
+void GrantTraceWriter::record(grant_ref_t gref, bool indirect)
+{
+    const int64_t delta = int64_t(gref) - int64_t(mLast);
+    const uint64_t zigzag = (uint64_t(delta) << 1) ^ uint64_t(delta >> 63);
+    uint64_t value = (zigzag << 1) | (indirect ? 1U : 0U);
+
+    while (value >= 0x80U) {
+        mBuffer.push_back(uint8_t(value) | 0x80U);
+        value >>= 7;
+    }
+
+    mBuffer.push_back(uint8_t(value));
+    mLast = gref;
+    mRecords++;
+
+    if (mBuffer.size() >= TRACE_BUFFER_SIZE - 16U) {
+        this->flush();
+    }
+}
+
+void GrantTraceWriter::flush()
+{
+    if (mBuffer.empty()) {
+        return;
+    }
+
+    mFile.write(reinterpret_cast<const char *>(mBuffer.data()), mBuffer.size());
+    mFile.flush();
+    mBuffer.clear();
+}
+
+bool readGrantTrace(const std::string &path,
+                    GrantTraceHeader &header,
+                    std::vector<GrantTraceRecord> &records)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+        return false;
+    }
+
+    if (memcmp(header.magic, GRANT_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != GRANT_TRACE_VERSION) {
+        return false;
+    }
+
+    const std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)),
+                                    std::istreambuf_iterator<char>());
+    grant_ref_t last = 0U;
+    uint64_t value = 0U;
+    uint32_t shift = 0U;
+
+    for (const uint8_t byte : data) {
+        value |= uint64_t(byte & 0x7FU) << shift;
+        shift += 7U;
+
+        if (byte & 0x80U) {
+            if (shift >= 64U) {
+                return false;
+            }
+            continue;
+        }
+
+        const uint64_t zigzag = value >> 1;
+        const int64_t delta = int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1U);
+
+        last = grant_ref_t(int64_t(last) + delta);
+        records.push_back({last, (value & 1U) != 0U});
+
+        value = 0U;
+        shift = 0U;
+    }
+
+    return shift == 0U;
+}
@@ -0,0 +1,87 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef BLKBACK_GRANTTRACE_HPP
+#define BLKBACK_GRANTTRACE_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <xen/grant_table.h>
+}
+
+//
+// Compact binary log of grant reference accesses, used to compare grant
+// cache policies offline (see grant-trace-replay).
+//
+// The file starts with a fixed header followed by one LEB128 varint per
+// access: the zigzag-encoded difference from the previous gref, shifted
+// left by one with the low bit set for indirect descriptor pages. Guests
+// tend to reuse neighbouring grefs, so most records take one or two bytes.
+//
+
+constexpr char GRANT_TRACE_MAGIC[8] = {'B', 'L', 'K', 'G', 'N', 'T', 'T', 'R'};
+constexpr uint32_t GRANT_TRACE_VERSION = 1U;
+
+struct GrantTraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint16_t domId;
+    uint16_t devId;
+};
+
+struct GrantTraceRecord {
+    grant_ref_t gref;
+    bool indirect;
+};
+
+class GrantTraceWriter
+{
+public:
+    GrantTraceWriter(const std::string &path, uint16_t domId, uint16_t devId);
+    ~GrantTraceWriter();
+
+    GrantTraceWriter(const GrantTraceWriter &) = delete;
+    GrantTraceWriter &operator=(const GrantTraceWriter &) = delete;
+
+    bool good() const noexcept { return mFile.good(); }
+    uint64_t records() const noexcept { return mRecords; }
+
+    void record(grant_ref_t gref, bool indirect);
+    void flush();
+
+private:
+    std::ofstream mFile;
+    std::vector<uint8_t> mBuffer;
+    grant_ref_t mLast{0};
+    uint64_t mRecords{0};
+};
+
+// Returns false if path is not a readable trace
+bool readGrantTrace(const std::string &path,
+                    GrantTraceHeader &header,
+                    std::vector<GrantTraceRecord> &records);
+
+#endif
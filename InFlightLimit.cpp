@@ -0,0 +1,107 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "InFlightLimit.hpp"
+
+#include <algorithm>
+
+InFlightLimit::InFlightLimit(uint32_t limit, std::shared_ptr<InFlightLimit> parent) :
+    mLimit(limit),
+    mParent(parent)
+{ }
+
+bool InFlightLimit::take(const Waiter *waiter)
+{
+    if (mLimit != 0U && mInFlight >= mLimit) {
+        if (std::find(mWaiters.begin(), mWaiters.end(), waiter) == mWaiters.end()) {
+            mWaiters.push_back(waiter);
+        }
+
+        return false;
+    }
+
+    mInFlight++;
+
+    return true;
+}
+
+bool InFlightLimit::acquire(const Waiter *waiter)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (!this->take(waiter)) {
+        return false;
+    }
+
+    if (mParent) {
+        std::lock_guard<std::mutex> parent(mParent->mMutex);
+
+        if (!mParent->take(waiter)) {
+            mInFlight--;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void InFlightLimit::put(uint32_t count)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mInFlight -= std::min(count, mInFlight);
+
+    // All of them, since a waiter with nothing left to consume doesn't
+    // pass the room on
+    for (const Waiter *waiter : mWaiters) {
+        (*waiter)();
+    }
+
+    mWaiters.clear();
+}
+
+void InFlightLimit::release(uint32_t count)
+{
+    this->put(count);
+
+    if (mParent) {
+        mParent->put(count);
+    }
+}
+
+void InFlightLimit::cancel(const Waiter *waiter)
+{
+    for (InFlightLimit *limit = this; limit; limit = limit->mParent.get()) {
+        std::lock_guard<std::mutex> lock(limit->mMutex);
+
+        limit->mWaiters.erase(std::remove(limit->mWaiters.begin(),
+                                          limit->mWaiters.end(), waiter),
+                              limit->mWaiters.end());
+    }
+}
+
+uint32_t InFlightLimit::inFlight() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    return mInFlight;
+}
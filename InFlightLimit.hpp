@@ -0,0 +1,76 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef BLKBACK_INFLIGHTLIMIT_HPP
+#define BLKBACK_INFLIGHTLIMIT_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//
+// Requests in flight counted against a limit, 0 meaning unlimited, and
+// against the limit of a parent if there is one: a device's rings share
+// the device's limit, and every device's limit counts towards the
+// backend's.
+//
+// A ring that can't acquire leaves the rest of its requests on the shared
+// ring and is called back once a request is released, at whichever level
+// was full. Limits can't change once set.
+//
+class InFlightLimit
+{
+public:
+    using Waiter = std::function<void()>;
+
+    explicit InFlightLimit(uint32_t limit = 0U,
+                           std::shared_ptr<InFlightLimit> parent = nullptr);
+
+    // Takes a request from this limit and its parent's, or from neither.
+    // If it fails, waiter is called (under a lock, so it must only hand
+    // the retry off) after the next release, unless cancelled first.
+    bool acquire(const Waiter *waiter);
+    void release(uint32_t count = 1U);
+
+    // Stops waiter from being called. It isn't running once this returns.
+    void cancel(const Waiter *waiter);
+
+    uint32_t inFlight() const;
+
+private:
+    // Takes a request here, or queues waiter. Called with mMutex held.
+    bool take(const Waiter *waiter);
+
+    // Drops count requests and wakes the waiters
+    void put(uint32_t count);
+
+    const uint32_t mLimit;
+    std::shared_ptr<InFlightLimit> mParent;
+
+    mutable std::mutex mMutex;
+    uint32_t mInFlight{0};
+    std::vector<const Waiter *> mWaiters;
+};
+
+#endif
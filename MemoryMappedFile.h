@@ -140,9 +140,9 @@ UnixMemoryMappedFile(const std::string &path) : MemoryMappedFile(path)
         close(m_fd);
     }
 
-    char* get() { return (char*) m_ptr; }
-    void flush() { msync(m_ptr, m_size, MS_SYNC); }
-    uint64_t size() { return m_size; }
+    char* get() override { return (char*) m_ptr; }
+    void flush() override { msync(m_ptr, m_size, MS_SYNC); }
+    uint64_t size() const override { return m_size; }
 
 private:
     int m_fd{-1};
@@ -0,0 +1,158 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+
+#ifndef BLKBACK_MPSCQUEUE_HPP
+#define BLKBACK_MPSCQUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+//
+// Bounded queue any number of threads push to and a single thread pops
+// from, without locks. The capacity is rounded up to a power of two. Each
+// cell carries a sequence number telling producers and the consumer whose
+// turn it is, after D. Vyukov's bounded queue; producers claim cells by
+// advancing the tail, and only the consumer moves the head. The two ends
+// and the cells are kept on cache lines of their own so producers and the
+// consumer don't invalidate each other's lines.
+//
+template <typename T>
+class MpscQueue
+{
+public:
+    static constexpr size_t CACHE_LINE = 64U;
+
+    explicit MpscQueue(size_t capacity) :
+        mMask(roundUp(capacity) - 1U),
+        mCells(new Cell[mMask + 1U])
+    {
+        for (size_t i = 0U; i <= mMask; i++) {
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    size_t capacity() const noexcept { return mMask + 1U; }
+
+    // Returns false if the queue is full. Safe on any thread.
+    bool push(const T &value) noexcept
+    {
+        size_t tail = mTail.value.load(std::memory_order_relaxed);
+
+        while (true) {
+            Cell &cell = mCells[tail & mMask];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t lag = intptr_t(sequence) - intptr_t(tail);
+
+            if (lag == 0) {
+                if (mTail.value.compare_exchange_weak(tail, tail + 1U,
+                                                      std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(tail + 1U, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                // The consumer hasn't freed this cell yet
+                return false;
+            } else {
+                tail = mTail.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Returns false if nothing is ready. Only the consumer may call this.
+    bool pop(T &value) noexcept
+    {
+        const size_t head = mHead.value.load(std::memory_order_relaxed);
+        Cell &cell = mCells[head & mMask];
+
+        // A producer may have claimed the cell without having filled it
+        if (cell.sequence.load(std::memory_order_acquire) != head + 1U) {
+            return false;
+        }
+
+        value = cell.value;
+        cell.sequence.store(head + mMask + 1U, std::memory_order_release);
+        mHead.value.store(head + 1U, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    // Pops everything ready into fn, returning how many. Only the consumer
+    // may call this.
+    template <typename Fn>
+    size_t drain(Fn &&fn)
+    {
+        size_t count = 0U;
+        T value;
+
+        while (this->pop(value)) {
+            fn(value);
+            count++;
+        }
+
+        return count;
+    }
+
+    // Whether the next pop would find nothing, as of the call. Safe on any
+    // thread.
+    bool empty() const noexcept
+    {
+        const size_t head = mHead.value.load(std::memory_order_acquire);
+
+        return mCells[head & mMask].sequence.load(std::memory_order_acquire) !=
+            head + 1U;
+    }
+
+private:
+    struct alignas(CACHE_LINE) Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    struct alignas(CACHE_LINE) Index {
+        std::atomic<size_t> value{0U};
+    };
+
+    static size_t roundUp(size_t capacity) noexcept
+    {
+        size_t size = 2U;
+
+        while (size < capacity) {
+            size <<= 1U;
+        }
+
+        return size;
+    }
+
+    const size_t mMask;
+    std::unique_ptr<Cell[]> mCells;
+    Index mHead;
+    Index mTail;
+};
+
+#endif
@@ -0,0 +1,125 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "NotifyCoalescer.hpp"
+
+#include <algorithm>
+
+NotifyCoalescer::NotifyCoalescer(uint32_t maxResponses,
+                                 uint32_t maxDelayUs,
+                                 bool adaptive,
+                                 std::function<void()> onTimeout) :
+    mMaxResponses(maxResponses),
+    mMaxDelay(std::chrono::microseconds(maxDelayUs)),
+    mAdaptive(adaptive),
+    mTimer(onTimeout)
+{
+}
+
+NotifyCoalescer::~NotifyCoalescer()
+{
+    this->stop();
+}
+
+void NotifyCoalescer::stop()
+{
+    mTimer.stop();
+}
+
+uint64_t NotifyCoalescer::limit() const noexcept
+{
+    if (!mAdaptive) {
+        return mMaxResponses;
+    }
+
+    // Responses expected within the delay at the current rate
+    const double expected = mRate * double(mMaxDelay.count());
+
+    return std::min<uint64_t>(std::max<uint64_t>(uint64_t(expected), 1U),
+                              mMaxResponses);
+}
+
+bool NotifyCoalescer::published(uint32_t count, bool wanted, uint32_t inFlight)
+{
+    mStats.responses += count;
+
+    if (!this->enabled()) {
+        mStats.notifies += wanted;
+        return wanted;
+    }
+
+    const auto now = clock::now();
+
+    if (mAdaptive && count != 0U) {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now - mLastPublish).count();
+
+        if (elapsed > 0) {
+            mRate = (7.0 * mRate + double(count) / double(elapsed)) / 8.0;
+        }
+
+        mLastPublish = now;
+    }
+
+    if (wanted && !mPending) {
+        mPending = true;
+        mPendingResponses = 0U;
+        mPendingSince = now;
+    }
+
+    if (!mPending) {
+        return false;
+    }
+
+    mPendingResponses += count;
+
+    const bool idle = mAdaptive && inFlight == 0U;
+
+    if (idle || mPendingResponses >= this->limit() || now - mPendingSince >= mMaxDelay) {
+        mPending = false;
+        mStats.notifies++;
+        return true;
+    }
+
+    mTimer.arm(mPendingSince + mMaxDelay);
+
+    return false;
+}
+
+bool NotifyCoalescer::expired()
+{
+    if (!mPending) {
+        return false;
+    }
+
+    // The timer was set for an earlier kick that has since gone out
+    if (clock::now() - mPendingSince < mMaxDelay) {
+        mTimer.arm(mPendingSince + mMaxDelay);
+        return false;
+    }
+
+    mPending = false;
+    mStats.notifies++;
+    mStats.timerNotifies++;
+
+    return true;
+}
@@ -0,0 +1,102 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef BLKBACK_NOTIFYCOALESCER_HPP
+#define BLKBACK_NOTIFYCOALESCER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+#include "DeadlineTimer.hpp"
+
+struct NotifyCoalescerStats {
+    uint64_t responses{0};
+    uint64_t notifies{0};
+    uint64_t timerNotifies{0};
+};
+
+//
+// Decides when a ring kicks its frontend for published responses. Without
+// coalescing the frontend is kicked whenever it asked to be. With it, a
+// kick it asked for is held back until maxResponses responses have been
+// published since, or maxDelayUs has passed, whichever comes first; a
+// timer thread covers the case where no more responses turn up. In
+// adaptive mode the response limit follows the recent response rate and a
+// kick is never held back while nothing else is in flight, so under light
+// load, where waiting would only add latency, kicks go out straight away.
+//
+// published() and expired() must be serialized by the caller, which for a
+// ring means holding its lock.
+//
+class NotifyCoalescer
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    // onTimeout is called from the timer thread when the delay of a held
+    // back kick runs out; it should call expired() and kick if told to
+    NotifyCoalescer(uint32_t maxResponses,
+                    uint32_t maxDelayUs,
+                    bool adaptive,
+                    std::function<void()> onTimeout);
+
+    ~NotifyCoalescer();
+
+    NotifyCoalescer(const NotifyCoalescer &) = delete;
+    NotifyCoalescer &operator=(const NotifyCoalescer &) = delete;
+
+    // Accounts for count responses just made visible; wanted is whether
+    // the frontend asked to be kicked for them and inFlight how many
+    // requests are still to be answered. Returns whether to kick now.
+    bool published(uint32_t count, bool wanted, uint32_t inFlight);
+
+    // Returns whether a held back kick is due
+    bool expired();
+
+    // Stops the timer thread. onTimeout isn't called once this returns.
+    void stop();
+
+    bool enabled() const noexcept { return mMaxResponses > 1U && mMaxDelay.count() != 0; }
+    const NotifyCoalescerStats &stats() const noexcept { return mStats; }
+
+private:
+    uint64_t limit() const noexcept;
+
+    uint32_t mMaxResponses;
+    std::chrono::nanoseconds mMaxDelay;
+    bool mAdaptive;
+    NotifyCoalescerStats mStats;
+
+    // A kick the frontend asked for that hasn't been sent yet
+    bool mPending{false};
+    uint64_t mPendingResponses{0};
+    clock::time_point mPendingSince{};
+
+    // Responses per nanosecond, averaged over recent publishes
+    double mRate{0.0};
+    clock::time_point mLastPublish{};
+
+    DeadlineTimer mTimer;
+};
+
+#endif
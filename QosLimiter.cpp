@@ -0,0 +1,115 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "QosLimiter.hpp"
+
+#include <algorithm>
+
+void TokenBucket::configure(uint64_t rate, uint32_t burstMs, clock::time_point now)
+{
+    this->refill(now);
+
+    const bool wasLimited = mRate != 0.0;
+
+    mRate = double(rate) / 1e9;
+    mCapacity = std::max(double(rate) * burstMs / 1000.0, 1.0);
+
+    // A new limit starts with a full burst
+    mTokens = wasLimited ? std::min(mTokens, mCapacity) : mCapacity;
+    mLast = now;
+}
+
+void TokenBucket::refill(clock::time_point now) noexcept
+{
+    if (mRate == 0.0) {
+        return;
+    }
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        now - mLast).count();
+
+    if (elapsed > 0) {
+        mTokens = std::min(mTokens + mRate * double(elapsed), mCapacity);
+        mLast = now;
+    }
+}
+
+std::chrono::nanoseconds TokenBucket::wait(uint64_t count, clock::time_point now)
+{
+    if (mRate == 0.0) {
+        return std::chrono::nanoseconds(0);
+    }
+
+    this->refill(now);
+
+    const double needed = std::min(double(count), mCapacity);
+
+    if (mTokens >= needed) {
+        return std::chrono::nanoseconds(0);
+    }
+
+    return std::chrono::nanoseconds(int64_t((needed - mTokens) / mRate) + 1);
+}
+
+void TokenBucket::take(uint64_t count) noexcept
+{
+    if (mRate != 0.0) {
+        mTokens -= double(count);
+    }
+}
+
+void QosLimiter::setLimits(const QosLimits &limits)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    const auto now = clock::now();
+
+    mLimits = limits;
+    mReadIops.configure(limits.readIops, limits.burstMs, now);
+    mWriteIops.configure(limits.writeIops, limits.burstMs, now);
+    mReadBytes.configure(limits.readBps, limits.burstMs, now);
+    mWriteBytes.configure(limits.writeBps, limits.burstMs, now);
+    mLimited = limits.limited();
+}
+
+QosLimits QosLimiter::limits()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    return mLimits;
+}
+
+std::chrono::nanoseconds QosLimiter::admit(bool write, uint32_t requests, uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    const auto now = clock::now();
+    TokenBucket &iops = write ? mWriteIops : mReadIops;
+    TokenBucket &bandwidth = write ? mWriteBytes : mReadBytes;
+
+    const auto wait = std::max(iops.wait(requests, now), bandwidth.wait(bytes, now));
+
+    if (wait.count() == 0) {
+        iops.take(requests);
+        bandwidth.take(bytes);
+    }
+
+    return wait;
+}
@@ -0,0 +1,104 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef BLKBACK_QOSLIMITER_HPP
+#define BLKBACK_QOSLIMITER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+// Rate limits of a device, 0 meaning unlimited. A limiter lets through
+// bursts of up to burstMs worth of its rates.
+struct QosLimits {
+    uint32_t readIops{0};
+    uint32_t writeIops{0};
+    uint64_t readBps{0};
+    uint64_t writeBps{0};
+    uint32_t burstMs{100};
+
+    bool limited() const noexcept
+    {
+        return readIops != 0U || writeIops != 0U || readBps != 0U || writeBps != 0U;
+    }
+};
+
+//
+// Tokens refilled at a fixed rate per second, up to a capacity. A take
+// bigger than the capacity is let through once the bucket is full and
+// leaves it in debt, so nothing is throttled forever.
+//
+class TokenBucket
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    // A rate of 0 takes the limit off
+    void configure(uint64_t rate, uint32_t burstMs, clock::time_point now);
+
+    // Time until count tokens can be taken, zero if they can be now
+    std::chrono::nanoseconds wait(uint64_t count, clock::time_point now);
+
+    void take(uint64_t count) noexcept;
+
+private:
+    void refill(clock::time_point now) noexcept;
+
+    // Tokens per nanosecond
+    double mRate{0.0};
+    double mCapacity{0.0};
+    double mTokens{0.0};
+    clock::time_point mLast{};
+};
+
+//
+// Token buckets for the I/O of a device, shared by all its rings. Limits
+// can be changed at any time from any thread.
+//
+class QosLimiter
+{
+public:
+    using clock = TokenBucket::clock;
+
+    void setLimits(const QosLimits &limits);
+    QosLimits limits();
+
+    // Takes the tokens for requests reads or writes of bytes in total if
+    // they are all available. Otherwise takes nothing and returns how long
+    // to wait before trying again.
+    std::chrono::nanoseconds admit(bool write, uint32_t requests, uint64_t bytes);
+
+    bool limited() const noexcept { return mLimited; }
+
+private:
+    std::mutex mMutex;
+    QosLimits mLimits;
+    std::atomic<bool> mLimited{false};
+
+    TokenBucket mReadIops;
+    TokenBucket mWriteIops;
+    TokenBucket mReadBytes;
+    TokenBucket mWriteBytes;
+};
+
+#endif
@@ -0,0 +1,199 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "Reactor.hpp"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Events taken from the kernel per wait
+static constexpr int MAX_EVENTS = 64;
+
+Reactor::Reactor(uint32_t threads,
+                 std::function<void(uint32_t)> onStart,
+                 std::function<void(uint32_t)> onStop) :
+    mLoads(std::max<uint32_t>(threads, 1U), 0U),
+    mOnStart(onStart),
+    mOnStop(onStop)
+{
+    for (uint32_t i = 0U; i < mLoads.size(); i++) {
+        std::unique_ptr<Loop> loop(new Loop);
+
+        loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        loop->stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = loop->stopFd;
+        epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->stopFd, &ev);
+
+        mLoops.push_back(std::move(loop));
+    }
+
+    for (uint32_t i = 0U; i < mLoops.size(); i++) {
+        mLoops[i]->thread = std::thread(&Reactor::run, this, i);
+    }
+}
+
+Reactor::~Reactor()
+{
+    for (auto &loop : mLoops) {
+        const uint64_t one = 1U;
+
+        while (write(loop->stopFd, &one, sizeof(one)) < 0 && errno == EINTR) { }
+
+        loop->thread.join();
+        close(loop->epollFd);
+        close(loop->stopFd);
+    }
+}
+
+bool Reactor::add(int fd, std::function<void()> callback)
+{
+    return this->addYielding(fd, [callback] {
+        callback();
+        return false;
+    });
+}
+
+bool Reactor::addYielding(int fd, std::function<bool()> callback)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (mOwners.count(fd) != 0U) {
+        return false;
+    }
+
+    const uint32_t index = uint32_t(std::min_element(mLoads.begin(), mLoads.end()) -
+                                    mLoads.begin());
+    Loop &loop = *mLoops[index];
+
+    {
+        std::lock_guard<std::mutex> dispatch(loop.mutex);
+        loop.callbacks[fd] = std::move(callback);
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(loop.epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        std::lock_guard<std::mutex> dispatch(loop.mutex);
+        loop.callbacks.erase(fd);
+        return false;
+    }
+
+    mOwners[fd] = index;
+    mLoads[index]++;
+
+    return true;
+}
+
+void Reactor::remove(int fd)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto itr = mOwners.find(fd);
+
+    if (itr == mOwners.end()) {
+        return;
+    }
+
+    Loop &loop = *mLoops[itr->second];
+
+    epoll_ctl(loop.epollFd, EPOLL_CTL_DEL, fd, nullptr);
+
+    // Events for fd the thread already has are skipped once it's gone
+    {
+        std::lock_guard<std::mutex> dispatch(loop.mutex);
+        loop.callbacks.erase(fd);
+        loop.backlog.erase(std::remove(loop.backlog.begin(), loop.backlog.end(), fd),
+                           loop.backlog.end());
+    }
+
+    mLoads[itr->second]--;
+    mOwners.erase(itr);
+}
+
+void Reactor::run(uint32_t index)
+{
+    Loop &loop = *mLoops[index];
+    struct epoll_event events[MAX_EVENTS];
+
+    if (mOnStart) {
+        mOnStart(index);
+    }
+
+    bool stopping = false;
+    std::vector<int> round;
+
+    while (!stopping) {
+        // Don't sleep while callbacks have work left
+        std::deque<int> backlog;
+        {
+            std::lock_guard<std::mutex> dispatch(loop.mutex);
+            backlog.swap(loop.backlog);
+        }
+
+        const int count = epoll_wait(loop.epollFd, events, MAX_EVENTS,
+                                     backlog.empty() ? -1 : 0);
+
+        round.clear();
+
+        for (int i = 0; i < count; i++) {
+            const int fd = events[i].data.fd;
+
+            if (fd == loop.stopFd) {
+                stopping = true;
+                break;
+            }
+
+            round.push_back(fd);
+        }
+
+        if (stopping) {
+            break;
+        }
+
+        for (const int fd : backlog) {
+            if (std::find(round.begin(), round.end(), fd) == round.end()) {
+                round.push_back(fd);
+            }
+        }
+
+        for (const int fd : round) {
+            std::lock_guard<std::mutex> dispatch(loop.mutex);
+            auto itr = loop.callbacks.find(fd);
+
+            if (itr != loop.callbacks.end() && itr->second()) {
+                loop.backlog.push_back(fd);
+            }
+        }
+    }
+
+    if (mOnStop) {
+        mOnStop(index);
+    }
+}
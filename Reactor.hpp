@@ -0,0 +1,104 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef BLKBACK_REACTOR_HPP
+#define BLKBACK_REACTOR_HPP
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//
+// A few threads waiting on many file descriptors. Each descriptor added is
+// watched by the thread with the fewest, which runs its callback whenever
+// the descriptor is readable, so a descriptor's callbacks never overlap.
+// The callback must consume whatever made the descriptor readable.
+//
+// Callbacks may also stop with work left, to let the other descriptors of
+// their thread go first. A thread serves its descriptors in rounds: each
+// one readable, and each one left with work in the last round, gets a
+// turn, those that just became readable first. A descriptor with a lot
+// to do therefore delays the others by one turn, not by all of its work.
+//
+// Lets many mostly idle event channels share a thread instead of each
+// sleeping in a thread of its own. Linux only (epoll).
+//
+class Reactor
+{
+public:
+    // onStart, if set, is called on each thread with its index before it
+    // waits on anything, e.g. to set the thread's affinity. onStop, if
+    // set, is called likewise as the thread exits, to undo it.
+    explicit Reactor(uint32_t threads,
+                     std::function<void(uint32_t)> onStart = nullptr,
+                     std::function<void(uint32_t)> onStop = nullptr);
+    ~Reactor();
+
+    Reactor(const Reactor &) = delete;
+    Reactor &operator=(const Reactor &) = delete;
+
+    // Returns false if fd can't be watched
+    bool add(int fd, std::function<void()> callback);
+
+    // As add(), but callback returns true if it stopped with work left.
+    // It is then called again in the next round, readable or not.
+    bool addYielding(int fd, std::function<bool()> callback);
+
+    // Stops watching fd, waiting for a callback running for it to return.
+    // Must not be called from a callback of the same thread.
+    void remove(int fd);
+
+    uint32_t size() const noexcept { return uint32_t(mLoops.size()); }
+
+private:
+    struct Loop {
+        int epollFd{-1};
+        int stopFd{-1};
+
+        // Held while a callback runs
+        std::mutex mutex;
+        std::unordered_map<int, std::function<bool()>> callbacks;
+
+        // Descriptors whose callbacks left work, in the order they ran
+        std::deque<int> backlog;
+
+        std::thread thread;
+    };
+
+    void run(uint32_t index);
+
+    // Which loop watches each fd, and how many each watches
+    std::mutex mMutex;
+    std::unordered_map<int, uint32_t> mOwners;
+    std::vector<uint32_t> mLoads;
+
+    std::function<void(uint32_t)> mOnStart;
+    std::function<void(uint32_t)> mOnStop;
+    std::vector<std::unique_ptr<Loop>> mLoops;
+};
+
+#endif
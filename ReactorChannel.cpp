@@ -0,0 +1,122 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+
+#include "ReactorChannel.hpp"
+
+#include <cerrno>
+#include <string>
+
+#include <fcntl.h>
+
+ReactorChannel::ReactorChannel(std::shared_ptr<Reactor> reactor,
+                               domid_t domId,
+                               evtchn_port_t port,
+                               Callback callback) :
+    mReactor(reactor),
+    mCallback(callback),
+    mLog("ReactorChannel")
+{
+    mHandle = xenevtchn_open(nullptr, 0);
+    if (!mHandle) {
+        throw XenBackend::XenEvtchnException("Can't open event channel",
+                                             errno);
+    }
+
+    const xenevtchn_port_or_error_t local =
+        xenevtchn_bind_interdomain(mHandle, domId, port);
+
+    if (local < 0) {
+        const int error = errno;
+
+        xenevtchn_close(mHandle);
+
+        throw XenBackend::XenEvtchnException("Can't bind port " +
+                                             std::to_string(port), error);
+    }
+
+    mPort = evtchn_port_t(local);
+
+    // Called for a turn without an event too, so don't block looking
+    const int fd = xenevtchn_fd(mHandle);
+    const int flags = fcntl(fd, F_GETFL);
+
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        const int error = errno;
+
+        xenevtchn_unbind(mHandle, mPort);
+        xenevtchn_close(mHandle);
+
+        throw XenBackend::XenEvtchnException("Can't poll port " +
+                                             std::to_string(port), error);
+    }
+}
+
+ReactorChannel::~ReactorChannel()
+{
+    this->stop();
+
+    xenevtchn_unbind(mHandle, mPort);
+    xenevtchn_close(mHandle);
+}
+
+bool ReactorChannel::start()
+{
+    if (!mStarted) {
+        mStarted = mReactor->addYielding(xenevtchn_fd(mHandle),
+                                         [this] { return this->onReady(); });
+    }
+
+    return mStarted;
+}
+
+void ReactorChannel::stop()
+{
+    if (mStarted) {
+        mReactor->remove(xenevtchn_fd(mHandle));
+        mStarted = false;
+    }
+}
+
+void ReactorChannel::notify()
+{
+    if (xenevtchn_notify(mHandle, mPort) < 0) {
+        LOG(mLog, ERROR) << "Can't notify port " << mPort;
+    }
+}
+
+bool ReactorChannel::onReady()
+{
+    const xenevtchn_port_or_error_t port = xenevtchn_pending(mHandle);
+
+    if (port >= 0) {
+        xenevtchn_unmask(mHandle, evtchn_port_t(port));
+    }
+
+    try {
+        return mCallback();
+    } catch (const std::exception &e) {
+        LOG(mLog, ERROR) << e.what();
+    }
+
+    return false;
+}
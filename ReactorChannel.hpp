@@ -0,0 +1,83 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+
+#ifndef BLKBACK_REACTORCHANNEL_HPP
+#define BLKBACK_REACTORCHANNEL_HPP
+
+#include <functional>
+#include <memory>
+
+#include <xen/be/Log.hpp>
+#include <xen/be/XenEvtchn.hpp>
+
+extern "C" {
+#include <xenevtchn.h>
+}
+
+#include "Reactor.hpp"
+
+//
+// Backend end of an interdomain event channel waited on by one of a
+// Reactor's threads rather than a thread of its own. It has a libxenevtchn
+// handle of its own, whose descriptor the reactor watches.
+//
+// The callback returns true if it stopped with work left; it is then
+// called again after the other channels of its thread had a turn, whether
+// or not another event came in.
+//
+class ReactorChannel
+{
+public:
+    using Callback = std::function<bool()>;
+
+    // Binds to port of domId. Throws XenEvtchnException if it can't.
+    ReactorChannel(std::shared_ptr<Reactor> reactor,
+                   domid_t domId,
+                   evtchn_port_t port,
+                   Callback callback);
+    ~ReactorChannel();
+
+    ReactorChannel(const ReactorChannel &) = delete;
+    ReactorChannel &operator=(const ReactorChannel &) = delete;
+
+    // Has the reactor run the callback for each event. Returns false if
+    // the reactor can't watch the channel.
+    bool start();
+
+    // Waits for a callback still running
+    void stop();
+
+    void notify();
+
+private:
+    bool onReady();
+
+    std::shared_ptr<Reactor> mReactor;
+    xenevtchn_handle *mHandle{nullptr};
+    evtchn_port_t mPort{0};
+    bool mStarted{false};
+    Callback mCallback;
+    XenBackend::Log mLog;
+};
+
+#endif
@@ -0,0 +1,124 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef BLKBACK_RINGPOLLER_HPP
+#define BLKBACK_RINGPOLLER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+struct RingPollerStats {
+    uint64_t hits{0};
+    uint64_t misses{0};
+    uint64_t spentNs{0};
+};
+
+//
+// Adaptive busy-polling for a ring thread. Once the ring is drained the
+// thread spins on it for a window instead of going straight back to the
+// event channel, so requests arriving in quick succession cost no
+// interrupt. A poll that finds work doubles the window (up to the
+// maximum) and one that runs dry halves it, down to zero, at which point
+// the thread is purely event driven again until it is woken soon enough
+// after sleeping that a maximum window would have caught the request.
+//
+class RingPoller
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit RingPoller(uint32_t maxUs) :
+        mMaxNs(uint64_t(maxUs) * 1000U),
+        mWindowNs(std::min(mMaxNs, START_NS))
+    { }
+
+    // Spins until ready() returns true or the window runs out. Returns
+    // whether ready() did.
+    template<typename Ready>
+    bool poll(Ready ready)
+    {
+        if (mWindowNs == 0U) {
+            return false;
+        }
+
+        const auto start = clock::now();
+        const auto deadline = start + std::chrono::nanoseconds(mWindowNs);
+        auto now = start;
+        bool found;
+
+        // Yielding keeps the spin cheap for anything else runnable on the
+        // core; on a dedicated core it returns straight away
+        while (!(found = ready()) && (now = clock::now()) < deadline) {
+            std::this_thread::yield();
+        }
+
+        if (found) {
+            now = clock::now();
+            mStats.hits++;
+            mWindowNs = std::min(mWindowNs * 2U, mMaxNs);
+        } else {
+            mStats.misses++;
+            mWindowNs /= 2U;
+
+            if (mWindowNs < MIN_NS) {
+                mWindowNs = 0U;
+            }
+        }
+
+        mStats.spentNs += std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+
+        return found;
+    }
+
+    // The thread went back to waiting on the event channel
+    void sleeping() { mSleptAt = clock::now(); }
+
+    // The event channel woke the thread
+    void woken()
+    {
+        if (mMaxNs == 0U || mWindowNs != 0U) {
+            return;
+        }
+
+        const auto slept = clock::now() - mSleptAt;
+
+        if (slept <= std::chrono::nanoseconds(mMaxNs)) {
+            mWindowNs = std::min(mMaxNs, START_NS);
+        }
+    }
+
+    bool enabled() const noexcept { return mMaxNs != 0U; }
+    const RingPollerStats &stats() const noexcept { return mStats; }
+
+private:
+    static constexpr uint64_t START_NS = 8000U;
+    static constexpr uint64_t MIN_NS = 1000U;
+
+    uint64_t mMaxNs;
+    uint64_t mWindowNs;
+    clock::time_point mSleptAt{};
+    RingPollerStats mStats;
+};
+
+#endif
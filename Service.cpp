@@ -202,7 +202,7 @@ DWORD WINAPI blkback_worker(LPVOID param)
             }
         }
 
-        BlkBackend blkBackend(args.count("wait") != 0);
+        BlkBackend blkBackend(args.count("wait") != 0, parseDeviceConfig(args));
         blkBackend.start();
         service_wait_for_stop_signal();
         blkBackend.stop();
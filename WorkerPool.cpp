@@ -0,0 +1,248 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(uint32_t threads,
+                       std::function<void(uint32_t)> onStart,
+                       uint32_t quantum,
+                       std::shared_ptr<WorkerGroup> group,
+                       int32_t node) :
+    mQuantum(quantum != 0U ? quantum : 1U),
+    mOnStart(onStart),
+    mGroup(group),
+    mNode(node)
+{
+    mFlows[0U].weight = 1U;
+
+    for (uint32_t i = 0U; i < threads; i++) {
+        mThreads.emplace_back(&WorkerPool::run, this, i);
+    }
+
+    if (mGroup) {
+        mGroup->join(this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    // No more thieves in this pool, and no more requests to steal for it
+    if (mGroup) {
+        mGroup->leave(this);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+
+    mCond.notify_all();
+
+    for (auto &thread : mThreads) {
+        thread.join();
+    }
+}
+
+uint32_t WorkerPool::addFlow(uint32_t weight)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    const uint32_t flow = mNextFlow++;
+
+    mFlows[flow].weight = weight != 0U ? weight : 1U;
+
+    return flow;
+}
+
+void WorkerPool::removeFlow(uint32_t flow)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto it = mFlows.find(flow);
+
+    if (flow != 0U && it != mFlows.end()) {
+        mQueued -= it->second.tasks.size();
+        mFlows.erase(it);
+        mActive.erase(std::remove(mActive.begin(), mActive.end(), flow), mActive.end());
+    }
+}
+
+void WorkerPool::submit(std::function<void()> task)
+{
+    this->submit(0U, std::move(task));
+}
+
+void WorkerPool::submit(uint32_t flow, std::function<void()> task)
+{
+    bool busy;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Flow &queue = mFlows.at(flow);
+
+        if (queue.tasks.empty()) {
+            queue.deficit = uint64_t(mQuantum) * queue.weight;
+            mActive.push_back(flow);
+        }
+
+        queue.tasks.push_back(std::move(task));
+
+        // A notified thread counts as idle until it wakes, so a burst of
+        // tasks needs help as soon as it outnumbers the idle threads
+        busy = ++mQueued > mIdle;
+    }
+
+    mCond.notify_one();
+
+    if (busy && mGroup) {
+        mGroup->help(this);
+    }
+}
+
+std::function<void()> WorkerPool::next()
+{
+    const uint32_t flow = mActive.front();
+    Flow &queue = mFlows.at(flow);
+    std::function<void()> task = std::move(queue.tasks.front());
+
+    queue.tasks.pop_front();
+    queue.deficit--;
+    mQueued--;
+
+    if (queue.tasks.empty()) {
+        mActive.pop_front();
+    } else if (queue.deficit == 0U) {
+        // Turn over, go to the back with the next turn's allowance
+        queue.deficit = uint64_t(mQuantum) * queue.weight;
+        mActive.pop_front();
+        mActive.push_back(flow);
+    }
+
+    return task;
+}
+
+void WorkerPool::run(uint32_t index)
+{
+    if (mOnStart) {
+        mOnStart(index);
+    }
+
+    while (true) {
+        std::function<void()> task;
+        bool queued;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            queued = !mActive.empty() || mStopping;
+        }
+
+        // Nothing to do here: take what other pools have queued before
+        // going to sleep
+        if (!queued && mGroup && mGroup->steal(this, task)) {
+            mStolen.fetch_add(1U, std::memory_order_relaxed);
+            task();
+            continue;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+
+            mIdle++;
+            mCond.wait(lock, [this] {
+                return mStopping || !mActive.empty() || mStealRequests != 0U;
+            });
+            mIdle--;
+
+            if (!mActive.empty()) {
+                task = this->next();
+            } else if (mStopping) {
+                return;
+            } else {
+                // Asked to help another pool: steal at the top of the loop
+                mStealRequests--;
+                continue;
+            }
+        }
+
+        task();
+    }
+}
+
+void WorkerGroup::join(WorkerPool *pool)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mPools.push_back(pool);
+}
+
+void WorkerGroup::leave(WorkerPool *pool)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mPools.erase(std::remove(mPools.begin(), mPools.end(), pool), mPools.end());
+}
+
+void WorkerGroup::help(WorkerPool *busy)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    for (WorkerPool *pool : mPools) {
+        if (pool == busy || pool->mNode != busy->mNode) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> poolLock(pool->mMutex);
+
+        // Idle threads that haven't been asked yet
+        if (pool->mIdle > pool->mStealRequests) {
+            pool->mStealRequests++;
+            pool->mCond.notify_one();
+            return;
+        }
+    }
+}
+
+bool WorkerGroup::steal(WorkerPool *thief, std::function<void()> &task)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // Start from a different victim each time so one isn't always drained
+    // first
+    for (size_t i = 0U; i < mPools.size(); i++) {
+        WorkerPool *victim = mPools[(mNextVictim + i) % mPools.size()];
+
+        if (victim == thief || victim->mNode != thief->mNode) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> victimLock(victim->mMutex);
+
+        if (!victim->mActive.empty()) {
+            task = victim->next();
+            mNextVictim = (mNextVictim + i + 1U) % mPools.size();
+            return true;
+        }
+    }
+
+    return false;
+}
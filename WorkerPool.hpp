@@ -0,0 +1,160 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef BLKBACK_WORKERPOOL_HPP
+#define BLKBACK_WORKERPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "CpuAffinity.hpp"
+
+//
+// Fixed set of threads running submitted tasks. A device's rings hand the
+// storage work of their requests to one of these so the ring threads only
+// parse requests and publish responses.
+//
+// Tasks are queued per flow, in FIFO order within a flow, and flows are
+// served in deficit round robin: each turn a flow runs up to quantum times
+// its weight tasks before the next flow with work gets a turn. A device
+// with a deep queue therefore can't hold back one with a few requests when
+// several devices share a pool. Tasks submitted without a flow go to a
+// default flow of weight 1.
+// Pools may join a WorkerGroup, whose idle threads then steal tasks from
+// the other pools in it on the same NUMA node.
+//
+class WorkerGroup;
+
+class WorkerPool
+{
+public:
+    // onStart, if set, is called on each thread with its index before it
+    // runs any task, e.g. to set the thread's affinity. node is the NUMA
+    // node onStart keeps the threads on, if any.
+    explicit WorkerPool(uint32_t threads,
+                        std::function<void(uint32_t)> onStart = nullptr,
+                        uint32_t quantum = 1U,
+                        std::shared_ptr<WorkerGroup> group = nullptr,
+                        int32_t node = NUMA_NODE_NONE);
+
+    // Runs the tasks still queued, then joins the threads
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    // Flows are removed once they have no tasks left
+    uint32_t addFlow(uint32_t weight);
+    void removeFlow(uint32_t flow);
+
+    void submit(std::function<void()> task);
+    void submit(uint32_t flow, std::function<void()> task);
+
+    uint32_t size() const noexcept { return uint32_t(mThreads.size()); }
+
+    // Tasks this pool's threads took from other pools
+    uint64_t stolen() const noexcept { return mStolen; }
+
+private:
+    friend class WorkerGroup;
+
+    struct Flow {
+        uint32_t weight{1};
+        uint64_t deficit{0};
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void run(uint32_t index);
+
+    // Takes the next task in round robin order. Called with mMutex held
+    // and at least one flow active.
+    std::function<void()> next();
+
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    uint32_t mQuantum;
+    std::unordered_map<uint32_t, Flow> mFlows;
+    uint32_t mNextFlow{1};
+
+    // Flows with queued tasks, the one whose turn it is first
+    std::deque<uint32_t> mActive;
+
+    // Tasks queued in all flows
+    size_t mQueued{0};
+
+    // Threads waiting for tasks, and how many of them were asked to steal
+    uint32_t mIdle{0};
+    uint32_t mStealRequests{0};
+    std::atomic<uint64_t> mStolen{0};
+
+    bool mStopping{false};
+    std::function<void(uint32_t)> mOnStart;
+    std::shared_ptr<WorkerGroup> mGroup;
+    int32_t mNode;
+    std::vector<std::thread> mThreads;
+};
+
+//
+// Worker pools whose idle threads take queued tasks from the others, so a
+// busy device's work spreads over the threads of idle ones. A pool asks the
+// group for help when its queued tasks outnumber its idle threads; the
+// group then wakes an idle thread of another pool. A thread with nothing
+// queued in its own pool steals from the others, in their own round robin
+// order, before it goes to sleep, so it keeps stealing until its own pool
+// has work or nothing is left to steal. Only the thread running a task changes, so
+// anything ordered before submitting (e.g. flushes) stays ordered.
+//
+// A stolen task runs with the thief's CPU affinity and memory policy, not
+// those of the pool it came from. Pools only steal from pools on the same
+// NUMA node, so the I/O stays on the node its buffers and the image's page
+// cache come from. Within a node it may run on CPUs outside the victim's
+// set, which is the price of using the idle threads at all. Pools without
+// a node only steal from each other.
+//
+class WorkerGroup
+{
+public:
+    void join(WorkerPool *pool);
+    void leave(WorkerPool *pool);
+
+    // Wakes an idle thread of a pool other than busy to steal
+    void help(WorkerPool *busy);
+
+    // Takes a task from a pool other than thief, returning false if none
+    // has any queued
+    bool steal(WorkerPool *thief, std::function<void()> &task);
+
+private:
+    std::mutex mMutex;
+    std::vector<WorkerPool *> mPools;
+    size_t mNextVictim{0};
+};
+
+#endif
@@ -0,0 +1,420 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+//
+// Drives the backend request path with synthetic frontends on top of the
+// in-process Xen stand-ins (WITH_SIM builds) and reports throughput,
+// latency and grant/event-channel activity.
+//
+
+#include "BlkBackend.hpp"
+#include "SimFrontend.hpp"
+#include "SimXen.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+#include <getopt.h>
+#include <sys/stat.h>
+
+using bench_clock = std::chrono::steady_clock;
+
+struct BenchConfig {
+    std::string image{"./bench.img"};
+    uint64_t imageMb{256U};
+    uint32_t frontends{1U};
+    uint32_t queues{1U};
+    uint32_t ringOrder{0U};
+    uint32_t seconds{5U};
+    uint32_t depth{8U};
+    uint32_t heavyDepth{0U};
+    uint32_t segments{8U};
+    uint32_t writePct{0U};
+    uint32_t dataPages{256U};
+    uint32_t linearMapPages{0U};
+    uint32_t workers{0U};
+    uint32_t sharedWorkers{0U};
+    uint32_t fairQuantum{1U};
+    bool workStealing{false};
+    uint32_t reactorThreads{0U};
+    uint32_t reactorQuantum{8U};
+    uint32_t maxInFlight{0U};
+    uint32_t maxInFlightTotal{0U};
+    uint32_t pollUs{0U};
+    uint32_t notifyBatch{0U};
+    uint32_t notifyDelayUs{0U};
+    bool notifyAdaptive{false};
+    uint32_t mergeSectors{0U};
+    uint32_t splitSectors{256U};
+    std::vector<uint32_t> cpus;
+    int32_t numaNode{NUMA_NODE_NONE};
+    bool random{false};
+};
+
+struct BenchResult {
+    uint64_t ops{0};
+    uint64_t errors{0};
+    std::vector<uint32_t> latencyUs;
+};
+
+static void usage()
+{
+    std::cout << "blkback-bench [options]\n"
+              << "  -i, --image PATH      backing image (created if missing)\n"
+              << "  -m, --image-mb N      size of a created image (256)\n"
+              << "  -f, --frontends N     number of simulated frontends (1)\n"
+              << "  -q, --queues N        rings per frontend, one thread each (1)\n"
+              << "  -o, --ring-order N    ring size as a page order, up to 4 (0)\n"
+              << "  -t, --seconds N       run time (5)\n"
+              << "  -d, --depth N         requests in flight per frontend (8)\n"
+              << "  -H, --heavy-depth N   requests in flight for the first frontend (-d)\n"
+              << "  -s, --segments N      4K segments per request, > "
+              << BLKIF_MAX_SEGMENTS_PER_REQUEST << " uses indirect (8)\n"
+              << "  -w, --write-pct N     percentage of writes (0)\n"
+              << "  -p, --data-pages N    frontend buffer pool in pages (256)\n"
+              << "  -l, --linear-map N    backend linear map cache in pages (0)\n"
+              << "  -W, --workers N       backend I/O threads per frontend (0)\n"
+              << "  -S, --shared-workers N backend I/O threads shared by frontends (0)\n"
+              << "  -Q, --fair-quantum N  requests per frontend per shared round (1)\n"
+              << "  -T, --work-stealing   idle frontends' workers help busy ones\n"
+              << "  -I, --max-in-flight N requests a frontend has worked on at once (0)\n"
+              << "  -G, --max-in-flight-total N  the same over all frontends (0)\n"
+              << "  -R, --reactor N       backend threads serving all rings (0, one per ring)\n"
+              << "  -U, --reactor-quantum N requests per ring per reactor turn (8, 0 all)\n"
+              << "  -P, --poll-us N       backend ring polling budget in us (0)\n"
+              << "  -n, --notify-batch N  responses per kick to the frontend (0)\n"
+              << "  -D, --notify-delay N  longest a kick is held back in us (0)\n"
+              << "  -a, --notify-adaptive scale the batch to the response rate\n"
+              << "  -M, --merge-sectors N longest merge of adjacent requests (0)\n"
+              << "  -X, --split-sectors N longest read or write one worker does (256)\n"
+              << "  -C, --cpus LIST       spread backend threads over these cpus\n"
+              << "  -N, --numa-node N     keep backend threads on a node, or auto\n"
+              << "  -r, --random          random instead of sequential offsets\n";
+}
+
+static bool parse(int argc, char *argv[], BenchConfig &config)
+{
+    static const struct option options[] = {
+        {"image", required_argument, nullptr, 'i'},
+        {"image-mb", required_argument, nullptr, 'm'},
+        {"frontends", required_argument, nullptr, 'f'},
+        {"queues", required_argument, nullptr, 'q'},
+        {"ring-order", required_argument, nullptr, 'o'},
+        {"seconds", required_argument, nullptr, 't'},
+        {"depth", required_argument, nullptr, 'd'},
+        {"heavy-depth", required_argument, nullptr, 'H'},
+        {"segments", required_argument, nullptr, 's'},
+        {"write-pct", required_argument, nullptr, 'w'},
+        {"data-pages", required_argument, nullptr, 'p'},
+        {"linear-map", required_argument, nullptr, 'l'},
+        {"workers", required_argument, nullptr, 'W'},
+        {"shared-workers", required_argument, nullptr, 'S'},
+        {"fair-quantum", required_argument, nullptr, 'Q'},
+        {"work-stealing", no_argument, nullptr, 'T'},
+        {"max-in-flight", required_argument, nullptr, 'I'},
+        {"max-in-flight-total", required_argument, nullptr, 'G'},
+        {"reactor", required_argument, nullptr, 'R'},
+        {"reactor-quantum", required_argument, nullptr, 'U'},
+        {"poll-us", required_argument, nullptr, 'P'},
+        {"notify-batch", required_argument, nullptr, 'n'},
+        {"notify-delay", required_argument, nullptr, 'D'},
+        {"notify-adaptive", no_argument, nullptr, 'a'},
+        {"merge-sectors", required_argument, nullptr, 'M'},
+        {"split-sectors", required_argument, nullptr, 'X'},
+        {"cpus", required_argument, nullptr, 'C'},
+        {"numa-node", required_argument, nullptr, 'N'},
+        {"random", no_argument, nullptr, 'r'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:m:f:q:o:t:d:H:s:w:p:l:W:S:Q:TI:G:R:U:P:n:D:aM:X:C:N:rh", options, nullptr)) != -1) {
+        switch (opt) {
+        case 'i': config.image = optarg; break;
+        case 'm': config.imageMb = strtoul(optarg, nullptr, 0); break;
+        case 'f': config.frontends = strtoul(optarg, nullptr, 0); break;
+        case 'q': config.queues = strtoul(optarg, nullptr, 0); break;
+        case 'o': config.ringOrder = strtoul(optarg, nullptr, 0); break;
+        case 't': config.seconds = strtoul(optarg, nullptr, 0); break;
+        case 'd': config.depth = strtoul(optarg, nullptr, 0); break;
+        case 'H': config.heavyDepth = strtoul(optarg, nullptr, 0); break;
+        case 's': config.segments = strtoul(optarg, nullptr, 0); break;
+        case 'w': config.writePct = strtoul(optarg, nullptr, 0); break;
+        case 'p': config.dataPages = strtoul(optarg, nullptr, 0); break;
+        case 'l': config.linearMapPages = strtoul(optarg, nullptr, 0); break;
+        case 'W': config.workers = strtoul(optarg, nullptr, 0); break;
+        case 'S': config.sharedWorkers = strtoul(optarg, nullptr, 0); break;
+        case 'Q': config.fairQuantum = strtoul(optarg, nullptr, 0); break;
+        case 'T': config.workStealing = true; break;
+        case 'I': config.maxInFlight = strtoul(optarg, nullptr, 0); break;
+        case 'G': config.maxInFlightTotal = strtoul(optarg, nullptr, 0); break;
+        case 'R': config.reactorThreads = strtoul(optarg, nullptr, 0); break;
+        case 'U': config.reactorQuantum = strtoul(optarg, nullptr, 0); break;
+        case 'P': config.pollUs = strtoul(optarg, nullptr, 0); break;
+        case 'n': config.notifyBatch = strtoul(optarg, nullptr, 0); break;
+        case 'D': config.notifyDelayUs = strtoul(optarg, nullptr, 0); break;
+        case 'a': config.notifyAdaptive = true; break;
+        case 'M': config.mergeSectors = strtoul(optarg, nullptr, 0); break;
+        case 'X': config.splitSectors = strtoul(optarg, nullptr, 0); break;
+        case 'C':
+            if (!parseCpuList(optarg, config.cpus)) {
+                return false;
+            }
+            break;
+        case 'N':
+            if (!parseNumaNode(optarg, config.numaNode)) {
+                return false;
+            }
+            break;
+        case 'r': config.random = true; break;
+        default: return false;
+        }
+    }
+
+    return config.frontends > 0U && config.queues > 0U && config.depth > 0U &&
+           config.segments > 0U && config.fairQuantum > 0U &&
+           config.dataPages / config.queues >= config.segments;
+}
+
+// Drives one queue of a frontend. Each queue uses its own slice of the
+// frontend's data pages.
+static void runQueue(SimFrontend &fe,
+                     uint32_t queue,
+                     uint32_t depth,
+                     const BenchConfig &config,
+                     uint64_t sectorCount,
+                     const std::atomic<bool> &stop,
+                     BenchResult &result)
+{
+    const uint64_t reqSectors = uint64_t(config.segments) * XC_PAGE_SIZE / SECTOR_SIZE;
+    const uint64_t slots = sectorCount / reqSectors;
+    const bool indirect = config.segments > BLKIF_MAX_SEGMENTS_PER_REQUEST;
+
+    const uint32_t queuePages = config.dataPages / config.queues;
+    const uint32_t firstPage = queue * queuePages;
+
+    std::mt19937_64 rng(fe.domId() * 64U + queue);
+    std::unordered_map<uint64_t, bench_clock::time_point> issued;
+    std::vector<blkif_response_t> rsps;
+    uint64_t nextId = 0U;
+    uint64_t nextSlot = 0U;
+
+    while (!stop || !issued.empty()) {
+        bool queued = false;
+
+        while (!stop && issued.size() < depth) {
+            const uint64_t slot = config.random ? rng() % slots : nextSlot++ % slots;
+            const uint8_t op = (rng() % 100U) < config.writePct ? BLKIF_OP_WRITE
+                                                                : BLKIF_OP_READ;
+            const uint32_t page = firstPage + (nextId * config.segments) % queuePages;
+            const bool ok = indirect ?
+                fe.queueIndirect(op, nextId, slot * reqSectors, page,
+                                 config.segments, queue) :
+                fe.queueReadWrite(op, nextId, slot * reqSectors, page,
+                                  config.segments, queue);
+
+            if (!ok) {
+                break;
+            }
+
+            issued[nextId++] = bench_clock::now();
+            queued = true;
+        }
+
+        if (queued) {
+            fe.push(queue);
+        }
+
+        rsps.clear();
+        fe.reap(rsps, 1U, 1000, queue);
+
+        const auto now = bench_clock::now();
+        for (const auto &rsp : rsps) {
+            auto itr = issued.find(rsp.id);
+            if (itr == issued.end()) {
+                continue;
+            }
+
+            const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                now - itr->second).count();
+
+            result.latencyUs.push_back(uint32_t(us));
+            result.errors += rsp.status != BLKIF_RSP_OKAY;
+            result.ops++;
+            issued.erase(itr);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    BenchConfig config;
+
+    if (!parse(argc, argv, config)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    struct stat sb;
+    if (stat(config.image.c_str(), &sb) != 0) {
+        const uint64_t sectors = config.imageMb * 1024U * 1024U / SECTOR_SIZE;
+
+        if (DiskImage::createBackingFile(config.image, sectors, SECTOR_SIZE)) {
+            std::cerr << "Failed to create " << config.image << '\n';
+            return EXIT_FAILURE;
+        }
+    }
+
+    BlkDeviceConfig defaults;
+    defaults.linearMapPages = config.linearMapPages;
+    defaults.maxQueues = config.queues;
+    defaults.workers = config.workers;
+    defaults.sharedWorkers = config.sharedWorkers;
+    defaults.fairQuantum = config.fairQuantum;
+    defaults.workStealing = config.workStealing;
+    defaults.reactorThreads = config.reactorThreads;
+    defaults.reactorQuantum = config.reactorQuantum;
+    defaults.maxInFlight = config.maxInFlight;
+    defaults.maxInFlightTotal = config.maxInFlightTotal;
+    defaults.pollUs = config.pollUs;
+    defaults.notifyBatch = config.notifyBatch;
+    defaults.notifyDelayUs = config.notifyDelayUs;
+    defaults.notifyAdaptive = config.notifyAdaptive;
+    defaults.mergeSectors = config.mergeSectors;
+    defaults.splitSectors = config.splitSectors;
+    defaults.cpus = config.cpus;
+
+    // Offer as many indirect segments as the requests need
+    defaults.maxIndirectSegments = std::max(defaults.maxIndirectSegments,
+                                            config.segments);
+    defaults.numaNode = config.numaNode;
+
+    BlkBackend backend(false, defaults);
+    backend.start();
+
+    SimFrontendConfig feConfig;
+    feConfig.dataPages = config.dataPages;
+    feConfig.queues = config.queues;
+    feConfig.ringPageOrder = config.ringOrder;
+
+    std::vector<std::unique_ptr<SimFrontend>> frontends;
+    for (uint32_t i = 0U; i < config.frontends; i++) {
+        frontends.emplace_back(new SimFrontend(backend, domid_t(i + 1), 51712,
+                                               config.image, feConfig));
+        frontends.back()->connect();
+    }
+
+    const uint64_t sectorCount = DiskImage(config.image).getSectorCount();
+    std::vector<BenchResult> results(config.frontends * config.queues);
+    std::vector<std::thread> threads;
+    std::atomic<bool> stop{false};
+
+    SimXen::resetStats();
+    const auto start = bench_clock::now();
+
+    for (uint32_t i = 0U; i < config.frontends; i++) {
+        const uint32_t depth = i == 0U && config.heavyDepth != 0U ?
+            config.heavyDepth : config.depth;
+
+        for (uint32_t queue = 0U; queue < frontends[i]->queues(); queue++) {
+            threads.emplace_back(runQueue, std::ref(*frontends[i]), queue,
+                                 depth, std::cref(config), sectorCount, std::cref(stop),
+                                 std::ref(results[i * config.queues + queue]));
+        }
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(config.seconds));
+    stop = true;
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    const double secs = std::chrono::duration<double>(bench_clock::now() - start).count();
+    const auto sim = SimXen::stats();
+
+    // With a heavy first frontend, the others are reported on their own too
+    BenchResult total;
+    BenchResult heavy;
+    BenchResult light;
+    for (size_t i = 0U; i < results.size(); i++) {
+        for (auto *sum : {&total, i < config.queues ? &heavy : &light}) {
+            sum->ops += results[i].ops;
+            sum->errors += results[i].errors;
+            sum->latencyUs.insert(sum->latencyUs.end(),
+                                  results[i].latencyUs.begin(),
+                                  results[i].latencyUs.end());
+        }
+    }
+
+    for (auto *sum : {&total, &heavy, &light}) {
+        std::sort(sum->latencyUs.begin(), sum->latencyUs.end());
+    }
+
+    auto percentile = [](const BenchResult &result, double p) -> uint32_t {
+        if (result.latencyUs.empty()) {
+            return 0U;
+        }
+
+        return result.latencyUs[size_t(p * (result.latencyUs.size() - 1))];
+    };
+
+    const double ops = double(std::max<uint64_t>(total.ops, 1U));
+    const double mib = double(total.ops) * config.segments * XC_PAGE_SIZE / (1024.0 * 1024.0);
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "requests:        " << total.ops << " (" << total.errors << " errors)\n"
+              << "iops:            " << total.ops / secs << '\n'
+              << "throughput:      " << mib / secs << " MiB/s\n"
+              << "latency p50/p99: " << percentile(total, 0.50) << " / "
+              << percentile(total, 0.99) << " us\n"
+              << std::setprecision(3)
+              << "grant maps:      " << sim.grantMaps << " (" << sim.grantMaps / ops << "/req)\n"
+              << "grant unmaps:    " << sim.grantUnmaps << '\n'
+              << "kicks to back:   " << sim.notifiesToBackend << " ("
+              << sim.notifiesToBackend / ops << "/req)\n"
+              << "kicks to front:  " << sim.notifiesToFrontend << " ("
+              << sim.notifiesToFrontend / ops << "/req)\n";
+
+    if (config.heavyDepth != 0U && config.frontends > 1U) {
+        for (const auto &part : {std::make_pair("heavy", &heavy),
+                                 std::make_pair("light", &light)}) {
+            std::cout << std::setprecision(1)
+                      << part.first << " iops:      " << part.second->ops / secs
+                      << ", p50/p99 " << percentile(*part.second, 0.50) << " / "
+                      << percentile(*part.second, 0.99) << " us\n";
+        }
+    }
+
+    frontends.clear();
+    backend.stop();
+
+    return total.errors == 0U ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,1213 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "BlkBackend.hpp"
+#include "SimFrontend.hpp"
+#include "SimXen.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#define CATCH_CONFIG_MAIN
+#include "include/catch.hpp"
+
+static const char *const IMAGE = "./sim-test.img";
+static constexpr uint64_t IMAGE_SECTORS = 8192U;
+static constexpr uint32_t PAGE_SECTORS = XC_PAGE_SIZE / SECTOR_SIZE;
+
+int8_t rc = DiskImage::createBackingFile(IMAGE, IMAGE_SECTORS, SECTOR_SIZE);
+BlkBackend backend;
+
+static blkif_response_t submitOne(SimFrontend &fe)
+{
+    std::vector<blkif_response_t> rsps;
+
+    fe.push();
+    REQUIRE(fe.reap(rsps, 1U) == 1U);
+
+    return rsps.front();
+}
+
+static void fillPages(SimFrontend &fe, uint32_t first, uint32_t count, uint8_t seed)
+{
+    for (uint32_t i = 0U; i < count; i++) {
+        memset(fe.dataPage(first + i), seed + i, XC_PAGE_SIZE);
+    }
+}
+
+static bool samePages(SimFrontend &fe, uint32_t a, uint32_t b, uint32_t count)
+{
+    for (uint32_t i = 0U; i < count; i++) {
+        if (memcmp(fe.dataPage(a + i), fe.dataPage(b + i), XC_PAGE_SIZE) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TEST_CASE("Direct requests round trip through the ring", "[ring]"){
+    REQUIRE(rc == 0);
+
+    SimFrontend fe(backend, 1, 51712, IMAGE);
+    fe.connect();
+
+    SECTION("Write then read back"){
+        fillPages(fe, 0, 4, 0x10);
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_WRITE, 1, 64, 0, 4));
+        REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+
+        fillPages(fe, 4, 4, 0x00);
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, 2, 64, 4, 4));
+
+        auto rsp = submitOne(fe);
+        REQUIRE(rsp.id == 2);
+        REQUIRE(rsp.operation == BLKIF_OP_READ);
+        REQUIRE(rsp.status == BLKIF_RSP_OKAY);
+        REQUIRE(samePages(fe, 0, 4, 4));
+    }
+    SECTION("Partial page segment"){
+        blkif_request_t req;
+        memset(&req, 0, sizeof(req));
+
+        fillPages(fe, 8, 1, 0xAB);
+
+        req.operation = BLKIF_OP_WRITE;
+        req.nr_segments = 1;
+        req.id = 3;
+        req.sector_number = 16;
+        req.seg[0].gref = fe.dataGref(8);
+        req.seg[0].first_sect = 2;
+        req.seg[0].last_sect = 5;
+
+        REQUIRE(fe.queueRequest(req));
+        REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+
+        fillPages(fe, 9, 1, 0x00);
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, 4, 14, 9, 1));
+        REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+
+        const uint8_t *page = fe.dataPage(9);
+        REQUIRE(page[0] == 0x00);
+        REQUIRE(page[2 * SECTOR_SIZE] == 0xAB);
+        REQUIRE(page[6 * SECTOR_SIZE - 1] == 0xAB);
+        REQUIRE(page[6 * SECTOR_SIZE] == 0x00);
+    }
+}
+
+TEST_CASE("Adjacent requests are merged", "[merge]"){
+    SimFrontendConfig config;
+    config.backendKeys["merge-sectors"] = "1024";
+
+    SimFrontend fe(backend, 9, 51712, IMAGE, config);
+    std::vector<blkif_response_t> rsps;
+
+    fe.connect();
+
+    // Four single page writes in a row, split by one running off the end
+    // of the image, which must fail on its own
+    fillPages(fe, 16, 8, 0x30);
+
+    for (uint32_t i = 0U; i < 4U; i++) {
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_WRITE, 10 + i, 256 + i * PAGE_SECTORS, 16 + i, 1));
+    }
+
+    REQUIRE(fe.queueReadWrite(BLKIF_OP_WRITE, 14, IMAGE_SECTORS - PAGE_SECTORS, 20, 2));
+    REQUIRE(fe.queueReadWrite(BLKIF_OP_WRITE, 15, 256 + 4 * PAGE_SECTORS, 20, 4));
+    fe.push();
+    REQUIRE(fe.reap(rsps, 6U) == 6U);
+
+    for (uint32_t i = 0U; i < 6U; i++) {
+        REQUIRE(rsps[i].id == 10 + i);
+        REQUIRE(rsps[i].status == (i == 4U ? BLKIF_RSP_ERROR : BLKIF_RSP_OKAY));
+    }
+
+    // Read back as adjacent reads too
+    fillPages(fe, 24, 8, 0x00);
+
+    for (uint32_t i = 0U; i < 8U; i++) {
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, 20 + i, 256 + i * PAGE_SECTORS, 24 + i, 1));
+    }
+
+    rsps.clear();
+    fe.push();
+    REQUIRE(fe.reap(rsps, 8U) == 8U);
+
+    for (uint32_t i = 0U; i < 8U; i++) {
+        REQUIRE(rsps[i].id == 20 + i);
+        REQUIRE(rsps[i].status == BLKIF_RSP_OKAY);
+    }
+
+    REQUIRE(samePages(fe, 16, 24, 8));
+
+    // A chain reaching the end of the image stops there, so the requests
+    // that fit still succeed
+    for (uint32_t i = 0U; i < 3U; i++) {
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, 30 + i,
+                                  IMAGE_SECTORS - (3 - i) * PAGE_SECTORS, i, i == 2U ? 2 : 1));
+    }
+
+    rsps.clear();
+    fe.push();
+    REQUIRE(fe.reap(rsps, 3U) == 3U);
+    REQUIRE(rsps[0].status == BLKIF_RSP_OKAY);
+    REQUIRE(rsps[1].status == BLKIF_RSP_OKAY);
+    REQUIRE(rsps[2].status == BLKIF_RSP_ERROR);
+}
+
+TEST_CASE("Responses to a batch are published together", "[publish]"){
+    SimFrontend fe(backend, 18, 51712, IMAGE);
+    fe.connect();
+
+    // The frontend sees either none of the responses or all of them, and
+    // is kicked once
+    for (uint32_t round = 0U; round < 10U; round++) {
+        std::vector<blkif_response_t> rsps;
+        const uint64_t kicks = SimXen::stats().notifiesToFrontend;
+
+        for (uint32_t i = 0U; i < 16U; i++) {
+            REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, i, i * PAGE_SECTORS, i, 1));
+        }
+
+        fe.push();
+        REQUIRE(fe.reap(rsps, 1U) == 16U);
+        REQUIRE(SimXen::stats().notifiesToFrontend == kicks + 1U);
+    }
+}
+
+TEST_CASE("Indirect requests round trip through the ring", "[indirect]"){
+    SimFrontend fe(backend, 2, 51712, IMAGE);
+    fe.connect();
+
+    fillPages(fe, 0, 64, 0x20);
+    REQUIRE(fe.queueIndirect(BLKIF_OP_WRITE, 1, 1024, 0, 64));
+    REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+
+    fillPages(fe, 64, 64, 0x00);
+    REQUIRE(fe.queueIndirect(BLKIF_OP_READ, 2, 1024, 64, 64));
+
+    auto rsp = submitOne(fe);
+    REQUIRE(rsp.operation == BLKIF_OP_READ);
+    REQUIRE(rsp.status == BLKIF_RSP_OKAY);
+    REQUIRE(samePages(fe, 0, 64, 64));
+}
+
+TEST_CASE("Indirect pages don't evict data grants", "[indirect]"){
+    BlkDeviceConfig defaults;
+
+    // 128 grants for the one device: 32 for indirect pages, 96 for data
+    defaults.maxGrants = 128U;
+
+    BlkBackend small(false, defaults);
+    SimFrontend fe(small, 19, 51712, IMAGE);
+
+    fe.connect();
+
+    // 80 data pages, all of which stay mapped
+    for (uint32_t i = 0U; i < 10U; i++) {
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, i, i * 8U * PAGE_SECTORS, i * 8U, 8));
+        REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+    }
+
+    // A ring full of indirect requests over data pages already mapped
+    // brings in 31 descriptor pages. Sharing the data pages' room, they
+    // would push some of them out.
+    std::vector<blkif_response_t> rsps;
+
+    for (uint32_t i = 0U; i < 31U; i++) {
+        REQUIRE(fe.queueIndirect(BLKIF_OP_READ, 100 + i, i * PAGE_SECTORS, 0, 16));
+    }
+
+    fe.push();
+    REQUIRE(fe.reap(rsps, 31U) == 31U);
+
+    for (const auto &rsp : rsps) {
+        REQUIRE(rsp.status == BLKIF_RSP_OKAY);
+    }
+
+    const uint64_t maps = SimXen::stats().grantMaps;
+
+    for (uint32_t i = 0U; i < 10U; i++) {
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, i, i * 8U * PAGE_SECTORS, i * 8U, 8));
+        REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+    }
+
+    REQUIRE(SimXen::stats().grantMaps == maps);
+
+    fe.disconnect();
+    small.stop();
+}
+
+TEST_CASE("Devices can take larger indirect requests", "[indirect]"){
+    SimFrontendConfig config;
+    config.dataPages = 1024U;
+    config.backendKeys["max-indirect-segments"] = "512";
+
+    SimFrontend fe(backend, 710, 51712, IMAGE, config);
+    fe.connect();
+
+    REQUIRE(fe.maxIndirectSegments() == 512U);
+
+    // 2 MB each way
+    fillPages(fe, 0, 512, 0x11);
+    REQUIRE(fe.queueIndirect(BLKIF_OP_WRITE, 1, 0, 0, 512));
+    REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+
+    fillPages(fe, 512, 512, 0x00);
+    REQUIRE(fe.queueIndirect(BLKIF_OP_READ, 2, 0, 512, 512));
+    REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+    REQUIRE(samePages(fe, 0, 512, 512));
+
+    // More than offered is refused
+    REQUIRE(fe.queueIndirect(BLKIF_OP_READ, 3, 0, 0, 520));
+    REQUIRE(submitOne(fe).status == BLKIF_RSP_ERROR);
+
+    SimFrontend small(backend, 711, 51712, IMAGE);
+    small.connect();
+    REQUIRE(small.maxIndirectSegments() == 256U);
+}
+
+TEST_CASE("Linear maps serve contiguous requests", "[linear]"){
+    SimFrontendConfig config;
+    config.backendKeys["linear-map-pages"] = "128";
+
+    SimFrontend fe(backend, 5, 51712, IMAGE, config);
+    fe.connect();
+
+    fillPages(fe, 0, 8, 0x30);
+    REQUIRE(fe.queueReadWrite(BLKIF_OP_WRITE, 1, 2048, 0, 8));
+    REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+
+    fillPages(fe, 8, 8, 0x00);
+    REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, 2, 2048, 8, 8));
+    REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+    REQUIRE(samePages(fe, 0, 8, 8));
+
+    // The same buffers again reuse the existing mapping
+    const uint64_t maps = SimXen::stats().grantMaps;
+
+    fillPages(fe, 8, 8, 0x00);
+    REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, 3, 2048, 8, 8));
+    REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+    REQUIRE(samePages(fe, 0, 8, 8));
+    REQUIRE(SimXen::stats().grantMaps == maps);
+
+    fillPages(fe, 16, 32, 0x40);
+    REQUIRE(fe.queueIndirect(BLKIF_OP_WRITE, 4, 3072, 16, 32));
+    REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+
+    fillPages(fe, 48, 32, 0x00);
+    REQUIRE(fe.queueIndirect(BLKIF_OP_READ, 5, 3072, 48, 32));
+    REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+    REQUIRE(samePages(fe, 16, 48, 32));
+}
+
+TEST_CASE("Non data requests and errors", "[status]"){
+    SimFrontend fe(backend, 3, 51712, IMAGE);
+    fe.connect();
+
+    SECTION("Flush"){
+        REQUIRE(fe.queueFlush(1));
+        REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+    }
+    SECTION("Unsupported operation"){
+        blkif_request_t req;
+        memset(&req, 0, sizeof(req));
+
+        req.operation = BLKIF_OP_RESERVED_1;
+        req.id = 2;
+
+        REQUIRE(fe.queueRequest(req));
+        REQUIRE(submitOne(fe).status == BLKIF_RSP_EOPNOTSUPP);
+    }
+    SECTION("Read past the end of the image"){
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, 3, IMAGE_SECTORS - PAGE_SECTORS, 0, 2));
+        REQUIRE(submitOne(fe).status == BLKIF_RSP_ERROR);
+    }
+    SECTION("Sector number wrapping around"){
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, 5, UINT64_MAX - 3U, 0, 1));
+        REQUIRE(submitOne(fe).status == BLKIF_RSP_ERROR);
+
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_WRITE, 6, UINT64_MAX - 3U, 0, 1));
+        REQUIRE(submitOne(fe).status == BLKIF_RSP_ERROR);
+    }
+    SECTION("Segment ending before it starts"){
+        blkif_request_t req;
+        memset(&req, 0, sizeof(req));
+
+        req.operation = BLKIF_OP_READ;
+        req.id = 4;
+        req.nr_segments = 2;
+        req.seg[0] = blkif_request_segment{fe.dataGref(0), 0, PAGE_SECTORS - 1};
+        req.seg[1] = blkif_request_segment{fe.dataGref(1), 4, 3};
+
+        REQUIRE(fe.queueRequest(req));
+        REQUIRE(submitOne(fe).status == BLKIF_RSP_ERROR);
+    }
+}
+
+TEST_CASE("Each queue of a multi-queue device is served", "[multiqueue]"){
+    SimFrontendConfig config;
+    config.queues = 4U;
+    config.backendKeys["max-queues"] = "4";
+
+    SimFrontend fe(backend, 6, 51712, IMAGE, config);
+    fe.connect();
+
+    REQUIRE(fe.queues() == 4U);
+
+    // Every queue writes its own 16 pages at once, then reads them back
+    std::vector<std::thread> threads;
+    std::atomic<uint32_t> failures{0};
+
+    fillPages(fe, 0, 64, 0x50);
+
+    for (uint32_t queue = 0U; queue < 4U; queue++) {
+        threads.emplace_back([&fe, &failures, queue] {
+            std::vector<blkif_response_t> rsps;
+
+            for (uint32_t i = 0U; i < 16U; i++) {
+                const uint32_t page = queue * 16U + i;
+
+                if (!fe.queueReadWrite(BLKIF_OP_WRITE, page, 4096 + page * PAGE_SECTORS,
+                                       page, 1, queue)) {
+                    failures++;
+                }
+            }
+
+            fe.push(queue);
+
+            if (fe.reap(rsps, 16U, 5000, queue) != 16U) {
+                failures++;
+            }
+
+            for (const auto &rsp : rsps) {
+                failures += rsp.status != BLKIF_RSP_OKAY;
+            }
+        });
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    REQUIRE(failures == 0U);
+
+    fillPages(fe, 64, 64, 0x00);
+    REQUIRE(fe.queueIndirect(BLKIF_OP_READ, 1, 4096, 64, 64, 3));
+    fe.push(3);
+
+    std::vector<blkif_response_t> rsps;
+    REQUIRE(fe.reap(rsps, 1U, 5000, 3) == 1U);
+    REQUIRE(rsps.front().status == BLKIF_RSP_OKAY);
+    REQUIRE(samePages(fe, 0, 64, 64));
+}
+
+TEST_CASE("Requests run on the device's workers", "[workers]"){
+    SimFrontendConfig config;
+    config.backendKeys["workers"] = "3";
+
+    SimFrontend fe(backend, 10, 51712, IMAGE, config);
+    std::vector<blkif_response_t> rsps;
+
+    fe.connect();
+
+    // 24 writes at once and a flush. The workers may finish the writes in
+    // any order but the flush is only answered after all of them.
+    fillPages(fe, 0, 24, 0x58);
+
+    for (uint32_t i = 0U; i < 24U; i++) {
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_WRITE, i, 5120 + i * PAGE_SECTORS, i, 1));
+    }
+
+    REQUIRE(fe.queueFlush(24));
+    fe.push();
+    REQUIRE(fe.reap(rsps, 25U) == 25U);
+    REQUIRE(rsps.back().id == 24);
+    REQUIRE(rsps.back().operation == BLKIF_OP_FLUSH_DISKCACHE);
+
+    for (const auto &rsp : rsps) {
+        REQUIRE(rsp.status == BLKIF_RSP_OKAY);
+    }
+
+    // Read back the same way
+    fillPages(fe, 24, 24, 0x00);
+
+    for (uint32_t i = 0U; i < 24U; i++) {
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, 30 + i, 5120 + i * PAGE_SECTORS, 24 + i, 1));
+    }
+
+    rsps.clear();
+    fe.push();
+    REQUIRE(fe.reap(rsps, 24U) == 24U);
+
+    for (const auto &rsp : rsps) {
+        REQUIRE(rsp.status == BLKIF_RSP_OKAY);
+    }
+
+    REQUIRE(samePages(fe, 0, 24, 24));
+}
+
+TEST_CASE("Requests after a flush wait for it", "[flush]"){
+    SimFrontendConfig config;
+    config.backendKeys["workers"] = "3";
+
+    SimFrontend fe(backend, 11, 51712, IMAGE, config);
+    std::vector<blkif_response_t> rsps;
+
+    fe.connect();
+
+    // A read queued after a flush sees the write queued before it, even
+    // though the workers could otherwise run it first
+    for (uint8_t round = 0U; round < 8U; round++) {
+        fillPages(fe, 0, 32, round);
+        fillPages(fe, 32, 32, 0x00);
+        REQUIRE(fe.queueIndirect(BLKIF_OP_WRITE, 2, 6144, 0, 32));
+        REQUIRE(fe.queueFlush(3));
+        REQUIRE(fe.queueIndirect(BLKIF_OP_READ, 4, 6144, 32, 32));
+        fe.push();
+
+        rsps.clear();
+        REQUIRE(fe.reap(rsps, 3U) == 3U);
+        REQUIRE(rsps[0].id == 2);
+        REQUIRE(rsps[1].id == 3);
+        REQUIRE(rsps[2].id == 4);
+        REQUIRE(samePages(fe, 0, 32, 32));
+    }
+}
+
+TEST_CASE("Large requests are split between the workers", "[split]"){
+    SimFrontendConfig config;
+    config.backendKeys["workers"] = "4";
+
+    // Not a whole number of pages, so chunks end inside a segment
+    config.backendKeys["split-sectors"] = "60";
+
+    SimFrontend fe(backend, 700, 51712, IMAGE, config);
+    fe.connect();
+
+    fillPages(fe, 0, 128, 0x70);
+    REQUIRE(fe.queueIndirect(BLKIF_OP_WRITE, 1, 2048, 0, 128));
+    REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+
+    fillPages(fe, 128, 128, 0x00);
+    REQUIRE(fe.queueIndirect(BLKIF_OP_READ, 2, 2048, 128, 128));
+
+    auto rsp = submitOne(fe);
+    REQUIRE(rsp.id == 2);
+    REQUIRE(rsp.status == BLKIF_RSP_OKAY);
+    REQUIRE(samePages(fe, 0, 128, 128));
+
+    // Only the chunks past the end of the image fail, which fails the
+    // whole request
+    REQUIRE(fe.queueIndirect(BLKIF_OP_READ, 3, IMAGE_SECTORS - 32 * PAGE_SECTORS,
+                             128, 64));
+    rsp = submitOne(fe);
+    REQUIRE(rsp.id == 3);
+    REQUIRE(rsp.status == BLKIF_RSP_ERROR);
+}
+
+TEST_CASE("Multi-page rings hold more requests", "[ring-order]"){
+    SimFrontendConfig config;
+    config.ringPageOrder = 2U;
+
+    SimFrontend fe(backend, 7, 51712, IMAGE, config);
+    std::vector<blkif_response_t> rsps;
+
+    fe.connect();
+
+    const unsigned int slots = fe.ringSize();
+    REQUIRE(slots == __CONST_RING_SIZE(blkif, 4 * XC_PAGE_SIZE));
+
+    for (unsigned int i = 0U; i < slots; i++) {
+        REQUIRE(fe.queueReadWrite(i % 2U ? BLKIF_OP_READ : BLKIF_OP_WRITE, i,
+                                  i * PAGE_SECTORS, i % fe.dataPages(), 1));
+    }
+
+    REQUIRE_FALSE(fe.queueFlush(slots));
+
+    fe.push();
+    REQUIRE(fe.reap(rsps, slots) == slots);
+
+    for (const auto &rsp : rsps) {
+        REQUIRE(rsp.status == BLKIF_RSP_OKAY);
+    }
+}
+
+TEST_CASE("Polled rings take requests without a kick", "[poll]"){
+    SimFrontendConfig config;
+    config.backendKeys["poll-us"] = "1000";
+
+    SimFrontend fe(backend, 15, 51712, IMAGE, config);
+    std::vector<blkif_response_t> rsps;
+    uint32_t kicks = 0U;
+
+    fe.connect();
+
+    REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, 0, 0, 0, 1));
+    REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+
+    // A steady stream of requests, one at a time and never kicked unless
+    // one is left waiting. The backend is still polling the ring when
+    // most of them arrive.
+    for (uint64_t i = 1U; i < 100U; i++) {
+        rsps.clear();
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, i, i * PAGE_SECTORS, 0, 1));
+        fe.publish();
+
+        if (fe.reap(rsps, 1U, 100) == 0U) {
+            kicks++;
+            fe.kick();
+            REQUIRE(fe.reap(rsps, 1U) == 1U);
+        }
+
+        REQUIRE(rsps[0].id == i);
+        REQUIRE(rsps[0].status == BLKIF_RSP_OKAY);
+    }
+
+    REQUIRE(kicks < 50U);
+}
+
+TEST_CASE("Ring polling adapts to how often it finds work", "[poll]"){
+    RingPoller poller(100);
+    uint32_t calls = 0U;
+
+    // Work turning up while polling widens the window
+    REQUIRE(poller.poll([] { return true; }));
+    REQUIRE(poller.stats().hits == 1U);
+
+    // An idle ring narrows it until polling stops altogether
+    for (int i = 0; i < 16; i++) {
+        calls = 0U;
+        REQUIRE_FALSE(poller.poll([&calls] { calls++; return false; }));
+
+        if (calls == 0U) {
+            break;
+        }
+    }
+
+    REQUIRE(calls == 0U);
+
+    // Being woken straight after sleeping turns it back on
+    poller.sleeping();
+    poller.woken();
+    REQUIRE(poller.poll([] { return true; }));
+
+    RingPoller disabled(0);
+    REQUIRE_FALSE(disabled.enabled());
+    REQUIRE_FALSE(disabled.poll([] { return true; }));
+}
+
+TEST_CASE("Kicks to the frontend are coalesced", "[notify]"){
+    // Off: every kick the frontend asks for goes out
+    NotifyCoalescer off(0, 0, false, [] { });
+    REQUIRE(off.published(3, true, 5));
+    REQUIRE_FALSE(off.published(3, false, 5));
+    REQUIRE(off.stats().notifies == 1U);
+    REQUIRE(off.stats().responses == 6U);
+
+    // A kick is held back until enough responses follow it
+    NotifyCoalescer batch(4, 1000000, false, [] { });
+    REQUIRE_FALSE(batch.published(1, true, 5));
+    REQUIRE_FALSE(batch.published(1, false, 5));
+    REQUIRE(batch.published(2, false, 5));
+    REQUIRE_FALSE(batch.published(2, false, 5));
+
+    // ... or until the delay runs out
+    std::atomic<uint32_t> expired{0};
+    NotifyCoalescer *delayed = nullptr;
+    std::mutex lock;
+    NotifyCoalescer timed(100, 1000, false, [&] {
+        std::lock_guard<std::mutex> guard(lock);
+        expired += delayed->expired();
+    });
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        delayed = &timed;
+        REQUIRE_FALSE(timed.published(1, true, 5));
+    }
+
+    for (int i = 0; i < 100 && expired == 0U; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    REQUIRE(expired == 1U);
+    REQUIRE(timed.stats().timerNotifies == 1U);
+
+    // Adaptive mode doesn't wait when nothing else is in flight
+    NotifyCoalescer adaptive(16, 1000000, true, [] { });
+    REQUIRE(adaptive.published(1, true, 0));
+}
+
+TEST_CASE("Coalesced kicks still answer lone requests", "[notify]"){
+    SimFrontendConfig config;
+    config.backendKeys["workers"] = "2";
+    config.backendKeys["notify-batch"] = "8";
+    config.backendKeys["notify-delay-us"] = "50";
+
+    SimFrontend fe(backend, 8, 51712, IMAGE, config);
+    fe.connect();
+
+    // Only one request is ever outstanding, so every kick waits for the
+    // delay. A worker finishing while the timer holds the ring must still
+    // get its response out. Sizes vary so the two land at varying times.
+    for (uint64_t i = 0U; i < 1000U; i++) {
+        std::vector<blkif_response_t> rsps;
+
+        REQUIRE(fe.queueReadWrite(i % 2U ? BLKIF_OP_READ : BLKIF_OP_WRITE, i,
+                                  (i % 64U) * 8U * PAGE_SECTORS, 0, 1U + i % 8U));
+        fe.push();
+        REQUIRE(fe.reap(rsps, 1U, 1000) == 1U);
+        REQUIRE(rsps[0].id == i);
+        REQUIRE(rsps[0].status == BLKIF_RSP_OKAY);
+    }
+}
+
+TEST_CASE("Token buckets allow a burst, then the rate", "[qos]"){
+    const auto start = TokenBucket::clock::now();
+    TokenBucket bucket;
+
+    bucket.configure(1000, 10, start);
+    REQUIRE(bucket.wait(10, start).count() == 0);
+    bucket.take(10);
+
+    // Empty: one more token takes a millisecond to come back
+    const auto wait = bucket.wait(1, start);
+    REQUIRE(wait > std::chrono::microseconds(990));
+    REQUIRE(wait <= std::chrono::microseconds(1001));
+    REQUIRE(bucket.wait(1, start + std::chrono::milliseconds(1)).count() == 0);
+
+    // More than the burst goes through once the bucket is full again
+    REQUIRE(bucket.wait(50, start + std::chrono::milliseconds(5)).count() != 0);
+    REQUIRE(bucket.wait(50, start + std::chrono::milliseconds(10)).count() == 0);
+
+    // Taking the limit off lets everything through
+    bucket.configure(0, 10, start);
+    REQUIRE(bucket.wait(1000000, start).count() == 0);
+
+    QosLimiter limiter;
+    QosLimits limits;
+    limits.readBps = 1U << 20;
+    limiter.setLimits(limits);
+
+    REQUIRE(limiter.limited());
+    REQUIRE(limiter.admit(true, 1000, 1U << 30).count() == 0);
+    REQUIRE(limiter.admit(false, 1, 100U << 10).count() == 0);
+    REQUIRE(limiter.admit(false, 1, 100U << 10).count() != 0);
+}
+
+TEST_CASE("Rate limits can change while connected", "[qos]"){
+    SimFrontend fe(backend, 17, 51712, IMAGE);
+    std::vector<blkif_response_t> rsps;
+
+    fe.connect();
+
+    // Rate limits set while connected hold writes back: a burst of 10,
+    // then 200 a second. Reads aren't limited.
+    fe.writeBackendKey("qos-burst-ms", "50");
+    fe.writeBackendKey("qos-write-iops", "200");
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (uint64_t i = 0U; i < 30U; i++) {
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_WRITE, i, i * 2 * PAGE_SECTORS, 0, 1));
+    }
+
+    REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, 30, 0, 1, 1));
+
+    fe.push();
+    REQUIRE(fe.reap(rsps, 31U) == 31U);
+    REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(100));
+
+    // Deferred, not failed, and still answered in order
+    for (uint64_t i = 0U; i < 31U; i++) {
+        REQUIRE(rsps[i].id == i);
+        REQUIRE(rsps[i].status == BLKIF_RSP_OKAY);
+    }
+
+    fe.writeBackendKey("qos-write-iops", "0");
+    REQUIRE(fe.queueReadWrite(BLKIF_OP_WRITE, 31, 0, 0, 1));
+    REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+}
+
+TEST_CASE("Flushes keep their order on stolen workers", "[steal]"){
+    // A flush on a device whose workers are stolen from still waits for
+    // the write before it, and the read after it still waits for the flush
+    BlkDeviceConfig defaults;
+    defaults.workStealing = true;
+
+    BlkBackend stealing(false, defaults);
+    SimFrontendConfig config;
+    config.backendKeys["workers"] = "1";
+
+    SimFrontend hot(stealing, 800, 51712, IMAGE, config);
+    SimFrontend cold(stealing, 801, 51712, IMAGE, config);
+    hot.connect();
+    cold.connect();
+
+    for (uint32_t round = 0U; round < 20U; round++) {
+        std::vector<blkif_response_t> rsps;
+
+        fillPages(hot, 0, 16, uint8_t(round));
+        fillPages(hot, 16, 16, 0x00);
+
+        for (uint32_t i = 0U; i < 16U; i++) {
+            REQUIRE(hot.queueReadWrite(BLKIF_OP_WRITE, i, 1024 + i * PAGE_SECTORS, i, 1));
+        }
+
+        REQUIRE(hot.queueFlush(16));
+        REQUIRE(hot.queueIndirect(BLKIF_OP_READ, 17, 1024, 16, 16));
+        hot.push();
+
+        REQUIRE(hot.reap(rsps, 18U) == 18U);
+        REQUIRE(rsps[16].id == 16);
+        REQUIRE(rsps[17].id == 17);
+        REQUIRE(samePages(hot, 0, 16, 16));
+    }
+
+    hot.disconnect();
+    cold.disconnect();
+    stealing.stop();
+}
+
+TEST_CASE("Threads are spread over their cpus", "[cpus]"){
+    std::vector<uint32_t> cpus;
+
+    REQUIRE(parseCpuList("4-6,1,5", cpus));
+    REQUIRE(cpus == std::vector<uint32_t>({1, 4, 5, 6}));
+    REQUIRE(cpuListString(cpus) == "1,4,5,6");
+    REQUIRE_FALSE(parseCpuList("3-1", cpus));
+    REQUIRE_FALSE(parseCpuList("1,x", cpus));
+
+    CpuPolicyType policy;
+    REQUIRE(parseCpuPolicy("shared", policy));
+    REQUIRE(policy == CpuPolicyType::SHARED);
+    REQUIRE_FALSE(parseCpuPolicy("numa", policy));
+
+    // Each thread goes to the least used cpu, so two devices sharing a set
+    // fill it evenly before doubling up
+    CpuPlacement placement;
+    std::vector<uint32_t> taken;
+
+    for (int i = 0; i < 6; i++) {
+        taken.push_back(placement.acquire({2, 3, 4}));
+    }
+
+    REQUIRE(placement.users(2) == 2U);
+    REQUIRE(placement.users(3) == 2U);
+    REQUIRE(placement.users(4) == 2U);
+
+    placement.release(3);
+    REQUIRE(placement.acquire({2, 3, 4}) == 3U);
+
+    for (const uint32_t cpu : taken) {
+        placement.release(cpu);
+    }
+
+    REQUIRE(placement.users(2) == 0U);
+    REQUIRE(placement.users(3) == 0U);
+}
+
+TEST_CASE("Device threads are placed on their cpus", "[cpus]"){
+    SimFrontendConfig config;
+    config.queues = 2U;
+    config.backendKeys["max-queues"] = "2";
+    config.backendKeys["workers"] = "2";
+    config.backendKeys["cpus"] = "0";
+
+    auto placement = backend.cpuPlacement();
+    const uint32_t users = placement->users(0);
+
+    SimFrontend fe(backend, 12, 51712, IMAGE, config);
+    fe.connect();
+
+    // A ring thread per queue and the workers
+    REQUIRE(placement->users(0) == users + 4U);
+
+    for (uint32_t queue = 0U; queue < 2U; queue++) {
+        std::vector<blkif_response_t> rsps;
+
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, queue, 0, queue, 1, queue));
+        fe.push(queue);
+        REQUIRE(fe.reap(rsps, 1U, 5000, queue) == 1U);
+        REQUIRE(rsps[0].status == BLKIF_RSP_OKAY);
+    }
+
+    // Handed back on disconnect
+    fe.disconnect();
+    REQUIRE(placement->users(0) == users);
+
+    // Under the shared policy threads may use any of the cpus, and none is
+    // counted against them
+    config.backendKeys["cpu-policy"] = "shared";
+
+    SimFrontend shared(backend, 13, 51712, IMAGE, config);
+    shared.connect();
+    REQUIRE(placement->users(0) == users);
+    REQUIRE(shared.queueReadWrite(BLKIF_OP_READ, 1, 0, 0, 1));
+    REQUIRE(submitOne(shared).status == BLKIF_RSP_OKAY);
+}
+
+TEST_CASE("Devices can be kept on a NUMA node", "[numa]"){
+    int32_t node;
+
+    REQUIRE(parseNumaNode("auto", node));
+    REQUIRE(node == NUMA_NODE_AUTO);
+    REQUIRE(parseNumaNode("1", node));
+    REQUIRE(node == 1);
+    REQUIRE_FALSE(parseNumaNode("-1", node));
+
+    // Every Linux host has a node 0, even without NUMA
+    std::vector<uint32_t> cpus;
+    REQUIRE(numaNodeCpus(0, cpus));
+    REQUIRE_FALSE(cpus.empty());
+    REQUIRE_FALSE(numaNodeCpus(1023, cpus));
+
+    int value = 0;
+    REQUIRE(numaNodeOfAddress(&value) == 0);
+    REQUIRE(currentNumaNode() == 0);
+
+    // A scoped node puts back the policy from before it, however the scope
+    // is left
+    REQUIRE(threadMemoryNode() == NUMA_NODE_NONE);
+
+    {
+        const ScopedMemoryNode outer(0);
+        REQUIRE(threadMemoryNode() == 0);
+
+        {
+            const ScopedMemoryNode none(NUMA_NODE_NONE);
+            REQUIRE(threadMemoryNode() == 0);
+        }
+
+        try {
+            const ScopedMemoryNode inner(0);
+            throw std::runtime_error("leaving");
+        } catch (const std::runtime_error &) {
+        }
+
+        REQUIRE(threadMemoryNode() == 0);
+    }
+
+    REQUIRE(threadMemoryNode() == NUMA_NODE_NONE);
+}
+
+TEST_CASE("Devices on a NUMA node are served", "[numa]"){
+    // The node given, with the domain's memory elsewhere so its I/O is
+    // counted as remote, or the domain's own node
+    for (const char *setting : {"0", "auto"}) {
+        SimXen::setNodeAffinity(14, {setting[0] == '0' ? 1U : 0U});
+
+        SimFrontendConfig config;
+        config.queues = 2U;
+        config.backendKeys["max-queues"] = "2";
+        config.backendKeys["workers"] = "2";
+        config.backendKeys["numa-node"] = setting;
+
+        SimFrontend fe(backend, 14, 51712, IMAGE, config);
+        fe.connect();
+
+        for (uint32_t queue = 0U; queue < 2U; queue++) {
+            std::vector<blkif_response_t> rsps;
+            const uint64_t sector = 7168 + queue * PAGE_SECTORS;
+
+            fillPages(fe, queue * 2U, 1, 0x90);
+            REQUIRE(fe.queueReadWrite(BLKIF_OP_WRITE, 1, sector, queue * 2U, 1, queue));
+            fe.push(queue);
+            REQUIRE(fe.reap(rsps, 1U, 5000, queue) == 1U);
+
+            REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, 2, sector, queue * 2U + 1U, 1, queue));
+            fe.push(queue);
+            REQUIRE(fe.reap(rsps, 2U, 5000, queue) == 1U);
+            REQUIRE(rsps[0].status == BLKIF_RSP_OKAY);
+            REQUIRE(rsps[1].status == BLKIF_RSP_OKAY);
+        }
+
+        REQUIRE(samePages(fe, 0, 1, 1));
+        REQUIRE(samePages(fe, 2, 3, 1));
+    }
+
+    SimXen::setNodeAffinity(14, {});
+}
+
+TEST_CASE("Hundreds of devices share one backend", "[scale]"){
+    static constexpr uint32_t DEVICES = 300U;
+    SimFrontendConfig config;
+    config.dataPages = 8U;
+    config.indirectPages = 1U;
+
+    std::vector<std::unique_ptr<SimFrontend>> frontends;
+
+    for (uint32_t i = 0U; i < DEVICES; i++) {
+        frontends.emplace_back(new SimFrontend(backend, domid_t(100 + i), 51712,
+                                               IMAGE, config));
+        frontends.back()->connect();
+    }
+
+    // Past 8192 / 32 devices each is down to the smallest share
+    REQUIRE(backend.grantBudget()->devices() == DEVICES);
+    REQUIRE(backend.grantBudget()->share() == 32U);
+
+    for (uint32_t i = 0U; i < DEVICES; i++) {
+        SimFrontend &fe = *frontends[i];
+        const uint64_t sector = (i % 64U) * 2U * PAGE_SECTORS;
+
+        fillPages(fe, 0, 2, uint8_t(i));
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_WRITE, 1, sector, 0, 2));
+        REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, 2, sector, 2, 2));
+        REQUIRE(submitOne(fe).status == BLKIF_RSP_OKAY);
+        REQUIRE(samePages(fe, 0, 2, 2));
+    }
+
+    frontends.resize(4);
+    REQUIRE(backend.grantBudget()->devices() == 4U);
+    REQUIRE(backend.grantBudget()->share() == 1024U);
+
+    frontends.clear();
+    REQUIRE(backend.grantBudget()->devices() == 0U);
+}
+
+static size_t threadCount()
+{
+    DIR *dir = opendir("/proc/self/task");
+    size_t count = 0U;
+
+    while (struct dirent *entry = readdir(dir)) {
+        count += entry->d_name[0] != '.';
+    }
+
+    closedir(dir);
+
+    return count;
+}
+
+TEST_CASE("Rings can share reactor threads", "[reactor]"){
+    BlkDeviceConfig defaults;
+    defaults.reactorThreads = 2U;
+    defaults.cpus = {0};
+
+    const size_t threads = threadCount();
+    auto shared = std::make_shared<BlkBackend>(false, defaults);
+    auto placement = shared->cpuPlacement();
+    SimFrontendConfig config;
+    config.dataPages = 8U;
+    config.queues = 2U;
+
+    std::vector<std::unique_ptr<SimFrontend>> frontends;
+
+    for (uint32_t i = 0U; i < 16U; i++) {
+        frontends.emplace_back(new SimFrontend(*shared, domid_t(500 + i), 51712,
+                                               IMAGE, config));
+        frontends.back()->connect();
+    }
+
+    // 32 rings on 2 threads
+    REQUIRE(threadCount() == threads + 2U);
+
+    for (int pass = 0; pass < 3; pass++) {
+        for (auto &fe : frontends) {
+            for (uint32_t queue = 0U; queue < fe->queues(); queue++) {
+                std::vector<blkif_response_t> rsps;
+
+                REQUIRE(fe->queueReadWrite(BLKIF_OP_READ, pass, 0, queue * 4U, 2, queue));
+                fe->push(queue);
+                REQUIRE(fe->reap(rsps, 1U, 1000, queue) == 1U);
+                REQUIRE(rsps[0].status == BLKIF_RSP_OKAY);
+            }
+        }
+    }
+
+    // A reconnect takes the rings off the reactor and puts new ones on
+    frontends[0]->disconnect();
+    frontends[0]->connect();
+    REQUIRE(frontends[0]->queueReadWrite(BLKIF_OP_READ, 9, 0, 0, 1));
+    REQUIRE(submitOne(*frontends[0]).status == BLKIF_RSP_OKAY);
+
+    frontends.clear();
+    shared->stop();
+
+    // Both reactor threads are on cpu 0 until the backend goes
+    REQUIRE(placement->users(0) == 2U);
+    shared.reset();
+    REQUIRE(placement->users(0) == 0U);
+}
+
+TEST_CASE("Rings on a reactor thread take turns", "[reactor]"){
+    BlkDeviceConfig defaults;
+    defaults.reactorThreads = 1U;
+    defaults.reactorQuantum = 1U;
+
+    BlkBackend shared(false, defaults);
+    SimFrontend heavy(shared, 530, 51712, IMAGE);
+    SimFrontend light(shared, 531, 51712, IMAGE);
+    std::vector<blkif_response_t> rsps;
+
+    heavy.connect();
+    light.connect();
+
+    // One kick for the lot: the ring comes back for the rest of them a
+    // request at a time without the frontend kicking again
+    for (uint32_t i = 0U; i < 24U; i++) {
+        REQUIRE(heavy.queueReadWrite(BLKIF_OP_READ, i, i * PAGE_SECTORS, i % 8U, 1));
+    }
+
+    heavy.push();
+
+    REQUIRE(light.queueReadWrite(BLKIF_OP_READ, 100, 0, 0, 1));
+    REQUIRE(submitOne(light).status == BLKIF_RSP_OKAY);
+
+    REQUIRE(heavy.reap(rsps, 24U) == 24U);
+
+    for (const auto &rsp : rsps) {
+        REQUIRE(rsp.status == BLKIF_RSP_OKAY);
+    }
+
+    heavy.disconnect();
+    light.disconnect();
+    shared.stop();
+}
+
+TEST_CASE("In-flight limits nest and wake their waiters", "[inflight]"){
+    auto total = std::make_shared<InFlightLimit>(3);
+    InFlightLimit a(2, total);
+    InFlightLimit b(0, total);
+    uint32_t wokenA = 0U;
+    uint32_t wokenB = 0U;
+    const InFlightLimit::Waiter waiterA = [&wokenA] { wokenA++; };
+    const InFlightLimit::Waiter waiterB = [&wokenB] { wokenB++; };
+
+    REQUIRE(a.acquire(&waiterA));
+    REQUIRE(a.acquire(&waiterA));
+    REQUIRE_FALSE(a.acquire(&waiterA));
+    REQUIRE(b.acquire(&waiterB));
+    REQUIRE_FALSE(b.acquire(&waiterB));
+    REQUIRE(total->inFlight() == 3U);
+    REQUIRE(b.inFlight() == 1U);
+
+    // Each waits on the limit that was full
+    a.release();
+    REQUIRE(wokenA == 1U);
+    REQUIRE(wokenB == 1U);
+    REQUIRE(total->inFlight() == 2U);
+
+    REQUIRE(b.acquire(&waiterB));
+    REQUIRE_FALSE(a.acquire(&waiterA));
+    a.cancel(&waiterA);
+    b.release();
+    REQUIRE(wokenA == 1U);
+}
+
+TEST_CASE("Requests over the in-flight limits stay on the ring", "[inflight]"){
+    BlkDeviceConfig defaults;
+    defaults.maxInFlightTotal = 3U;
+    defaults.workers = 2U;
+
+    BlkBackend limited(false, defaults);
+    SimFrontendConfig config;
+    config.dataPages = 32U;
+    config.backendKeys["max-in-flight"] = "2";
+
+    std::vector<std::unique_ptr<SimFrontend>> frontends;
+
+    for (uint32_t i = 0U; i < 4U; i++) {
+        frontends.emplace_back(new SimFrontend(limited, domid_t(600 + i), 51712,
+                                               IMAGE, config));
+        frontends.back()->connect();
+    }
+
+    // Every device fills its ring at once; all of it gets done, a few
+    // requests at a time
+    for (auto &fe : frontends) {
+        for (uint32_t i = 0U; i < fe->ringSize(); i++) {
+            REQUIRE(fe->queueReadWrite(BLKIF_OP_READ, i, i * PAGE_SECTORS, i % 32U, 1));
+        }
+
+        fe->push();
+    }
+
+    for (auto &fe : frontends) {
+        std::vector<blkif_response_t> rsps;
+
+        REQUIRE(fe->reap(rsps, fe->ringSize()) == fe->ringSize());
+
+        for (const auto &rsp : rsps) {
+            REQUIRE(rsp.status == BLKIF_RSP_OKAY);
+        }
+    }
+
+    frontends.clear();
+    limited.stop();
+}
+
+TEST_CASE("A full ring survives a reconnect", "[reconnect]"){
+    SimFrontendConfig config;
+    config.backendKeys["grant-warmup"] = "1";
+
+    SimFrontend fe(backend, 4, 51712, IMAGE, config);
+    std::vector<blkif_response_t> rsps;
+
+    fe.connect();
+    fe.disconnect();
+    fe.connect();
+
+    const unsigned int slots = fe.ringSize();
+    for (unsigned int i = 0U; i < slots; i++) {
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, i, i * PAGE_SECTORS, i, 1));
+    }
+
+    REQUIRE_FALSE(fe.queueFlush(slots));
+
+    fe.push();
+    REQUIRE(fe.reap(rsps, slots) == slots);
+
+    for (const auto &rsp : rsps) {
+        REQUIRE(rsp.status == BLKIF_RSP_OKAY);
+    }
+
+    // The grants resident at disconnect are mapped again by the time the
+    // device reconnects, so the same I/O maps nothing new
+    fe.disconnect();
+    fe.connect();
+
+    const uint64_t maps = SimXen::stats().grantMaps;
+
+    rsps.clear();
+    for (unsigned int i = 0U; i < slots; i++) {
+        REQUIRE(fe.queueReadWrite(BLKIF_OP_READ, i, i * PAGE_SECTORS, i, 1));
+    }
+
+    fe.push();
+    REQUIRE(fe.reap(rsps, slots) == slots);
+    REQUIRE(SimXen::stats().grantMaps == maps);
+}
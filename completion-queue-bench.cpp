@@ -0,0 +1,248 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+
+//
+// Measures handing completions from worker threads to a ring's thread:
+// producers push numbered items that one consumer drains in batches, once
+// through MpscQueue and once through a mutex guarded vector swapped out by
+// the consumer, as BlkCmdRingBuffer used to. Each run checks that every
+// item arrives once and in order per producer.
+//
+
+#include "MpscQueue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+static constexpr uint32_t PRODUCER_SHIFT = 24U;
+
+struct BenchResult {
+    double seconds{0.0};
+    uint64_t batches{0};
+    bool ok{true};
+};
+
+// Keeps the last item seen from each producer, items being the producer
+// index in the top bits and a sequence number below
+class OrderCheck
+{
+public:
+    explicit OrderCheck(uint32_t producers) : mNext(producers, 0U) { }
+
+    void seen(uint32_t item)
+    {
+        const uint32_t producer = item >> PRODUCER_SHIFT;
+        const uint32_t sequence = item & ((1U << PRODUCER_SHIFT) - 1U);
+
+        if (producer >= mNext.size() || mNext[producer] != sequence) {
+            mOk = false;
+            return;
+        }
+
+        mNext[producer]++;
+    }
+
+    bool ok(uint32_t items) const
+    {
+        for (const uint32_t next : mNext) {
+            if (next != items) {
+                return false;
+            }
+        }
+
+        return mOk;
+    }
+
+private:
+    std::vector<uint32_t> mNext;
+    bool mOk{true};
+};
+
+template <typename Push, typename Drain>
+static BenchResult run(uint32_t producers, uint32_t items, Push push, Drain drain)
+{
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    OrderCheck check(producers);
+    BenchResult result;
+
+    for (uint32_t p = 0U; p < producers; p++) {
+        threads.emplace_back([&go, &push, p, items] {
+            while (!go) {
+                std::this_thread::yield();
+            }
+
+            for (uint32_t i = 0U; i < items; i++) {
+                push((p << PRODUCER_SHIFT) | i);
+            }
+        });
+    }
+
+    const uint64_t total = uint64_t(producers) * items;
+    uint64_t received = 0U;
+    const auto start = bench_clock::now();
+
+    go = true;
+
+    while (received < total) {
+        const size_t count = drain([&check](uint32_t item) { check.seen(item); });
+
+        if (count == 0U) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        received += count;
+        result.batches++;
+    }
+
+    result.seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    result.ok = check.ok(items);
+
+    return result;
+}
+
+static void report(const char *name, const BenchResult &result, uint64_t total)
+{
+    std::cout << "  " << std::left << std::setw(8) << name << std::right
+              << std::fixed << std::setprecision(2)
+              << std::setw(10) << total / result.seconds / 1e6 << " M items/s"
+              << std::setw(10) << double(total) / result.batches << " per batch"
+              << (result.ok ? "" : "  LOST OR REORDERED") << '\n';
+}
+
+static void usage()
+{
+    std::cout << "completion-queue-bench [options]\n"
+              << "  -p <threads>  producers, like workers (4)\n"
+              << "  -n <items>    items per producer (1000000)\n"
+              << "  -c <items>    queue capacity, like ring slots (256)\n";
+}
+
+int main(int argc, const char **argv)
+{
+    uint32_t producers = 4U;
+    uint32_t items = 1000000U;
+    uint32_t capacity = 256U;
+
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+
+        if (!strcmp(argv[i], "-p") && hasValue) {
+            producers = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-n") && hasValue) {
+            items = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-c") && hasValue) {
+            capacity = strtoul(argv[++i], nullptr, 0);
+        } else {
+            usage();
+            return -1;
+        }
+    }
+
+    if (producers == 0U || producers > 255U || items == 0U ||
+        items >= (1U << PRODUCER_SHIFT) || capacity == 0U) {
+        usage();
+        return -1;
+    }
+
+    const uint64_t total = uint64_t(producers) * items;
+    bool ok = true;
+
+    std::cout << producers << " producers, " << items << " items each, "
+              << "capacity " << capacity << '\n';
+
+    {
+        MpscQueue<uint32_t> queue(capacity);
+
+        const auto result = run(producers, items,
+            [&queue](uint32_t item) {
+                while (!queue.push(item)) {
+                    std::this_thread::yield();
+                }
+            },
+            [&queue](const std::function<void(uint32_t)> &fn) {
+                return queue.drain(fn);
+            });
+
+        report("mpsc", result, total);
+        ok = ok && result.ok;
+    }
+
+    {
+        std::mutex mutex;
+        std::vector<uint32_t> pending;
+        std::vector<uint32_t> batch;
+
+        const auto result = run(producers, items,
+            [&mutex, &pending, capacity](uint32_t item) {
+                // Bounded like the queue, as completions are by the ring
+                while (true) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+
+                        if (pending.size() < capacity) {
+                            pending.push_back(item);
+                            return;
+                        }
+                    }
+
+                    std::this_thread::yield();
+                }
+            },
+            [&mutex, &pending, &batch](const std::function<void(uint32_t)> &fn) {
+                batch.clear();
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    batch.swap(pending);
+                }
+
+                for (const uint32_t item : batch) {
+                    fn(item);
+                }
+
+                return batch.size();
+            });
+
+        report("mutex", result, total);
+        ok = ok && result.ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -60,6 +60,26 @@ TEST_CASE("Test Write Sector","[readSector]"){
     }
 }
 
+TEST_CASE("Vectored Read/Write covers adjacent sectors","[sectorsv]"){
+    std::vector<uint8_t> a(1024, 0x11);
+    std::vector<uint8_t> b(512, 0x22);
+    const DiskIoVec out[] = {{a.data(), 2}, {b.data(), 1}};
+
+    REQUIRE(di.writeSectorsv(100, out, 2) == 0);
+
+    std::vector<uint8_t> in(1536, 0x00);
+    const DiskIoVec one[] = {{in.data(), 3}};
+
+    REQUIRE(di.readSectorsv(100, one, 1) == 0);
+    REQUIRE(in[1023] == 0x11);
+    REQUIRE(in[1024] == 0x22);
+    REQUIRE(in[1535] == 0x22);
+
+    // The whole operation is checked against the end of the image
+    REQUIRE(di.writeSectorsv(1022, out, 2) == -1);
+    REQUIRE(di.readSectorsv(1021, out, 2) == 0);
+}
+
 TEST_CASE("Sector Read/Write is Bounded Correctly", "[writeSector]"){
     SECTION("Sector Write Bounding"){
         std::vector<char> buf1(512,0xAA);
@@ -0,0 +1,455 @@
+#include "GrantCache.hpp"
+#include "GrantTrace.hpp"
+#include <map>
+#include <set>
+#define CATCH_CONFIG_MAIN
+#include "include/catch.hpp"
+
+static const GrantCachePolicyType ALL_POLICIES[] = {
+    GrantCachePolicyType::LRU,
+    GrantCachePolicyType::CLOCK,
+    GrantCachePolicyType::TWO_Q,
+    GrantCachePolicyType::ARC,
+    GrantCachePolicyType::LFU,
+};
+
+// Tracks what is mapped so the tests can check the cache never leaks or
+// double-unmaps a grant
+class TestGrantCache final : public GrantCache {
+public:
+    using GrantCache::GrantCache;
+    ~TestGrantCache() { this->clear(); }
+
+    std::set<grant_ref_t> mapped;
+    uint64_t badUnmaps{0};
+
+    // Batches are mapped only when set, and failed when failBatches is
+    bool batches{false};
+    bool failBatches{false};
+    std::map<void *, std::vector<grant_ref_t>> batchMaps;
+
+private:
+    void *map(grant_ref_t gref) override
+    {
+        mapped.insert(gref);
+        return reinterpret_cast<void *>(uintptr_t(gref) + 1U);
+    }
+
+    void unmap(grant_ref_t gref, void *addr) override
+    {
+        if (!mapped.erase(gref) || addr != reinterpret_cast<void *>(uintptr_t(gref) + 1U)) {
+            badUnmaps++;
+        }
+    }
+
+    void *mapBatch(const grant_ref_t *grefs, uint32_t count, void **addrs) override
+    {
+        if (!batches || failBatches) {
+            return nullptr;
+        }
+
+        void *batch = reinterpret_cast<void *>(uintptr_t(grefs[0]) + 0x100000U);
+
+        for (uint32_t i = 0U; i < count; i++) {
+            mapped.insert(grefs[i]);
+            addrs[i] = reinterpret_cast<void *>(uintptr_t(grefs[i]) + 1U);
+        }
+
+        batchMaps[batch].assign(grefs, grefs + count);
+
+        return batch;
+    }
+
+    void unmapBatch(void *batch, uint32_t count) override
+    {
+        auto itr = batchMaps.find(batch);
+
+        if (itr == batchMaps.end() || itr->second.size() != count) {
+            badUnmaps++;
+            return;
+        }
+
+        for (const grant_ref_t gref : itr->second) {
+            mapped.erase(gref);
+        }
+
+        batchMaps.erase(itr);
+    }
+};
+
+TEST_CASE("Policy names round trip", "[policy]"){
+    for (auto type : ALL_POLICIES) {
+        GrantCachePolicyType parsed;
+        REQUIRE(parseGrantCachePolicy(grantCachePolicyName(type), parsed));
+        REQUIRE(parsed == type);
+    }
+
+    GrantCachePolicyType parsed;
+    REQUIRE_FALSE(parseGrantCachePolicy("mru", parsed));
+}
+
+TEST_CASE("Every policy stays within capacity", "[policy]"){
+    for (auto type : ALL_POLICIES) {
+        TestGrantCache cache(type, 64, 4);
+        uint64_t seed = 1;
+
+        for (int i = 0; i < 10000; i++) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            const grant_ref_t gref = 8 + (seed >> 33) % 200;
+
+            REQUIRE(cache.get(gref) == reinterpret_cast<void *>(uintptr_t(gref) + 1U));
+            REQUIRE(cache.size() <= 64);
+            REQUIRE(cache.size() == cache.mapped.size());
+        }
+
+        const auto &stats = cache.stats();
+        REQUIRE(stats.hits + stats.misses == 10000);
+        REQUIRE(stats.misses - stats.evictions == cache.size());
+        REQUIRE(cache.badUnmaps == 0);
+
+        cache.clear();
+        REQUIRE(cache.mapped.empty());
+    }
+}
+
+TEST_CASE("A working set that fits only misses once", "[policy]"){
+    for (auto type : ALL_POLICIES) {
+        TestGrantCache cache(type, 64, 4);
+
+        for (int pass = 0; pass < 10; pass++) {
+            for (grant_ref_t gref = 8; gref < 8 + 64; gref++) {
+                cache.get(gref);
+            }
+        }
+
+        REQUIRE(cache.stats().misses == 64);
+        REQUIRE(cache.stats().evictions == 0);
+    }
+}
+
+static const int SCAN_LENGTH = 60;
+
+static uint64_t scanMisses(GrantCachePolicyType type)
+{
+    TestGrantCache cache(type, 64, 1);
+    grant_ref_t scan = 1000;
+
+    // Establish a hot set, then interleave it with scans that push it past
+    // the LRU end of the cache but stay within the 2Q ghost queue
+    for (int pass = 0; pass < 4; pass++) {
+        for (grant_ref_t gref = 8; gref < 8 + 16; gref++) {
+            cache.get(gref);
+        }
+    }
+
+    const uint64_t before = cache.stats().misses;
+
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < SCAN_LENGTH; i++) {
+            cache.get(scan++);
+        }
+
+        for (grant_ref_t gref = 8; gref < 8 + 16; gref++) {
+            cache.get(gref);
+        }
+    }
+
+    return cache.stats().misses - before;
+}
+
+TEST_CASE("Scan resistant policies keep the hot set", "[policy]"){
+    // LRU loses the whole hot set to every scan
+    REQUIRE(scanMisses(GrantCachePolicyType::LRU) == 20 * (SCAN_LENGTH + 16));
+    REQUIRE(scanMisses(GrantCachePolicyType::CLOCK) ==
+            20 * (SCAN_LENGTH + 16));
+
+    // ARC and LFU keep it, 2Q keeps it once it has been promoted to Am
+    REQUIRE(scanMisses(GrantCachePolicyType::ARC) == 20 * SCAN_LENGTH);
+    REQUIRE(scanMisses(GrantCachePolicyType::LFU) == 20 * SCAN_LENGTH);
+    REQUIRE(scanMisses(GrantCachePolicyType::TWO_Q) <= 20 * SCAN_LENGTH + 16);
+}
+
+TEST_CASE("Resizing evicts down to the new capacity", "[resize]"){
+    for (auto type : ALL_POLICIES) {
+        TestGrantCache cache(type, 64, 4);
+
+        for (grant_ref_t gref = 8; gref < 8 + 64; gref++) {
+            cache.get(gref);
+        }
+
+        cache.resize(16, 1);
+        REQUIRE(cache.size() == 16);
+        REQUIRE(cache.mapped.size() == 16);
+
+        for (grant_ref_t gref = 100; gref < 200; gref++) {
+            cache.get(gref);
+            REQUIRE(cache.size() <= 16);
+        }
+
+        // Growing keeps what is there and makes room for more
+        cache.resize(32, 1);
+        for (grant_ref_t gref = 300; gref < 316; gref++) {
+            cache.get(gref);
+        }
+
+        REQUIRE(cache.size() == 32);
+        REQUIRE(cache.badUnmaps == 0);
+    }
+
+    GrantBudget budget(1000, 300, 50);
+
+    REQUIRE(budget.share() == 300);
+    budget.join();
+    budget.join();
+    budget.join();
+    budget.join();
+    REQUIRE(budget.share() == 250);
+
+    const uint64_t generation = budget.generation();
+    for (int i = 0; i < 30; i++) {
+        budget.join();
+    }
+
+    REQUIRE(budget.share() == 50);
+    REQUIRE(budget.generation() == generation + 30);
+
+    // A device with four shares gets four times as many grants, and counts
+    // as four devices towards everyone's share
+    GrantBudget weighted(1000, 300, 50);
+
+    weighted.join(4);
+    weighted.join();
+    REQUIRE(weighted.devices() == 2);
+    REQUIRE(weighted.share() == 200);
+    REQUIRE(weighted.share(4) == 800);
+
+    weighted.leave(4);
+    REQUIRE(weighted.share() == 300);
+
+    // Floors beyond the total are reported, but the device still joins
+    GrantBudget floored(1000, 300, 50);
+
+    REQUIRE(floored.join(1, 128));
+    REQUIRE(floored.join(4, 128));
+    REQUIRE(floored.floor() == 328);
+    REQUIRE_FALSE(floored.join(1, 800));
+    REQUIRE(floored.devices() == 3);
+
+    floored.leave(1, 800);
+    REQUIRE(floored.floor() == 328);
+    REQUIRE(floored.join());
+}
+
+TEST_CASE("Warming maps up to capacity ahead of use", "[warm]"){
+    TestGrantCache cache(GrantCachePolicyType::LRU, 8, 1);
+    std::vector<grant_ref_t> grefs;
+
+    REQUIRE(cache.get(8) != nullptr);
+
+    for (grant_ref_t gref = 8; gref < 8 + 12; gref++) {
+        grefs.push_back(gref);
+    }
+
+    // 8 is already resident, so 7 more fit
+    REQUIRE(cache.warm(grefs) == 7);
+    REQUIRE(cache.size() == 8);
+    REQUIRE(cache.stats().warmed == 7);
+
+    for (grant_ref_t gref = 8; gref < 8 + 8; gref++) {
+        REQUIRE(cache.get(gref) != nullptr);
+    }
+
+    REQUIRE(cache.stats().misses == 1);
+    REQUIRE(cache.resident().size() == 8);
+
+    GrantRetention retention;
+    retention.save(1, 51712, {RetainedGrants{cache.resident(), {}}});
+
+    const auto queues = retention.take(1, 51712);
+    REQUIRE(queues.size() == 1);
+    REQUIRE(queues[0].data.size() == 8);
+    REQUIRE(retention.take(1, 51712).empty());
+}
+
+TEST_CASE("Warming maps a batch at once", "[warm]"){
+    TestGrantCache cache(GrantCachePolicyType::LRU, 8, 1);
+    std::vector<grant_ref_t> grefs;
+
+    cache.batches = true;
+
+    for (grant_ref_t gref = 8; gref < 8 + 6; gref++) {
+        grefs.push_back(gref);
+    }
+
+    REQUIRE(cache.warm(grefs) == 6);
+    REQUIRE(cache.batchMaps.size() == 1);
+    REQUIRE(cache.get(10) == reinterpret_cast<void *>(uintptr_t(10) + 1U));
+    REQUIRE(cache.stats().misses == 0);
+
+    // Evicting some of the batch keeps it mapped, evicting all of it
+    // unmaps it in one go
+    for (grant_ref_t gref = 100; gref < 100 + 5; gref++) {
+        cache.get(gref);
+    }
+
+    REQUIRE(cache.batchMaps.size() == 1);
+
+    for (grant_ref_t gref = 200; gref < 200 + 8; gref++) {
+        cache.get(gref);
+    }
+
+    REQUIRE(cache.batchMaps.empty());
+    REQUIRE(cache.mapped.size() == 8);
+
+    // A batch that fails to map falls back to one gref at a time
+    cache.failBatches = true;
+    cache.clear();
+
+    REQUIRE(cache.warm(grefs) == 6);
+    REQUIRE(cache.batchMaps.empty());
+    REQUIRE(cache.mapped.size() == 6);
+
+    cache.clear();
+    REQUIRE(cache.mapped.empty());
+    REQUIRE(cache.badUnmaps == 0);
+}
+
+TEST_CASE("Grants of destroyed domains are forgotten", "[warm]"){
+    GrantRetention retention;
+
+    retention.save(1, 51712, {RetainedGrants{{8, 9}, {}}});
+    retention.save(2, 51712, {RetainedGrants{{10}, {}}});
+    retention.save(2, 51728, {RetainedGrants{{11}, {}}});
+
+    retention.prune([](uint16_t domId) { return domId != 2; });
+
+    REQUIRE(retention.take(2, 51712).empty());
+    REQUIRE(retention.take(2, 51728).empty());
+    REQUIRE(retention.take(1, 51712).size() == 1);
+}
+
+TEST_CASE("Pinned grants outlive their eviction", "[pin]"){
+    TestGrantCache cache(GrantCachePolicyType::LRU, 4, 1);
+
+    cache.get(8);
+    cache.pin(8);
+    cache.pin(8);
+
+    // 8 is least recently used, so it goes first but stays mapped
+    for (grant_ref_t gref = 9; gref < 9 + 4; gref++) {
+        cache.get(gref);
+    }
+
+    REQUIRE(cache.size() == 4);
+    REQUIRE(cache.mapped.count(8) == 1);
+
+    cache.unpin(8);
+    REQUIRE(cache.mapped.count(8) == 1);
+
+    cache.unpin(8);
+    REQUIRE(cache.mapped.count(8) == 0);
+    REQUIRE(cache.mapped.size() == 4);
+    REQUIRE(cache.badUnmaps == 0);
+
+    // Unpinning a resident grant leaves it mapped
+    cache.pin(12);
+    cache.unpin(12);
+    REQUIRE(cache.mapped.count(12) == 1);
+}
+
+class TestLinearMapCache final : public LinearMapCache
+{
+public:
+    using LinearMapCache::LinearMapCache;
+    ~TestLinearMapCache() { this->clear(); }
+
+    uint64_t mappedPages{0};
+    uint64_t maps{0};
+
+private:
+    void *map(const grant_ref_t *grefs, uint32_t count) override
+    {
+        (void)grefs;
+        mappedPages += count;
+        maps++;
+        return reinterpret_cast<void *>(uintptr_t(maps) << 20);
+    }
+
+    void unmap(void *, uint32_t count) override
+    {
+        mappedPages -= count;
+    }
+};
+
+TEST_CASE("Linear maps are reused and bounded in pages", "[linear]"){
+    TestLinearMapCache cache(16);
+    const grant_ref_t a[] = {8, 9, 10, 11};
+    const grant_ref_t b[] = {8, 9, 10, 12};
+    const grant_ref_t big[17] = {};
+
+    REQUIRE(cache.get(a, 4) != nullptr);
+    REQUIRE(cache.get(a, 4) != nullptr);
+    REQUIRE(cache.get(b, 4) != nullptr);
+    REQUIRE(cache.maps == 2);
+    REQUIRE(cache.stats().hits == 1);
+    REQUIRE(cache.pages() == 8);
+
+    // A sequence larger than the cache is never mapped
+    REQUIRE(cache.get(big, 17) == nullptr);
+    REQUIRE(cache.maps == 2);
+
+    // Filling the cache pushes out the least recently used sequence
+    for (grant_ref_t first = 100; first < 103; first++) {
+        const grant_ref_t seq[] = {first, first + 10, first + 20, first + 30};
+        REQUIRE(cache.get(seq, 4) != nullptr);
+        REQUIRE(cache.pages() <= 16);
+    }
+
+    REQUIRE(cache.mappedPages == cache.pages());
+    REQUIRE(cache.get(b, 4) != nullptr);
+    REQUIRE(cache.maps == 5);
+    REQUIRE(cache.get(a, 4) != nullptr);
+    REQUIRE(cache.maps == 6);
+
+    // A pinned sequence stays mapped when pushed out
+    void *pinned = cache.get(a, 4);
+    cache.pin(pinned);
+
+    for (grant_ref_t first = 200; first < 204; first++) {
+        const grant_ref_t seq[] = {first, first + 10, first + 20, first + 30};
+        REQUIRE(cache.get(seq, 4) != nullptr);
+    }
+
+    REQUIRE(cache.mappedPages == cache.pages() + 4);
+    cache.unpin(pinned);
+    REQUIRE(cache.mappedPages == cache.pages());
+
+    cache.clear();
+    REQUIRE(cache.mappedPages == 0);
+}
+
+TEST_CASE("Grant traces round trip", "[trace]"){
+    const grant_ref_t grefs[] = {8, 9, 10, 4000000000U, 8, 12345, 12344, 0};
+
+    {
+        GrantTraceWriter writer("./grant-test.trace", 7, 51712);
+        REQUIRE(writer.good());
+
+        for (size_t i = 0; i < sizeof(grefs) / sizeof(grefs[0]); i++) {
+            writer.record(grefs[i], (i % 3) == 0);
+        }
+    }
+
+    GrantTraceHeader header;
+    std::vector<GrantTraceRecord> records;
+
+    REQUIRE(readGrantTrace("./grant-test.trace", header, records));
+    REQUIRE(header.domId == 7);
+    REQUIRE(header.devId == 51712);
+    REQUIRE(records.size() == sizeof(grefs) / sizeof(grefs[0]));
+
+    for (size_t i = 0; i < records.size(); i++) {
+        REQUIRE(records[i].gref == grefs[i]);
+        REQUIRE(records[i].indirect == ((i % 3) == 0));
+    }
+}
@@ -0,0 +1,198 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+//
+// Replays grant traces recorded by the backend (--grant-trace-dir or the
+// grant-trace xenstore key) against each grant cache policy and reports how
+// many grants each would have had to map. Like the backend, indirect
+// descriptor pages go to a separate LRU cache, reported on its own line.
+//
+
+#include "GrantCache.hpp"
+#include "GrantTrace.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unordered_set>
+#include <vector>
+
+// Matches the grant caches of a single queue device in the backend
+static constexpr uint64_t DEFAULT_CAPACITY = 960U;
+static constexpr uint64_t DEFAULT_INDIRECT_CAPACITY = 64U;
+static constexpr uint64_t DEFAULT_EVICTION_PCT = 5U;
+
+class ReplayGrantCache final : public GrantCache
+{
+public:
+    using GrantCache::GrantCache;
+
+    ~ReplayGrantCache()
+    {
+        this->clear();
+    }
+
+private:
+    void *map(grant_ref_t gref) override
+    {
+        return reinterpret_cast<void *>(uintptr_t(gref) + 1U);
+    }
+
+    void unmap(grant_ref_t, void *) override { }
+};
+
+static void usage()
+{
+    std::cout << "grant-trace-replay [options] <trace>...\n"
+              << "  -c <grants>      cache capacity (" << DEFAULT_CAPACITY << ")\n"
+              << "  -e <percent>     bulk eviction size (" << DEFAULT_EVICTION_PCT << ")\n"
+              << "  -p <policy,...>  policies to replay (lru,clock,2q,arc,lfu)\n"
+              << "  -i <grants>      indirect page cache capacity (" << DEFAULT_INDIRECT_CAPACITY << ")\n";
+}
+
+static bool parsePolicies(const std::string &list,
+                          std::vector<GrantCachePolicyType> &policies)
+{
+    std::istringstream stream(list);
+    std::string name;
+
+    policies.clear();
+
+    while (std::getline(stream, name, ',')) {
+        GrantCachePolicyType type;
+
+        if (!parseGrantCachePolicy(name, type)) {
+            std::cerr << "Unknown policy: " << name << '\n';
+            return false;
+        }
+
+        policies.push_back(type);
+    }
+
+    return !policies.empty();
+}
+
+static void replay(const std::string &path,
+                   const std::vector<GrantCachePolicyType> &policies,
+                   uint64_t capacity,
+                   uint64_t evictionSize,
+                   uint64_t indirectCapacity)
+{
+    GrantTraceHeader header;
+    std::vector<GrantTraceRecord> records;
+
+    if (!readGrantTrace(path, header, records)) {
+        std::cerr << path << ": not a grant trace\n";
+        return;
+    }
+
+    std::unordered_set<grant_ref_t> unique;
+    uint64_t accesses = 0U;
+    ReplayGrantCache indirect(GrantCachePolicyType::LRU, indirectCapacity, 1U);
+
+    for (const auto &record : records) {
+        if (record.indirect) {
+            indirect.get(record.gref);
+            continue;
+        }
+
+        unique.insert(record.gref);
+        accesses++;
+    }
+
+    std::cout << path << ": domain " << header.domId << ", device "
+              << header.devId << ", " << accesses << " accesses, "
+              << unique.size() << " distinct grants\n"
+              << "  policy   hit rate      maps    unmaps\n";
+
+    auto report = [](const char *name, const GrantCacheStats &stats) {
+        const uint64_t total = stats.hits + stats.misses;
+        const double rate = total ? 100.0 * stats.hits / total : 0.0;
+
+        std::cout << "  " << std::left << std::setw(6) << name
+                  << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(10) << rate << "%"
+                  << std::setw(10) << stats.misses
+                  << std::setw(10) << stats.evictions << '\n';
+    };
+
+    for (const auto type : policies) {
+        ReplayGrantCache cache(type, capacity, evictionSize);
+
+        for (const auto &record : records) {
+            if (!record.indirect) {
+                cache.get(record.gref);
+            }
+        }
+
+        report(grantCachePolicyName(type), cache.stats());
+    }
+
+    if (indirect.stats().hits + indirect.stats().misses != 0U) {
+        report("ind", indirect.stats());
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    std::vector<GrantCachePolicyType> policies;
+    uint64_t capacity = DEFAULT_CAPACITY;
+    uint64_t evictionPct = DEFAULT_EVICTION_PCT;
+    uint64_t indirectCapacity = DEFAULT_INDIRECT_CAPACITY;
+    int i = 1;
+
+    parsePolicies("lru,clock,2q,arc,lfu", policies);
+
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        const bool hasValue = i + 1 < argc;
+
+        if (!strcmp(argv[i], "-c") && hasValue) {
+            capacity = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-e") && hasValue) {
+            evictionPct = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-p") && hasValue) {
+            if (!parsePolicies(argv[++i], policies)) {
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "-i") && hasValue) {
+            indirectCapacity = strtoul(argv[++i], nullptr, 0);
+        } else {
+            usage();
+            return -1;
+        }
+    }
+
+    if (i == argc || capacity == 0U || indirectCapacity == 0U) {
+        usage();
+        return -1;
+    }
+
+    const uint64_t evictionSize = (capacity * evictionPct + 99U) / 100U;
+
+    for (; i < argc; i++) {
+        replay(argv[i], policies, capacity, evictionSize, indirectCapacity);
+    }
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ *  us-blkback entry point
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ */
+
+#include "BlkBackend.hpp"
+#include "Args.hpp"
+#include "Service.hpp"
+
+#include <csignal>
+#include <cxxopts.hpp>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+void waitSignals()
+{
+#ifndef _WIN32
+    sigset_t set;
+    int signal;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigprocmask(SIG_BLOCK, &set, nullptr);
+
+    sigwait(&set,&signal);
+#else
+    HANDLE h = CreateEvent(NULL, FALSE, FALSE, TEXT("STOPTHREAD"));
+    WaitForSingleObject(h, INFINITE);
+#endif
+}
+
+static inline int set_affinity(uint64_t core)
+{
+#ifdef _WIN32
+    if (SetProcessAffinityMask(GetCurrentProcess(), 1ULL << core) == 0) {
+        return -1;
+    }
+
+    return 0;
+#else
+    cpu_set_t  mask;
+
+    CPU_ZERO(&mask);
+    CPU_SET(core, &mask);
+
+    if (sched_setaffinity(0, sizeof(mask), &mask) != 0) {
+        return -1;
+    }
+
+    return 0;
+#endif
+}
+
+//! [main]
+int main(int argc, char *argv[])
+{
+    try
+    {
+        auto args = parseArgs(argc, argv);
+        if (args.count("affinity")) {
+                uint64_t cpu = args["affinity"].as<uint64_t>();
+
+                if (set_affinity(cpu)) {
+                        LOG("Main", ERROR) << "Failed to set affinity to cpu "
+                                           << cpu;
+                        throw;
+                }
+        } else if (!args.count("cpus") && !args.count("numa-node")) {
+#ifdef _WIN32
+                SYSTEM_INFO info;
+                ZeroMemory(&info, sizeof(SYSTEM_INFO));
+                GetSystemInfo(&info);
+                auto nr_cpus = info.dwNumberOfProcessors;
+#else
+                auto nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+                if (set_affinity(nr_cpus - 1)) {
+                        LOG("Main", ERROR) << "Failed to set affinity to cpu "
+                                           << nr_cpus - 1;
+                        throw;
+                }
+        }
+
+#ifdef _WIN32
+        if (args.count("windows-svc")) {
+            if (copyArgs(argc, argv)) {
+                LOG("Main", ERROR) << "Failed to copy args for Windows service\n";
+                exit(EXIT_FAILURE);
+            }
+
+            serviceStart();
+            freeArgs();
+
+            exit(EXIT_SUCCESS);
+        }
+
+        if (args.count("high-priority")) {
+            if (!SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS)) {
+                LOG("Main", INFO) << "Failed to set high priority\n";
+            }
+        }
+#endif
+
+
+        // Spin until XcOpen succeeds. Useful if this program may
+        // be started before the xeniface driver is loaded.
+        bool wait = args.count("wait") != 0;
+
+        // Create backend
+        BlkBackend blkBackend(wait, parseDeviceConfig(args));
+        LOG("Main", INFO) << "Starting block backend";
+        blkBackend.start();
+
+        waitSignals();
+
+        blkBackend.stop();
+    }
+    catch(const std::exception& e)
+    {
+        LOG("Main", ERROR) << e.what();
+    }
+
+    return 0;
+}
+//! [main]
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,467 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "SimFrontend.hpp"
+#include "SimXen.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+extern "C" {
+#include <xen/io/xenbus.h>
+}
+
+using XenBackend::Exception;
+
+static constexpr uint32_t SECTORS_PER_PAGE = XC_PAGE_SIZE / 512U;
+static constexpr uint32_t SEGMENTS_PER_INDIRECT_PAGE =
+    XC_PAGE_SIZE / sizeof(struct blkif_request_segment);
+
+SimFrontend::SimFrontend(XenBackend::BackendBase &backend,
+                         domid_t domId,
+                         uint16_t devId,
+                         const std::string &imagePath,
+                         const SimFrontendConfig &config) :
+    mBackend(backend),
+    mDomId(domId),
+    mDevId(devId),
+    mConfig(config)
+{
+    const std::string dev = "vbd/" + std::to_string(devId);
+
+    mXsFrontendPath = mXenStore.getDomainPath(domId) + "/device/" + dev;
+    mXsBackendPath = mXenStore.getDomainPath(0) + "/backend/vbd/" +
+                     std::to_string(domId) + "/" + std::to_string(devId);
+
+    mRingPages = 1U << config.ringPageOrder;
+    mDataStart = mRingPages * config.queues;
+    mNrPages = mDataStart + config.dataPages + config.indirectPages;
+    mFd = memfd_create("sim-blkfront", MFD_CLOEXEC);
+
+    if (mFd < 0 || ftruncate(mFd, off_t(mNrPages) * XC_PAGE_SIZE) != 0) {
+        throw Exception("Can't create frontend memory", errno);
+    }
+
+    mMem = static_cast<uint8_t *>(mmap(nullptr, mNrPages * XC_PAGE_SIZE,
+                                       PROT_READ | PROT_WRITE, MAP_SHARED,
+                                       mFd, 0));
+    if (mMem == MAP_FAILED) {
+        throw Exception("Can't map frontend memory", errno);
+    }
+
+    mFirstGref = SimXen::grantPages(domId, mFd, 0, mNrPages);
+    mQueues.resize(config.queues);
+
+    for (auto &queue : mQueues) {
+        queue.port = SimXen::allocPort(domId);
+    }
+
+    for (uint32_t i = 0U; i < config.indirectPages; i++) {
+        mFreeIndirect.push_back(mDataStart + config.dataPages + i);
+    }
+
+    // What the toolstack would have written before the backend sees us
+    mXenStore.writeString(mXsBackendPath + "/params", imagePath);
+    mXenStore.writeString(mXsBackendPath + "/frontend", mXsFrontendPath);
+
+    for (const auto &key : config.backendKeys) {
+        mXenStore.writeString(mXsBackendPath + "/" + key.first, key.second);
+    }
+
+    mXenStore.writeInt(mXsFrontendPath + "/state", XenbusStateInitialising);
+
+    mBackend.simAttachFrontend(domId, devId);
+}
+
+SimFrontend::~SimFrontend()
+{
+    try {
+        this->disconnect();
+    } catch (const std::exception &e) {
+        LOG("SimFrontend", ERROR) << "Disconnect failed: " << e.what();
+    }
+
+    mBackend.simDetachFrontend(mDomId, mDevId);
+    mXenStore.removePath(mXsFrontendPath);
+    mXenStore.removePath(mXsBackendPath);
+
+    for (auto &queue : mQueues) {
+        SimXen::freePort(queue.port);
+    }
+
+    SimXen::revokePages(mDomId, mFirstGref, mNrPages);
+
+    munmap(mMem, mNrPages * XC_PAGE_SIZE);
+    close(mFd);
+}
+
+uint8_t *SimFrontend::page(uint32_t index) noexcept
+{
+    return mMem + size_t(index) * XC_PAGE_SIZE;
+}
+
+uint8_t *SimFrontend::dataPage(uint32_t index) noexcept
+{
+    return this->page(mDataStart + index);
+}
+
+grant_ref_t SimFrontend::dataGref(uint32_t index) const noexcept
+{
+    return mFirstGref + mDataStart + index;
+}
+
+void SimFrontend::releaseIndirect(const std::vector<uint32_t> &pages)
+{
+    std::lock_guard<std::mutex> lock(mIndirectMutex);
+
+    mFreeIndirect.insert(mFreeIndirect.end(), pages.begin(), pages.end());
+}
+
+void SimFrontend::waitBackendState(int state, int timeoutMs)
+{
+    const auto path = mXsBackendPath + "/state";
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::milliseconds(timeoutMs);
+
+    while (!mXenStore.checkIfExist(path) || mXenStore.readInt(path) != state) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            throw Exception("Timed out waiting for backend state " +
+                            std::to_string(state), ETIMEDOUT);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void SimFrontend::writeBackendKey(const std::string &key, const std::string &value)
+{
+    mXenStore.writeString(mXsBackendPath + "/" + key, value);
+}
+
+void SimFrontend::connect()
+{
+    if (mConnected) {
+        return;
+    }
+
+    mXenStore.writeInt(mXsFrontendPath + "/state", XenbusStateInitialising);
+    this->waitBackendState(XenbusStateInitWait, 1000);
+
+    // Like blkfront, use as many queues as both sides support
+    mNrQueues = 1U;
+
+    if (mXenStore.checkIfExist(mXsBackendPath + "/multi-queue-max-queues")) {
+        mNrQueues = std::min<uint32_t>(mConfig.queues,
+            mXenStore.readUint(mXsBackendPath + "/multi-queue-max-queues"));
+        mNrQueues = std::max<uint32_t>(mNrQueues, 1U);
+    }
+
+    mMaxIndirectSegments = 0U;
+
+    if (mXenStore.checkIfExist(mXsBackendPath + "/feature-max-indirect-segments")) {
+        mMaxIndirectSegments =
+            mXenStore.readUint(mXsBackendPath + "/feature-max-indirect-segments");
+    }
+
+    mRingOrder = 0U;
+
+    if (mXenStore.checkIfExist(mXsBackendPath + "/max-ring-page-order")) {
+        mRingOrder = std::min<uint32_t>(mConfig.ringPageOrder,
+            mXenStore.readUint(mXsBackendPath + "/max-ring-page-order"));
+    }
+
+    for (uint32_t i = 0U; i < mNrQueues; i++) {
+        const uint32_t first = i * mRingPages;
+        auto sring = reinterpret_cast<blkif_sring_t *>(this->page(first));
+
+        SHARED_RING_INIT(sring);
+        FRONT_RING_INIT(&mQueues[i].ring, sring, (1U << mRingOrder) * XC_PAGE_SIZE);
+
+        // A single queue is published the legacy way
+        const std::string path = mNrQueues == 1U ? mXsFrontendPath :
+            mXsFrontendPath + "/queue-" + std::to_string(i);
+
+        // and so is a single page ring
+        if (mRingOrder == 0U) {
+            mXenStore.writeInt(path + "/ring-ref", mFirstGref + first);
+        } else {
+            for (uint32_t n = 0U; n < (1U << mRingOrder); n++) {
+                mXenStore.writeInt(path + "/ring-ref" + std::to_string(n),
+                                   mFirstGref + first + n);
+            }
+        }
+
+        mXenStore.writeInt(path + "/event-channel", mQueues[i].port);
+    }
+
+    if (mRingOrder != 0U) {
+        mXenStore.writeInt(mXsFrontendPath + "/ring-page-order", mRingOrder);
+    }
+
+    if (mNrQueues > 1U) {
+        mXenStore.writeInt(mXsFrontendPath + "/multi-queue-num-queues", mNrQueues);
+    }
+
+    mXenStore.writeString(mXsFrontendPath + "/protocol", "x86_64-abi");
+    mXenStore.writeInt(mXsFrontendPath + "/state", XenbusStateInitialised);
+
+    this->waitBackendState(XenbusStateConnected, 1000);
+    mXenStore.writeInt(mXsFrontendPath + "/state", XenbusStateConnected);
+
+    mConnected = true;
+}
+
+void SimFrontend::disconnect()
+{
+    if (!mConnected) {
+        return;
+    }
+
+    mXenStore.writeInt(mXsFrontendPath + "/state", XenbusStateClosing);
+    this->waitBackendState(XenbusStateClosed, 1000);
+    mXenStore.writeInt(mXsFrontendPath + "/state", XenbusStateClosed);
+
+    for (auto &queue : mQueues) {
+        for (auto &inUse : queue.indirectInUse) {
+            this->releaseIndirect(inUse.second);
+        }
+
+        queue.indirectInUse.clear();
+    }
+
+    mXenStore.removePath(mXsFrontendPath + "/multi-queue-num-queues");
+    mXenStore.removePath(mXsFrontendPath + "/ring-page-order");
+    mXenStore.removePath(mXsFrontendPath + "/ring-ref");
+
+    for (uint32_t n = 0U; n < mRingPages; n++) {
+        mXenStore.removePath(mXsFrontendPath + "/ring-ref" + std::to_string(n));
+    }
+
+    for (uint32_t i = 0U; i < mNrQueues; i++) {
+        mXenStore.removePath(mXsFrontendPath + "/queue-" + std::to_string(i));
+    }
+
+    mConnected = false;
+}
+
+bool SimFrontend::queueRequest(const blkif_request_t &req, uint32_t queue)
+{
+    auto &ring = mQueues[queue].ring;
+
+    if (RING_FULL(&ring)) {
+        return false;
+    }
+
+    *RING_GET_REQUEST(&ring, ring.req_prod_pvt) = req;
+    ring.req_prod_pvt++;
+
+    return true;
+}
+
+bool SimFrontend::queueReadWrite(uint8_t op,
+                                 uint64_t id,
+                                 blkif_sector_t sector,
+                                 uint32_t firstPage,
+                                 uint32_t nrSegs,
+                                 uint32_t queue)
+{
+    blkif_request_t req;
+    memset(&req, 0, sizeof(req));
+
+    req.operation = op;
+    req.nr_segments = nrSegs;
+    req.handle = mDevId;
+    req.id = id;
+    req.sector_number = sector;
+
+    for (uint32_t i = 0U; i < nrSegs; i++) {
+        req.seg[i].gref = this->dataGref((firstPage + i) % mConfig.dataPages);
+        req.seg[i].first_sect = 0U;
+        req.seg[i].last_sect = SECTORS_PER_PAGE - 1U;
+    }
+
+    return this->queueRequest(req, queue);
+}
+
+bool SimFrontend::queueIndirect(uint8_t op,
+                                uint64_t id,
+                                blkif_sector_t sector,
+                                uint32_t firstPage,
+                                uint32_t nrSegs,
+                                uint32_t queue)
+{
+    const uint32_t nrIndirect = (nrSegs + SEGMENTS_PER_INDIRECT_PAGE - 1U) /
+                                SEGMENTS_PER_INDIRECT_PAGE;
+
+    if (RING_FULL(&mQueues[queue].ring) ||
+        nrIndirect > BLKIF_MAX_INDIRECT_PAGES_PER_REQUEST) {
+        return false;
+    }
+
+    std::vector<uint32_t> pages;
+
+    {
+        std::lock_guard<std::mutex> lock(mIndirectMutex);
+
+        if (nrIndirect > mFreeIndirect.size()) {
+            return false;
+        }
+
+        pages.assign(mFreeIndirect.end() - nrIndirect, mFreeIndirect.end());
+        mFreeIndirect.resize(mFreeIndirect.size() - nrIndirect);
+    }
+
+    blkif_request_indirect_t req;
+    memset(&req, 0, sizeof(req));
+
+    req.operation = BLKIF_OP_INDIRECT;
+    req.indirect_op = op;
+    req.nr_segments = nrSegs;
+    req.id = id;
+    req.sector_number = sector;
+    req.handle = mDevId;
+
+    for (uint32_t i = 0U; i < nrIndirect; i++) {
+        const uint32_t index = pages[i];
+
+        req.indirect_grefs[i] = mFirstGref + index;
+
+        auto segs = reinterpret_cast<blkif_request_segment *>(this->page(index));
+        for (uint32_t n = 0U; n < SEGMENTS_PER_INDIRECT_PAGE; n++) {
+            const uint32_t seg = i * SEGMENTS_PER_INDIRECT_PAGE + n;
+
+            if (seg == nrSegs) {
+                break;
+            }
+
+            segs[n].gref = this->dataGref((firstPage + seg) % mConfig.dataPages);
+            segs[n].first_sect = 0U;
+            segs[n].last_sect = SECTORS_PER_PAGE - 1U;
+        }
+    }
+
+    static_assert(sizeof(req) <= sizeof(blkif_request_t), "bad indirect size");
+
+    blkif_request_t raw;
+    memcpy(&raw, &req, sizeof(req));
+
+    if (!this->queueRequest(raw, queue)) {
+        this->releaseIndirect(pages);
+        return false;
+    }
+
+    mQueues[queue].indirectInUse[id] = std::move(pages);
+
+    return true;
+}
+
+bool SimFrontend::queueFlush(uint64_t id, uint32_t queue)
+{
+    blkif_request_t req;
+    memset(&req, 0, sizeof(req));
+
+    req.operation = BLKIF_OP_FLUSH_DISKCACHE;
+    req.handle = mDevId;
+    req.id = id;
+
+    return this->queueRequest(req, queue);
+}
+
+void SimFrontend::push(uint32_t queue)
+{
+    int notify = 0;
+
+    RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&mQueues[queue].ring, notify);
+
+    if (notify) {
+        SimXen::notifyBackend(mQueues[queue].port);
+    }
+}
+
+void SimFrontend::publish(uint32_t queue)
+{
+    RING_PUSH_REQUESTS(&mQueues[queue].ring);
+}
+
+void SimFrontend::kick(uint32_t queue)
+{
+    SimXen::notifyBackend(mQueues[queue].port);
+}
+
+size_t SimFrontend::reap(std::vector<blkif_response_t> &rsps,
+                         size_t min,
+                         int timeoutMs,
+                         uint32_t queue)
+{
+    auto &ring = mQueues[queue].ring;
+    auto &indirectInUse = mQueues[queue].indirectInUse;
+    const int fd = SimXen::frontendFd(mQueues[queue].port);
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::milliseconds(timeoutMs);
+    size_t count = 0U;
+
+    while (true) {
+        int more = 0;
+
+        do {
+            RING_IDX rp = ring.sring->rsp_prod;
+            xen_rmb();
+
+            for (; ring.rsp_cons != rp; ring.rsp_cons++) {
+                const blkif_response_t rsp = *RING_GET_RESPONSE(&ring, ring.rsp_cons);
+
+                auto inUse = indirectInUse.find(rsp.id);
+                if (inUse != indirectInUse.end()) {
+                    this->releaseIndirect(inUse->second);
+                    indirectInUse.erase(inUse);
+                }
+
+                rsps.push_back(rsp);
+                count++;
+            }
+
+            RING_FINAL_CHECK_FOR_RESPONSES(&ring, more);
+        } while (more);
+
+        if (count >= min) {
+            return count;
+        }
+
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0) {
+            return count;
+        }
+
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, int(left)) > 0) {
+            uint64_t events;
+            (void)read(fd, &events, sizeof(events));
+        }
+    }
+}
@@ -0,0 +1,180 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef SIM_SIMFRONTEND_HPP
+#define SIM_SIMFRONTEND_HPP
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <xen/be/BackendBase.hpp>
+#include <xen/be/XenStore.hpp>
+
+extern "C" {
+#include <xen/io/blkif.h>
+}
+
+struct SimFrontendConfig {
+    // Pages available for request data, granted once at creation
+    uint32_t dataPages{256U};
+
+    // Pages available for indirect segment descriptors, shared by all
+    // queues
+    uint32_t indirectPages{64U};
+
+    // Rings to ask for; fewer are used if the backend offers fewer
+    uint32_t queues{1U};
+
+    // Size of each ring to ask for, 2^order pages; smaller if the backend
+    // offers less
+    uint32_t ringPageOrder{0U};
+
+    // Extra keys written to the backend directory before attaching, such
+    // as per-device overrides of the backend defaults
+    std::map<std::string, std::string> backendKeys;
+};
+
+//
+// Synthetic blkfront. Owns a memfd holding its shared rings, data pages and
+// indirect pages, publishes them through the simulated xenstore and drives
+// the backend's xenbus state machine the way a guest driver would.
+//
+// Functions taking a queue index may be called concurrently for different
+// queues, but not for the same one.
+//
+class SimFrontend
+{
+public:
+    SimFrontend(XenBackend::BackendBase &backend,
+                domid_t domId,
+                uint16_t devId,
+                const std::string &imagePath,
+                const SimFrontendConfig &config = SimFrontendConfig{});
+    ~SimFrontend();
+
+    SimFrontend(const SimFrontend &) = delete;
+    SimFrontend &operator=(const SimFrontend &) = delete;
+
+    void connect();
+    void disconnect();
+
+    // Writes a key to the backend directory the way a toolstack would
+    // while the device is in use
+    void writeBackendKey(const std::string &key, const std::string &value);
+    bool connected() const noexcept { return mConnected; }
+
+    // Queues in use since the last connect()
+    uint32_t queues() const noexcept { return mNrQueues; }
+
+    // Segments the backend takes in an indirect request, 0 if it doesn't
+    // take any, as of the last connect()
+    uint32_t maxIndirectSegments() const noexcept { return mMaxIndirectSegments; }
+
+    domid_t domId() const noexcept { return mDomId; }
+    uint16_t devId() const noexcept { return mDevId; }
+
+    uint32_t dataPages() const noexcept { return mConfig.dataPages; }
+    uint8_t *dataPage(uint32_t index) noexcept;
+    grant_ref_t dataGref(uint32_t index) const noexcept;
+
+    unsigned int ringSize(uint32_t queue = 0U) const noexcept
+    {
+        return RING_SIZE(&mQueues[queue].ring);
+    }
+
+    unsigned int freeSlots(uint32_t queue = 0U) const noexcept
+    {
+        return RING_FREE_REQUESTS(&mQueues[queue].ring);
+    }
+
+    // The queue functions place a request on a ring without publishing it
+    // and return false if the ring (or the indirect page pool) is full.
+    bool queueRequest(const blkif_request_t &req, uint32_t queue = 0U);
+    bool queueReadWrite(uint8_t op,
+                        uint64_t id,
+                        blkif_sector_t sector,
+                        uint32_t firstPage,
+                        uint32_t nrSegs,
+                        uint32_t queue = 0U);
+    bool queueIndirect(uint8_t op,
+                       uint64_t id,
+                       blkif_sector_t sector,
+                       uint32_t firstPage,
+                       uint32_t nrSegs,
+                       uint32_t queue = 0U);
+    bool queueFlush(uint64_t id, uint32_t queue = 0U);
+
+    // Publishes queued requests and kicks the backend if it asked for it
+    void push(uint32_t queue = 0U);
+
+    // Publishes queued requests without a kick, leaving them to a backend
+    // that polls the ring, and kicks it regardless
+    void publish(uint32_t queue = 0U);
+    void kick(uint32_t queue = 0U);
+
+    // Collects responses until at least min have arrived or timeoutMs passes
+    size_t reap(std::vector<blkif_response_t> &rsps,
+                size_t min = 1U,
+                int timeoutMs = 5000,
+                uint32_t queue = 0U);
+
+private:
+    struct Queue {
+        blkif_front_ring_t ring;
+        evtchn_port_t port{0};
+        std::unordered_map<uint64_t, std::vector<uint32_t>> indirectInUse;
+    };
+
+    uint8_t *page(uint32_t index) noexcept;
+    void waitBackendState(int state, int timeoutMs);
+    void releaseIndirect(const std::vector<uint32_t> &pages);
+
+    XenBackend::BackendBase &mBackend;
+    domid_t mDomId;
+    uint16_t mDevId;
+    SimFrontendConfig mConfig;
+
+    XenBackend::XenStore mXenStore;
+    std::string mXsFrontendPath;
+    std::string mXsBackendPath;
+
+    int mFd{-1};
+    uint8_t *mMem{nullptr};
+    uint32_t mNrPages{0};
+    uint32_t mRingPages{1};
+    uint32_t mRingOrder{0};
+    uint32_t mDataStart{0};
+    grant_ref_t mFirstGref{0};
+
+    std::vector<Queue> mQueues;
+    uint32_t mNrQueues{1};
+    uint32_t mMaxIndirectSegments{0};
+    bool mConnected{false};
+
+    std::mutex mIndirectMutex;
+    std::vector<uint32_t> mFreeIndirect;
+};
+
+#endif
@@ -0,0 +1,1190 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "SimXen.hpp"
+
+#include <xen/be/BackendBase.hpp>
+#include <xen/be/FrontendHandlerBase.hpp>
+#include <xen/be/Log.hpp>
+#include <xen/be/XenEvtchn.hpp>
+#include <xen/be/XenGnttab.hpp>
+#include <xen/be/XenStore.hpp>
+
+#include <xenctrl.h>
+#include <xenevtchn.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Statistics
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct AtomicStats {
+    std::atomic<uint64_t> grantMaps{0};
+    std::atomic<uint64_t> grantUnmaps{0};
+    std::atomic<uint64_t> pagesMapped{0};
+    std::atomic<uint64_t> notifiesToBackend{0};
+    std::atomic<uint64_t> notifiesToFrontend{0};
+};
+
+AtomicStats gStats;
+
+}
+
+SimXen::Stats SimXen::stats() noexcept
+{
+    Stats stats;
+
+    stats.grantMaps = gStats.grantMaps.load();
+    stats.grantUnmaps = gStats.grantUnmaps.load();
+    stats.pagesMapped = gStats.pagesMapped.load();
+    stats.notifiesToBackend = gStats.notifiesToBackend.load();
+    stats.notifiesToFrontend = gStats.notifiesToFrontend.load();
+
+    return stats;
+}
+
+void SimXen::resetStats() noexcept
+{
+    gStats.grantMaps = 0;
+    gStats.grantUnmaps = 0;
+    gStats.pagesMapped = 0;
+    gStats.notifiesToBackend = 0;
+    gStats.notifiesToFrontend = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Log
+////////////////////////////////////////////////////////////////////////////////
+
+namespace XenBackend {
+
+static std::atomic<LogLevel> gLogLevel{LogLevel::logWARNING};
+static std::mutex gLogMutex;
+
+void Log::setLogLevel(LogLevel level) noexcept
+{
+    gLogLevel = level;
+}
+
+LogLevel Log::getLogLevel() noexcept
+{
+    return gLogLevel;
+}
+
+LogLine::LogLine(const std::string &name, LogLevel level)
+{
+    static const char *const names[] = {
+        "", "ERROR", "WARNING", "INFO", "DEBUG"
+    };
+
+    mStream << "[" << name << "] " << names[static_cast<int>(level)] << ": ";
+}
+
+LogLine::~LogLine()
+{
+    std::lock_guard<std::mutex> lock(gLogMutex);
+    std::clog << mStream.str() << std::endl;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// XenStore
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Watch {
+    const XenBackend::XenStore *owner;
+    std::string path;
+    XenBackend::XenStore::WatchCallback callback;
+};
+
+struct Store {
+    std::mutex mutex;
+    std::map<std::string, std::string> entries;
+
+    // Held while callbacks run so clearWatch() never returns while one of
+    // the watches being cleared is still executing on another thread.
+    std::recursive_mutex watchMutex;
+    std::list<Watch> watches;
+};
+
+Store &store()
+{
+    static Store s;
+    return s;
+}
+
+bool isUnder(const std::string &path, const std::string &parent)
+{
+    if (path.compare(0, parent.size(), parent) != 0) {
+        return false;
+    }
+
+    return path.size() == parent.size() || path[parent.size()] == '/';
+}
+
+void fireWatches(const std::string &path)
+{
+    auto &s = store();
+    std::lock_guard<std::recursive_mutex> lock(s.watchMutex);
+    std::vector<XenBackend::XenStore::WatchCallback> callbacks;
+
+    for (const auto &watch : s.watches) {
+        if (isUnder(path, watch.path)) {
+            callbacks.push_back(watch.callback);
+        }
+    }
+
+    for (const auto &callback : callbacks) {
+        callback();
+    }
+}
+
+}
+
+namespace XenBackend {
+
+XenStore::~XenStore()
+{
+    this->clearWatches();
+}
+
+std::string XenStore::getDomainPath(domid_t domId) const
+{
+    return "/local/domain/" + std::to_string(domId);
+}
+
+std::string XenStore::readString(const std::string &path)
+{
+    auto &s = store();
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    auto itr = s.entries.find(path);
+    if (itr == s.entries.end()) {
+        throw XenStoreException("Can't read from: " + path, ENOENT);
+    }
+
+    return itr->second;
+}
+
+int XenStore::readInt(const std::string &path)
+{
+    return std::stoi(this->readString(path));
+}
+
+unsigned int XenStore::readUint(const std::string &path)
+{
+    return std::stoul(this->readString(path));
+}
+
+void XenStore::writeString(const std::string &path, const std::string &value)
+{
+    auto &s = store();
+
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.entries[path] = value;
+    }
+
+    fireWatches(path);
+}
+
+void XenStore::writeInt(const std::string &path, int value)
+{
+    this->writeString(path, std::to_string(value));
+}
+
+void XenStore::writeUint(const std::string &path, unsigned int value)
+{
+    this->writeString(path, std::to_string(value));
+}
+
+bool XenStore::checkIfExist(const std::string &path)
+{
+    auto &s = store();
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    auto itr = s.entries.lower_bound(path);
+
+    return itr != s.entries.end() && isUnder(itr->first, path);
+}
+
+void XenStore::removePath(const std::string &path)
+{
+    auto &s = store();
+
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+
+        auto itr = s.entries.lower_bound(path);
+        while (itr != s.entries.end() && isUnder(itr->first, path)) {
+            itr = s.entries.erase(itr);
+        }
+    }
+
+    fireWatches(path);
+}
+
+std::vector<std::string> XenStore::readDirectory(const std::string &path)
+{
+    auto &s = store();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    std::vector<std::string> children;
+
+    for (auto itr = s.entries.lower_bound(path + "/");
+         itr != s.entries.end() && isUnder(itr->first, path);
+         itr++) {
+        const auto child = itr->first.substr(path.size() + 1);
+        const auto name = child.substr(0, child.find('/'));
+
+        if (children.empty() || children.back() != name) {
+            children.push_back(name);
+        }
+    }
+
+    return children;
+}
+
+void XenStore::setWatch(const std::string &path,
+                        WatchCallback callback,
+                        bool initNotify)
+{
+    auto &s = store();
+    std::lock_guard<std::recursive_mutex> lock(s.watchMutex);
+
+    s.watches.push_back({this, path, callback});
+
+    if (initNotify) {
+        callback();
+    }
+}
+
+void XenStore::clearWatch(const std::string &path)
+{
+    auto &s = store();
+    std::lock_guard<std::recursive_mutex> lock(s.watchMutex);
+
+    s.watches.remove_if([this, &path](const Watch &watch) {
+        return watch.owner == this && watch.path == path;
+    });
+}
+
+void XenStore::clearWatches()
+{
+    auto &s = store();
+    std::lock_guard<std::recursive_mutex> lock(s.watchMutex);
+
+    s.watches.remove_if([this](const Watch &watch) {
+        return watch.owner == this;
+    });
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Event channels
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Port {
+    domid_t domId;
+    int backendFd;
+    int frontendFd;
+};
+
+struct Evtchns {
+    std::mutex mutex;
+    std::unordered_map<evtchn_port_t, Port> ports;
+    evtchn_port_t next{1};
+};
+
+Evtchns &evtchns()
+{
+    static Evtchns e;
+    return e;
+}
+
+Port findPort(evtchn_port_t port)
+{
+    auto &e = evtchns();
+    std::lock_guard<std::mutex> lock(e.mutex);
+
+    auto itr = e.ports.find(port);
+    if (itr == e.ports.end()) {
+        throw XenBackend::XenEvtchnException("Can't bind port " +
+                                             std::to_string(port), EINVAL);
+    }
+
+    return itr->second;
+}
+
+void kick(int fd)
+{
+    const uint64_t one = 1U;
+
+    if (write(fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+        LOG("SimXen", ERROR) << "Failed to kick eventfd " << fd;
+    }
+}
+
+void drain(int fd)
+{
+    uint64_t count;
+
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        LOG("SimXen", ERROR) << "Failed to drain eventfd " << fd;
+    }
+}
+
+}
+
+evtchn_port_t SimXen::allocPort(domid_t domId)
+{
+    auto &e = evtchns();
+    std::lock_guard<std::mutex> lock(e.mutex);
+
+    const int backendFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    const int frontendFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (backendFd < 0 || frontendFd < 0) {
+        throw XenBackend::XenEvtchnException("Can't create eventfd", errno);
+    }
+
+    const evtchn_port_t port = e.next++;
+    e.ports[port] = {domId, backendFd, frontendFd};
+
+    return port;
+}
+
+void SimXen::freePort(evtchn_port_t port)
+{
+    auto &e = evtchns();
+    std::lock_guard<std::mutex> lock(e.mutex);
+
+    auto itr = e.ports.find(port);
+    if (itr == e.ports.end()) {
+        return;
+    }
+
+    close(itr->second.backendFd);
+    close(itr->second.frontendFd);
+    e.ports.erase(itr);
+}
+
+int SimXen::frontendFd(evtchn_port_t port)
+{
+    return findPort(port).frontendFd;
+}
+
+void SimXen::notifyBackend(evtchn_port_t port)
+{
+    gStats.notifiesToBackend++;
+    kick(findPort(port).backendFd);
+}
+
+namespace XenBackend {
+
+XenEvtchn::XenEvtchn(domid_t domId,
+                     evtchn_port_t port,
+                     Callback callback,
+                     ErrorCallback errorCallback) :
+    mDomId(domId),
+    mPort(port),
+    mCallback(callback),
+    mErrorCallback(errorCallback)
+{
+    const Port p = findPort(port);
+
+    if (p.domId != domId) {
+        throw XenEvtchnException("Port " + std::to_string(port) +
+                                 " is not owned by domain " +
+                                 std::to_string(domId), EINVAL);
+    }
+
+    mFd = dup(p.backendFd);
+    mNotifyFd = dup(p.frontendFd);
+    mStopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (mFd < 0 || mNotifyFd < 0 || mStopFd < 0) {
+        throw XenEvtchnException("Can't bind port " + std::to_string(port),
+                                 errno);
+    }
+}
+
+XenEvtchn::~XenEvtchn()
+{
+    this->stop();
+
+    close(mFd);
+    close(mNotifyFd);
+    close(mStopFd);
+}
+
+void XenEvtchn::start()
+{
+    if (mThread.joinable()) {
+        return;
+    }
+
+    mThread = std::thread(&XenEvtchn::eventThread, this);
+}
+
+void XenEvtchn::stop()
+{
+    if (!mThread.joinable()) {
+        return;
+    }
+
+    kick(mStopFd);
+    mThread.join();
+    drain(mStopFd);
+}
+
+void XenEvtchn::notify()
+{
+    gStats.notifiesToFrontend++;
+    kick(mNotifyFd);
+}
+
+void XenEvtchn::eventThread()
+{
+    struct pollfd fds[2] = {
+        {mFd, POLLIN, 0},
+        {mStopFd, POLLIN, 0}
+    };
+
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            LOG("XenEvtchn", ERROR) << "poll failed on port " << mPort;
+            return;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            return;
+        }
+
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        this->handleEvent();
+    }
+}
+
+void XenEvtchn::handleEvent()
+{
+    drain(mFd);
+
+    try {
+        mCallback();
+    } catch (const std::exception &e) {
+        if (mErrorCallback) {
+            mErrorCallback(e);
+        } else {
+            LOG("XenEvtchn", ERROR) << e.what();
+        }
+    }
+}
+
+}
+
+struct xenevtchn_handle {
+    int fd{-1};
+    int notifyFd{-1};
+    evtchn_port_t port{0};
+};
+
+extern "C" {
+
+xenevtchn_handle *xenevtchn_open(xentoollog_logger *logger,
+                                 unsigned open_flags)
+{
+    (void)logger;
+    (void)open_flags;
+
+    // Takes the place of the bound port's eventfd until there is one, so
+    // the descriptor stays the same across the bind
+    const int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    auto xce = new xenevtchn_handle;
+    xce->fd = fd;
+
+    return xce;
+}
+
+int xenevtchn_close(xenevtchn_handle *xce)
+{
+    if (!xce) {
+        return 0;
+    }
+
+    xenevtchn_unbind(xce, xce->port);
+    close(xce->fd);
+    delete xce;
+
+    return 0;
+}
+
+int xenevtchn_fd(xenevtchn_handle *xce)
+{
+    return xce->fd;
+}
+
+int xenevtchn_notify(xenevtchn_handle *xce, evtchn_port_t port)
+{
+    if (port == 0U || port != xce->port) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    gStats.notifiesToFrontend++;
+    kick(xce->notifyFd);
+
+    return 0;
+}
+
+xenevtchn_port_or_error_t xenevtchn_bind_interdomain(xenevtchn_handle *xce,
+                                                     uint32_t domid,
+                                                     evtchn_port_t remote_port)
+{
+    if (xce->port != 0U) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    Port p;
+
+    try {
+        p = findPort(remote_port);
+    } catch (const XenBackend::XenEvtchnException &e) {
+        errno = e.getErrno();
+        return -1;
+    }
+
+    if (p.domId != domid) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    xce->notifyFd = dup(p.frontendFd);
+
+    if (xce->notifyFd < 0 || dup2(p.backendFd, xce->fd) < 0) {
+        const int error = errno;
+
+        close(xce->notifyFd);
+        xce->notifyFd = -1;
+        errno = error;
+
+        return -1;
+    }
+
+    // The local port is the remote one, there being only one domain here
+    xce->port = remote_port;
+
+    return xenevtchn_port_or_error_t(remote_port);
+}
+
+int xenevtchn_unbind(xenevtchn_handle *xce, evtchn_port_t port)
+{
+    if (port == 0U || port != xce->port) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Stop the descriptor hearing from the port's frontend
+    const int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd >= 0) {
+        dup2(fd, xce->fd);
+        close(fd);
+    }
+
+    close(xce->notifyFd);
+    xce->notifyFd = -1;
+    xce->port = 0U;
+
+    return 0;
+}
+
+xenevtchn_port_or_error_t xenevtchn_pending(xenevtchn_handle *xce)
+{
+    uint64_t count;
+
+    if (read(xce->fd, &count, sizeof(count)) < 0) {
+        return -1;
+    }
+
+    return xenevtchn_port_or_error_t(xce->port);
+}
+
+int xenevtchn_unmask(xenevtchn_handle *xce, evtchn_port_t port)
+{
+    (void)xce;
+    (void)port;
+
+    return 0;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Grant tables
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// The first few grant references are reserved by real Xen as well
+constexpr grant_ref_t FIRST_GREF = 8U;
+
+struct Region {
+    grant_ref_t first;
+    uint32_t count;
+    int fd;
+    off_t offset;
+};
+
+struct Grants {
+    std::shared_mutex mutex;
+    std::unordered_map<domid_t, std::vector<Region>> regions;
+    std::unordered_map<domid_t, grant_ref_t> next;
+};
+
+Grants &grants()
+{
+    static Grants g;
+    return g;
+}
+
+// Caller must hold the grants mutex
+const Region *findRegion(domid_t domId, grant_ref_t ref)
+{
+    auto &g = grants();
+    auto itr = g.regions.find(domId);
+
+    if (itr == g.regions.end()) {
+        return nullptr;
+    }
+
+    for (const auto &region : itr->second) {
+        if (ref >= region.first && ref - region.first < region.count) {
+            return &region;
+        }
+    }
+
+    return nullptr;
+}
+
+}
+
+grant_ref_t SimXen::grantPages(domid_t domId, int fd, off_t offset, uint32_t count)
+{
+    auto &g = grants();
+    std::unique_lock<std::shared_mutex> lock(g.mutex);
+
+    const int owned = dup(fd);
+    if (owned < 0) {
+        throw XenBackend::XenGnttabException("Can't grant pages", errno);
+    }
+
+    auto next = g.next.try_emplace(domId, FIRST_GREF).first;
+    const grant_ref_t first = next->second;
+
+    next->second += count;
+    g.regions[domId].push_back({first, count, owned, offset});
+
+    return first;
+}
+
+void SimXen::revokePages(domid_t domId, grant_ref_t first, uint32_t count)
+{
+    auto &g = grants();
+    std::unique_lock<std::shared_mutex> lock(g.mutex);
+    auto &regions = g.regions[domId];
+
+    for (auto itr = regions.begin(); itr != regions.end(); itr++) {
+        if (itr->first == first && itr->count == count) {
+            close(itr->fd);
+            regions.erase(itr);
+            return;
+        }
+    }
+}
+
+extern "C" {
+
+void *xengnttab_map_domain_grant_refs(xengnttab_handle *xgt,
+                                      uint32_t count,
+                                      uint32_t domid,
+                                      uint32_t *refs,
+                                      int prot)
+{
+    (void)xgt;
+
+    if (count == 0U) {
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    const size_t len = count * XC_PAGE_SIZE;
+    auto base = static_cast<uint8_t *>(mmap(nullptr, len, PROT_NONE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS,
+                                            -1, 0));
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+
+    auto &g = grants();
+    std::shared_lock<std::shared_mutex> lock(g.mutex);
+
+    // Map runs of references that are consecutive in the same region with
+    // a single mmap, like a multi-page ring normally is.
+    for (uint32_t i = 0U; i < count; ) {
+        const Region *region = findRegion(domid, refs[i]);
+
+        if (!region) {
+            munmap(base, len);
+            errno = EINVAL;
+            return nullptr;
+        }
+
+        uint32_t run = 1U;
+        while (i + run < count &&
+               refs[i + run] == refs[i] + run &&
+               refs[i + run] - region->first < region->count) {
+            run++;
+        }
+
+        const off_t offset = region->offset +
+                             off_t(refs[i] - region->first) * XC_PAGE_SIZE;
+        void *addr = mmap(base + i * XC_PAGE_SIZE, run * XC_PAGE_SIZE, prot,
+                          MAP_SHARED | MAP_FIXED, region->fd, offset);
+
+        if (addr == MAP_FAILED) {
+            munmap(base, len);
+            return nullptr;
+        }
+
+        i += run;
+    }
+
+    gStats.grantMaps++;
+    gStats.pagesMapped += count;
+
+    return base;
+}
+
+void *xengnttab_map_grant_ref(xengnttab_handle *xgt,
+                              uint32_t domid,
+                              uint32_t ref,
+                              int prot)
+{
+    return xengnttab_map_domain_grant_refs(xgt, 1U, domid, &ref, prot);
+}
+
+int xengnttab_unmap(xengnttab_handle *xgt, void *start_address, uint32_t count)
+{
+    (void)xgt;
+
+    if (!start_address) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    gStats.grantUnmaps++;
+
+    return munmap(start_address, count * XC_PAGE_SIZE);
+}
+
+}
+
+namespace XenBackend {
+
+XenGnttabBuffer::XenGnttabBuffer(domid_t domId, grant_ref_t ref, int prot) :
+    XenGnttabBuffer(domId, &ref, 1U, prot)
+{ }
+
+XenGnttabBuffer::XenGnttabBuffer(domid_t domId,
+                                 const grant_ref_t *refs,
+                                 size_t count,
+                                 int prot) :
+    mCount(count)
+{
+    std::vector<uint32_t> grefs(refs, refs + count);
+
+    mBuffer = xengnttab_map_domain_grant_refs(nullptr, count, domId,
+                                              grefs.data(), prot);
+    if (!mBuffer) {
+        throw XenGnttabException("Can't map grant refs", errno);
+    }
+}
+
+XenGnttabBuffer::~XenGnttabBuffer()
+{
+    xengnttab_unmap(nullptr, mBuffer, mCount);
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Domain control
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Nodes the simulated host reports having
+constexpr int SIM_MAX_NODES = 64;
+
+struct NodeAffinities {
+    std::mutex mutex;
+    std::unordered_map<domid_t, std::vector<uint32_t>> nodes;
+};
+
+NodeAffinities &nodeAffinities()
+{
+    static NodeAffinities affinities;
+    return affinities;
+}
+
+}
+
+struct xc_interface_core {
+};
+
+namespace SimXen {
+
+void setNodeAffinity(domid_t domId, const std::vector<uint32_t> &nodes)
+{
+    auto &affinities = nodeAffinities();
+    std::lock_guard<std::mutex> lock(affinities.mutex);
+
+    if (nodes.empty()) {
+        affinities.nodes.erase(domId);
+    } else {
+        affinities.nodes[domId] = nodes;
+    }
+}
+
+}
+
+extern "C" {
+
+xc_interface *xc_interface_open(xentoollog_logger *logger,
+                                xentoollog_logger *dombuild_logger,
+                                unsigned open_flags)
+{
+    (void)logger;
+    (void)dombuild_logger;
+    (void)open_flags;
+
+    return new xc_interface;
+}
+
+int xc_interface_close(xc_interface *xch)
+{
+    delete xch;
+    return 0;
+}
+
+int xc_get_max_nodes(xc_interface *xch)
+{
+    (void)xch;
+    return SIM_MAX_NODES;
+}
+
+int xc_get_nodemap_size(xc_interface *xch)
+{
+    return (xc_get_max_nodes(xch) + 7) / 8;
+}
+
+xc_nodemap_t xc_nodemap_alloc(xc_interface *xch)
+{
+    return static_cast<xc_nodemap_t>(calloc(size_t(xc_get_nodemap_size(xch)), 1U));
+}
+
+int xc_domain_node_getaffinity(xc_interface *xch,
+                               uint32_t domid,
+                               xc_nodemap_t nodemap)
+{
+    auto &affinities = nodeAffinities();
+    std::lock_guard<std::mutex> lock(affinities.mutex);
+    const size_t size = size_t(xc_get_nodemap_size(xch));
+
+    auto itr = affinities.nodes.find(domid_t(domid));
+
+    if (itr == affinities.nodes.end()) {
+        memset(nodemap, 0xFF, size);
+        return 0;
+    }
+
+    memset(nodemap, 0, size);
+
+    for (const uint32_t node : itr->second) {
+        if (node < uint32_t(SIM_MAX_NODES)) {
+            nodemap[node / 8U] |= uint8_t(1U << (node % 8U));
+        }
+    }
+
+    return 0;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// FrontendHandlerBase
+////////////////////////////////////////////////////////////////////////////////
+
+namespace XenBackend {
+
+FrontendHandlerBase::FrontendHandlerBase(const std::string &name,
+                                         const std::string &devName,
+                                         domid_t feDomId,
+                                         uint16_t devId) :
+    mFeDomId(feDomId),
+    mDevId(devId),
+    mLog(name)
+{
+    const std::string suffix = devName + "/" + std::to_string(feDomId) + "/" +
+                               std::to_string(devId);
+
+    mXsBackendPath = mXenStore.getDomainPath(0) + "/backend/" + suffix;
+    mXsFrontendPath = mXenStore.getDomainPath(feDomId) + "/device/" +
+                      devName + "/" + std::to_string(devId);
+}
+
+FrontendHandlerBase::~FrontendHandlerBase()
+{
+    mXenStore.clearWatches();
+
+    for (auto &ringBuffer : mRingBuffers) {
+        ringBuffer->stop();
+    }
+}
+
+void FrontendHandlerBase::simStart()
+{
+    this->setBackendState(XenbusStateInitWait);
+
+    mXenStore.setWatch(mXsFrontendPath + "/state",
+                       [this] { this->frontendStateChanged(); },
+                       true);
+}
+
+void FrontendHandlerBase::simStop()
+{
+    mXenStore.clearWatches();
+
+    std::lock_guard<std::recursive_mutex> lock(mMutex);
+    this->close();
+}
+
+void FrontendHandlerBase::addRingBuffer(RingBufferPtr ringBuffer)
+{
+    mRingBuffers.push_back(ringBuffer);
+    ringBuffer->start();
+}
+
+void FrontendHandlerBase::setBackendState(XenbusState state)
+{
+    mBackendState = state;
+    mXenStore.writeInt(mXsBackendPath + "/state", state);
+}
+
+void FrontendHandlerBase::close()
+{
+    for (auto &ringBuffer : mRingBuffers) {
+        ringBuffer->stop();
+    }
+
+    mRingBuffers.clear();
+
+    if (mBackendState == XenbusStateConnected) {
+        this->setBackendState(XenbusStateClosing);
+        this->onClosing();
+    }
+
+    if (mBackendState != XenbusStateClosed) {
+        this->setBackendState(XenbusStateClosed);
+    }
+}
+
+void FrontendHandlerBase::frontendStateChanged()
+{
+    std::lock_guard<std::recursive_mutex> lock(mMutex);
+    const std::string path = mXsFrontendPath + "/state";
+
+    if (!mXenStore.checkIfExist(path)) {
+        return;
+    }
+
+    const auto state = static_cast<XenbusState>(mXenStore.readInt(path));
+
+    switch (state) {
+    case XenbusStateInitialising:
+        if (mBackendState == XenbusStateClosed) {
+            this->setBackendState(XenbusStateInitWait);
+        }
+        break;
+    case XenbusStateInitialised:
+    case XenbusStateConnected:
+        if (mBackendState != XenbusStateInitWait) {
+            break;
+        }
+
+        try {
+            this->onBind();
+            this->setBackendState(XenbusStateConnected);
+        } catch (const std::exception &e) {
+            LOG(mLog, ERROR) << "Bind failed: " << e.what();
+            this->close();
+        }
+        break;
+    case XenbusStateClosing:
+    case XenbusStateClosed:
+        this->close();
+        break;
+    default:
+        break;
+    }
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BackendBase
+////////////////////////////////////////////////////////////////////////////////
+
+namespace XenBackend {
+
+BackendBase::BackendBase(const std::string &name,
+                         const std::string &deviceName,
+                         bool wait) :
+    mDeviceName(deviceName),
+    mLog(name)
+{
+    (void)wait;
+}
+
+BackendBase::~BackendBase()
+{
+    this->stop();
+}
+
+void BackendBase::start()
+{
+    LOG(mLog, DEBUG) << "Simulated backend started";
+}
+
+void BackendBase::stop()
+{
+    std::list<FrontendHandlerPtr> handlers;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        handlers.swap(mFrontendHandlers);
+    }
+
+    for (auto &handler : handlers) {
+        handler->simStop();
+    }
+}
+
+void BackendBase::simAttachFrontend(domid_t domId, uint16_t devId)
+{
+    this->onNewFrontend(domId, devId);
+}
+
+void BackendBase::simDetachFrontend(domid_t domId, uint16_t devId)
+{
+    FrontendHandlerPtr handler;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        auto itr = std::find_if(mFrontendHandlers.begin(),
+                                mFrontendHandlers.end(),
+                                [domId, devId](const FrontendHandlerPtr &h) {
+                                    return h->getDomId() == domId &&
+                                           h->getDevId() == devId;
+                                });
+        if (itr == mFrontendHandlers.end()) {
+            return;
+        }
+
+        handler = *itr;
+        mFrontendHandlers.erase(itr);
+    }
+
+    handler->simStop();
+}
+
+FrontendHandlerPtr BackendBase::getFrontendHandler(domid_t domId, uint16_t devId)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    for (auto &handler : mFrontendHandlers) {
+        if (handler->getDomId() == domId && handler->getDevId() == devId) {
+            return handler;
+        }
+    }
+
+    return nullptr;
+}
+
+void BackendBase::addFrontendHandler(FrontendHandlerPtr frontendHandler)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFrontendHandlers.push_back(frontendHandler);
+    }
+
+    frontendHandler->simStart();
+}
+
+}
@@ -0,0 +1,68 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef SIM_SIMXEN_HPP
+#define SIM_SIMXEN_HPP
+
+#include <cstdint>
+#include <vector>
+#include <sys/types.h>
+
+#include <xen/be/SimTypes.hpp>
+
+//
+// Frontend-side controls of the simulated hypervisor: granting pages and
+// allocating event channels, which the backend then consumes through the
+// usual libxenbe / libxengnttab stand-ins.
+//
+namespace SimXen {
+
+struct Stats {
+    uint64_t grantMaps{0};
+    uint64_t grantUnmaps{0};
+    uint64_t pagesMapped{0};
+    uint64_t notifiesToBackend{0};
+    uint64_t notifiesToFrontend{0};
+};
+
+// Grants count pages of fd starting at offset to the backend. Returns the
+// first grant reference; the rest follow consecutively.
+grant_ref_t grantPages(domid_t domId, int fd, off_t offset, uint32_t count);
+void revokePages(domid_t domId, grant_ref_t first, uint32_t count);
+
+// Allocates an unbound event channel. Notifications from the backend make
+// frontendFd() readable.
+evtchn_port_t allocPort(domid_t domId);
+void freePort(evtchn_port_t port);
+int frontendFd(evtchn_port_t port);
+void notifyBackend(evtchn_port_t port);
+
+// Sets the NUMA nodes xc_domain_node_getaffinity() reports for domId. An
+// empty list, the default, means every node.
+void setNodeAffinity(domid_t domId, const std::vector<uint32_t> &nodes);
+
+Stats stats() noexcept;
+void resetStats() noexcept;
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef SIM_XEN_BE_BACKENDBASE_HPP
+#define SIM_XEN_BE_BACKENDBASE_HPP
+
+#include <list>
+#include <mutex>
+#include <string>
+
+#include "FrontendHandlerBase.hpp"
+#include "Log.hpp"
+
+namespace XenBackend {
+
+//
+// There is no toolstack in a simulated build: frontend devices appear and
+// disappear only when simAttachFrontend()/simDetachFrontend() are called,
+// normally by SimFrontend.
+//
+class BackendBase
+{
+public:
+    BackendBase(const std::string &name,
+                const std::string &deviceName,
+                bool wait = false);
+    virtual ~BackendBase();
+
+    void start();
+    void stop();
+
+    const std::string &getDeviceName() const noexcept { return mDeviceName; }
+    domid_t getDomId() const noexcept { return 0; }
+
+    void simAttachFrontend(domid_t domId, uint16_t devId);
+    void simDetachFrontend(domid_t domId, uint16_t devId);
+    FrontendHandlerPtr getFrontendHandler(domid_t domId, uint16_t devId);
+
+protected:
+    virtual void onNewFrontend(domid_t domId, uint16_t devId) = 0;
+
+    void addFrontendHandler(FrontendHandlerPtr frontendHandler);
+
+private:
+    std::string mDeviceName;
+    std::list<FrontendHandlerPtr> mFrontendHandlers;
+    std::mutex mMutex;
+    Log mLog;
+};
+
+}
+
+#endif
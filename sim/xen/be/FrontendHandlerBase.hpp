@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef SIM_XEN_BE_FRONTENDHANDLERBASE_HPP
+#define SIM_XEN_BE_FRONTENDHANDLERBASE_HPP
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+extern "C" {
+#include <xen/io/xenbus.h>
+}
+
+#include "Log.hpp"
+#include "RingBufferBase.hpp"
+#include "XenStore.hpp"
+
+namespace XenBackend {
+
+//
+// Follows the frontend's xenbus state through an xenstore watch, calling
+// onBind() when the frontend has published its rings and onClosing() when it
+// goes away. A handler survives frontend reconnects (Closed -> Initialising)
+// until the simulated toolstack detaches it from the backend.
+//
+class FrontendHandlerBase
+{
+public:
+    FrontendHandlerBase(const std::string &name,
+                        const std::string &devName,
+                        domid_t feDomId,
+                        uint16_t devId);
+    virtual ~FrontendHandlerBase();
+
+    domid_t getDomId() const noexcept { return mFeDomId; }
+    uint16_t getDevId() const noexcept { return mDevId; }
+
+    const std::string &getXsBackendPath() const noexcept { return mXsBackendPath; }
+    const std::string &getXsFrontendPath() const noexcept { return mXsFrontendPath; }
+
+    XenStore &getXenStore() noexcept { return mXenStore; }
+
+    XenbusState getBackendState() const noexcept { return mBackendState; }
+
+    // Called by BackendBase once the handler is registered
+    void simStart();
+
+    // Called by BackendBase when the toolstack removes the device
+    void simStop();
+
+protected:
+    virtual void onBind() = 0;
+    virtual void onClosing() = 0;
+
+    void addRingBuffer(RingBufferPtr ringBuffer);
+
+private:
+    void setBackendState(XenbusState state);
+    void frontendStateChanged();
+    void close();
+
+    domid_t mFeDomId;
+    uint16_t mDevId;
+    std::string mXsBackendPath;
+    std::string mXsFrontendPath;
+    XenbusState mBackendState{XenbusStateInitialising};
+    XenStore mXenStore;
+    std::list<RingBufferPtr> mRingBuffers;
+    std::recursive_mutex mMutex;
+    Log mLog;
+};
+
+typedef std::shared_ptr<FrontendHandlerBase> FrontendHandlerPtr;
+
+}
+
+#endif
@@ -0,0 +1,82 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef SIM_XEN_BE_LOG_HPP
+#define SIM_XEN_BE_LOG_HPP
+
+#include <sstream>
+#include <string>
+
+namespace XenBackend {
+
+enum class LogLevel {
+    logDISABLE,
+    logERROR,
+    logWARNING,
+    logINFO,
+    logDEBUG
+};
+
+class Log
+{
+public:
+    Log(const std::string &name) : mName(name) {}
+
+    const std::string &getName() const noexcept { return mName; }
+
+    static void setLogLevel(LogLevel level) noexcept;
+    static LogLevel getLogLevel() noexcept;
+
+private:
+    std::string mName;
+};
+
+class LogLine
+{
+public:
+    LogLine(const std::string &name, LogLevel level);
+    ~LogLine();
+
+    std::ostringstream &get() noexcept { return mStream; }
+
+private:
+    std::ostringstream mStream;
+};
+
+inline const std::string &getLogName(const Log &log) noexcept
+{
+    return log.getName();
+}
+
+inline std::string getLogName(const char *name)
+{
+    return name;
+}
+
+}
+
+#define LOG(logger, level) \
+    if (XenBackend::LogLevel::log ## level > XenBackend::Log::getLogLevel()) ; \
+    else XenBackend::LogLine(XenBackend::getLogName(logger), \
+                             XenBackend::LogLevel::log ## level).get()
+
+#endif
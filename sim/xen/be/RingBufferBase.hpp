@@ -0,0 +1,135 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef SIM_XEN_BE_RINGBUFFERBASE_HPP
+#define SIM_XEN_BE_RINGBUFFERBASE_HPP
+
+#include <memory>
+#include <mutex>
+
+#include "Log.hpp"
+#include "SimTypes.hpp"
+#include "XenEvtchn.hpp"
+#include "XenGnttab.hpp"
+
+extern "C" {
+#include <xen/io/ring.h>
+}
+
+namespace XenBackend {
+
+class RingBufferItf
+{
+public:
+    virtual ~RingBufferItf() {}
+
+    virtual void start() = 0;
+    virtual void stop() = 0;
+};
+
+typedef std::shared_ptr<RingBufferItf> RingBufferPtr;
+
+class RingBufferBase : public RingBufferItf
+{
+public:
+    RingBufferBase(domid_t domId, evtchn_port_t port) :
+        mEventChannel(domId, port, [this] { this->onReceiveIndication(); })
+    { }
+
+    void start() override { mEventChannel.start(); }
+    void stop() override { mEventChannel.stop(); }
+
+protected:
+    XenEvtchn mEventChannel;
+
+    virtual void onReceiveIndication() = 0;
+};
+
+template<typename Ring, typename SRing, typename Req, typename Rsp>
+class RingBufferInBase : public RingBufferBase
+{
+public:
+    RingBufferInBase(domid_t domId,
+                     evtchn_port_t port,
+                     grant_ref_t ref,
+                     size_t ringSize,
+                     size_t pageSize) :
+        RingBufferBase(domId, port),
+        mBuffer(domId, ref)
+    {
+        (void)ringSize;
+
+        BACK_RING_INIT(&mRing, static_cast<SRing *>(mBuffer.get()), pageSize);
+    }
+
+protected:
+    void sendResponse(const Rsp &rsp)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        int notify = 0;
+
+        *RING_GET_RESPONSE(&mRing, mRing.rsp_prod_pvt) = rsp;
+        mRing.rsp_prod_pvt++;
+
+        RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(&mRing, notify);
+
+        if (notify) {
+            mEventChannel.notify();
+        }
+    }
+
+    virtual void processRequest(const Req &req) = 0;
+
+private:
+    XenGnttabBuffer mBuffer;
+    Ring mRing;
+    std::mutex mMutex;
+
+    void onReceiveIndication() override
+    {
+        int workToDo = 0;
+
+        do {
+            RING_IDX rc = mRing.req_cons;
+            RING_IDX rp = mRing.sring->req_prod;
+
+            xen_rmb();
+
+            while (rc != rp) {
+                if (RING_REQUEST_CONS_OVERFLOW(&mRing, rc)) {
+                    break;
+                }
+
+                Req req = *RING_GET_REQUEST(&mRing, rc);
+                mRing.req_cons = ++rc;
+
+                processRequest(req);
+            }
+
+            RING_FINAL_CHECK_FOR_REQUESTS(&mRing, workToDo);
+        } while (workToDo);
+    }
+};
+
+}
+
+#endif
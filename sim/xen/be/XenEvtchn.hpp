@@ -0,0 +1,78 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef SIM_XEN_BE_XENEVTCHN_HPP
+#define SIM_XEN_BE_XENEVTCHN_HPP
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <thread>
+
+#include "Exception.hpp"
+#include "SimTypes.hpp"
+
+namespace XenBackend {
+
+//
+// Backend end of a simulated interdomain event channel. The port must have
+// been allocated by the simulated frontend (see SimXen::allocPort); each
+// direction of the channel is an eventfd.
+//
+class XenEvtchn
+{
+public:
+    using Callback = std::function<void()>;
+    using ErrorCallback = std::function<void(const std::exception &)>;
+
+    XenEvtchn(domid_t domId,
+              evtchn_port_t port,
+              Callback callback,
+              ErrorCallback errorCallback = nullptr);
+    ~XenEvtchn();
+
+    XenEvtchn(const XenEvtchn &) = delete;
+    XenEvtchn &operator=(const XenEvtchn &) = delete;
+
+    void start();
+    void stop();
+    void notify();
+
+    evtchn_port_t getPort() const noexcept { return mPort; }
+
+private:
+    void eventThread();
+    void handleEvent();
+
+    domid_t mDomId;
+    evtchn_port_t mPort;
+    int mFd{-1};
+    int mNotifyFd{-1};
+    int mStopFd{-1};
+    Callback mCallback;
+    ErrorCallback mErrorCallback;
+    std::thread mThread;
+};
+
+}
+
+#endif
@@ -0,0 +1,82 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef SIM_XEN_BE_XENGNTTAB_HPP
+#define SIM_XEN_BE_XENGNTTAB_HPP
+
+#include <cstddef>
+
+#include "Exception.hpp"
+#include "SimTypes.hpp"
+
+//
+// libxengnttab entry points backed by the simulated grant table. Granted
+// pages live in memfds owned by the simulated frontend, so each map really
+// is an mmap of shared memory and costs a system call, as with gntdev.
+//
+extern "C" {
+
+typedef struct xengnttab_handle xengnttab_handle;
+
+void *xengnttab_map_grant_ref(xengnttab_handle *xgt,
+                              uint32_t domid,
+                              uint32_t ref,
+                              int prot);
+
+void *xengnttab_map_domain_grant_refs(xengnttab_handle *xgt,
+                                      uint32_t count,
+                                      uint32_t domid,
+                                      uint32_t *refs,
+                                      int prot);
+
+int xengnttab_unmap(xengnttab_handle *xgt, void *start_address, uint32_t count);
+
+}
+
+namespace XenBackend {
+
+class XenGnttabBuffer
+{
+public:
+    XenGnttabBuffer(domid_t domId,
+                    grant_ref_t ref,
+                    int prot = PROT_READ | PROT_WRITE);
+    XenGnttabBuffer(domid_t domId,
+                    const grant_ref_t *refs,
+                    size_t count,
+                    int prot = PROT_READ | PROT_WRITE);
+    ~XenGnttabBuffer();
+
+    XenGnttabBuffer(const XenGnttabBuffer &) = delete;
+    XenGnttabBuffer &operator=(const XenGnttabBuffer &) = delete;
+
+    void *get() const noexcept { return mBuffer; }
+    size_t size() const noexcept { return mCount * XC_PAGE_SIZE; }
+
+private:
+    void *mBuffer{nullptr};
+    size_t mCount{0};
+};
+
+}
+
+#endif
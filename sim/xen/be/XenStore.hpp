@@ -0,0 +1,74 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef SIM_XEN_BE_XENSTORE_HPP
+#define SIM_XEN_BE_XENSTORE_HPP
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Exception.hpp"
+#include "SimTypes.hpp"
+
+namespace XenBackend {
+
+//
+// In-memory xenstore. Every instance operates on the same process-wide
+// tree, so the backend and the simulated frontends see each other's writes.
+// Watches fire synchronously on the thread doing the write.
+//
+class XenStore
+{
+public:
+    using WatchCallback = std::function<void()>;
+
+    XenStore() = default;
+    ~XenStore();
+
+    XenStore(const XenStore &) = delete;
+    XenStore &operator=(const XenStore &) = delete;
+
+    std::string getDomainPath(domid_t domId) const;
+
+    std::string readString(const std::string &path);
+    int readInt(const std::string &path);
+    unsigned int readUint(const std::string &path);
+
+    void writeString(const std::string &path, const std::string &value);
+    void writeInt(const std::string &path, int value);
+    void writeUint(const std::string &path, unsigned int value);
+
+    bool checkIfExist(const std::string &path);
+    void removePath(const std::string &path);
+    std::vector<std::string> readDirectory(const std::string &path);
+
+    void setWatch(const std::string &path,
+                  WatchCallback callback,
+                  bool initNotify = false);
+    void clearWatch(const std::string &path);
+    void clearWatches();
+};
+
+}
+
+#endif
@@ -0,0 +1,58 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+
+#ifndef SIM_XENCTRL_H
+#define SIM_XENCTRL_H
+
+#include "xen/be/SimTypes.hpp"
+
+//
+// The libxenctrl calls the backend makes, answered from the simulated
+// domains' settings (see SimXen::setNodeAffinity()).
+//
+extern "C" {
+
+typedef struct xc_interface_core xc_interface;
+typedef struct xentoollog_logger xentoollog_logger;
+typedef uint8_t *xc_nodemap_t;
+
+xc_interface *xc_interface_open(xentoollog_logger *logger,
+                                xentoollog_logger *dombuild_logger,
+                                unsigned open_flags);
+
+int xc_interface_close(xc_interface *xch);
+
+int xc_get_max_nodes(xc_interface *xch);
+
+int xc_get_nodemap_size(xc_interface *xch);
+
+// Allocated with malloc(), freed by the caller with free()
+xc_nodemap_t xc_nodemap_alloc(xc_interface *xch);
+
+int xc_domain_node_getaffinity(xc_interface *xch,
+                               uint32_t domid,
+                               xc_nodemap_t nodemap);
+
+}
+
+#endif
@@ -0,0 +1,61 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+
+#ifndef SIM_XENEVTCHN_H
+#define SIM_XENEVTCHN_H
+
+#include "xen/be/SimTypes.hpp"
+
+//
+// libxenevtchn entry points backed by the simulated event channels, for
+// callers that wait on a channel's descriptor themselves. A handle binds
+// one port here; its descriptor is the port's eventfd from the frontend.
+//
+extern "C" {
+
+typedef struct xenevtchn_handle xenevtchn_handle;
+typedef struct xentoollog_logger xentoollog_logger;
+typedef int xenevtchn_port_or_error_t;
+
+xenevtchn_handle *xenevtchn_open(xentoollog_logger *logger,
+                                 unsigned open_flags);
+
+int xenevtchn_close(xenevtchn_handle *xce);
+
+int xenevtchn_fd(xenevtchn_handle *xce);
+
+int xenevtchn_notify(xenevtchn_handle *xce, evtchn_port_t port);
+
+xenevtchn_port_or_error_t xenevtchn_bind_interdomain(xenevtchn_handle *xce,
+                                                     uint32_t domid,
+                                                     evtchn_port_t remote_port);
+
+int xenevtchn_unbind(xenevtchn_handle *xce, evtchn_port_t port);
+
+xenevtchn_port_or_error_t xenevtchn_pending(xenevtchn_handle *xce);
+
+int xenevtchn_unmask(xenevtchn_handle *xce, evtchn_port_t port);
+
+}
+
+#endif
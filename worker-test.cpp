@@ -0,0 +1,347 @@
+//
+// Copyright (C) 2020 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "MpscQueue.hpp"
+#include "Reactor.hpp"
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define CATCH_CONFIG_MAIN
+#include "include/catch.hpp"
+
+TEST_CASE("Shared workers take turns between flows", "[fair]"){
+    std::vector<uint32_t> order;
+    std::mutex gate;
+
+    {
+        WorkerPool pool(1, nullptr, 2);
+        const uint32_t heavy = pool.addFlow(1);
+        const uint32_t light = pool.addFlow(1);
+        const uint32_t weighted = pool.addFlow(3);
+
+        // Hold the only thread until everything is queued
+        gate.lock();
+        pool.submit([&gate] { std::lock_guard<std::mutex> lock(gate); });
+
+        for (int i = 0; i < 100; i++) {
+            pool.submit(heavy, [&order, heavy] { order.push_back(heavy); });
+        }
+
+        for (int i = 0; i < 4; i++) {
+            pool.submit(light, [&order, light] { order.push_back(light); });
+        }
+
+        for (int i = 0; i < 60; i++) {
+            pool.submit(weighted, [&order, weighted] { order.push_back(weighted); });
+        }
+
+        gate.unlock();
+    }
+
+    REQUIRE(order.size() == 164);
+
+    // Two turns of 2 each get the light flow through in the first 20 tasks
+    auto lastLight = std::find(order.rbegin(), order.rend(), 2U);
+    REQUIRE(order.rend() - lastLight <= 20);
+
+    // While all are busy, weight 3 runs 3 times as often as weight 1
+    const auto heavyRuns = std::count(order.begin(), order.begin() + 80, 1U);
+    const auto weightedRuns = std::count(order.begin(), order.begin() + 80, 3U);
+    REQUIRE(weightedRuns >= 3 * heavyRuns - 6);
+    REQUIRE(weightedRuns <= 3 * heavyRuns + 6);
+}
+
+TEST_CASE("Idle workers steal from busy pools", "[steal]"){
+    auto group = std::make_shared<WorkerGroup>();
+    std::mutex mutex;
+    std::condition_variable cond;
+    uint32_t done = 0U;
+    bool started = false;
+    std::atomic<bool> release{false};
+
+    auto block = [&] {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            started = true;
+        }
+
+        cond.notify_all();
+
+        while (!release) {
+            std::this_thread::yield();
+        }
+    };
+
+    auto count = [&] {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done++;
+        }
+
+        cond.notify_all();
+    };
+
+    {
+        WorkerPool busy(1, nullptr, 1, group);
+
+        // busy's only thread stays stuck until everything else has run,
+        // which only idle's threads can do
+        busy.submit(block);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&started] { return started; });
+        lock.unlock();
+
+        WorkerPool idle(2, nullptr, 1, group);
+
+        for (int i = 0; i < 50; i++) {
+            busy.submit(count);
+        }
+
+        lock.lock();
+        const bool all = cond.wait_for(lock, std::chrono::seconds(10),
+                                       [&done] { return done == 50U; });
+        lock.unlock();
+
+        release = true;
+
+        REQUIRE(all);
+        REQUIRE(idle.stolen() == 50U);
+        REQUIRE(busy.stolen() == 0U);
+    }
+
+    // Nothing is taken from a pool on another node
+    {
+        WorkerPool busy(1, nullptr, 1, group, 0);
+
+        done = 0U;
+        started = false;
+        release = false;
+        busy.submit(block);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&started] { return started; });
+        lock.unlock();
+
+        WorkerPool remote(2, nullptr, 1, group, 1);
+
+        for (int i = 0; i < 10; i++) {
+            busy.submit(count);
+        }
+
+        // Give remote's threads the chance to take something they shouldn't
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        release = true;
+
+        REQUIRE(remote.stolen() == 0U);
+    }
+
+    REQUIRE(done == 10U);
+
+}
+
+TEST_CASE("A reactor waits on many descriptors", "[reactor]"){
+    static constexpr int FDS = 16;
+    std::atomic<uint32_t> calls[FDS] = {};
+    int fds[FDS];
+
+    Reactor reactor(2);
+
+    for (int i = 0; i < FDS; i++) {
+        fds[i] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        REQUIRE(reactor.add(fds[i], [&calls, &fds, i] {
+            uint64_t count;
+
+            if (read(fds[i], &count, sizeof(count)) == sizeof(count)) {
+                calls[i] += uint32_t(count);
+            }
+        }));
+    }
+
+    REQUIRE_FALSE(reactor.add(fds[0], [] { }));
+
+    for (int i = 0; i < FDS; i++) {
+        const uint64_t kicks = i + 1;
+        REQUIRE(write(fds[i], &kicks, sizeof(kicks)) == sizeof(kicks));
+    }
+
+    for (int i = 0; i < FDS; i++) {
+        for (int wait = 0; wait < 1000 && calls[i] != uint32_t(i + 1); wait++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        REQUIRE(calls[i] == uint32_t(i + 1));
+    }
+
+    // Nothing runs for a descriptor once it is removed
+    reactor.remove(fds[0]);
+    const uint64_t kick = 1;
+    REQUIRE(write(fds[0], &kick, sizeof(kick)) == sizeof(kick));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(calls[0] == 1U);
+
+    for (int i = 0; i < FDS; i++) {
+        reactor.remove(fds[i]);
+        close(fds[i]);
+    }
+}
+
+TEST_CASE("Descriptors on a reactor thread take turns", "[reactor]"){
+    Reactor reactor(1);
+    const int busy = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    const int idle = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    std::mutex mutex;
+    std::string order;
+    uint32_t left = 4U;
+
+    // Checked here rather than on the reactor thread
+    std::atomic<bool> kicked{true};
+
+    // Four turns' worth of work from one kick, the other descriptor
+    // becoming readable during the first
+    REQUIRE(reactor.addYielding(busy, [&] {
+        uint64_t count;
+        const uint64_t kick = 1;
+
+        if (read(busy, &count, sizeof(count)) == sizeof(count) &&
+            write(idle, &kick, sizeof(kick)) != sizeof(kick)) {
+            kicked = false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        order += 'b';
+
+        return --left != 0U;
+    }));
+
+    REQUIRE(reactor.add(idle, [&] {
+        uint64_t count;
+
+        if (read(idle, &count, sizeof(count)) == sizeof(count)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            order += 'i';
+        }
+    }));
+
+    const uint64_t kick = 1;
+    REQUIRE(write(busy, &kick, sizeof(kick)) == sizeof(kick));
+
+    std::string seen;
+
+    for (int wait = 0; wait < 1000 && seen.size() != 5U; wait++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        seen = order;
+    }
+
+    // Not holding mutex, which the callbacks take
+    reactor.remove(busy);
+    reactor.remove(idle);
+    close(busy);
+    close(idle);
+
+    REQUIRE(kicked);
+    REQUIRE(seen == "bibbb");
+}
+
+TEST_CASE("Completion queues take pushes from many threads", "[mpsc]"){
+    MpscQueue<uint32_t> queue(3);
+    uint32_t value;
+
+    REQUIRE(queue.capacity() == 4U);
+    REQUIRE(queue.empty());
+    REQUIRE_FALSE(queue.pop(value));
+
+    // Full at the capacity, and usable again once popped
+    for (uint32_t i = 0U; i < 4U; i++) {
+        REQUIRE(queue.push(i));
+    }
+
+    REQUIRE_FALSE(queue.push(4));
+    REQUIRE(queue.pop(value));
+    REQUIRE(value == 0U);
+    REQUIRE(queue.push(4));
+
+    // Around the cells many times over, in order
+    uint32_t next = 1U;
+
+    for (uint32_t i = 5U; i < 100U; i++) {
+        REQUIRE(queue.pop(value));
+        REQUIRE(value == next++);
+        REQUIRE(queue.push(i));
+    }
+
+    REQUIRE(queue.drain([&next](uint32_t popped) { REQUIRE(popped == next++); }) == 4U);
+    REQUIRE(queue.empty());
+
+    // Every value pushed by racing producers is popped once, and each
+    // producer's values come out in the order it pushed them
+    static constexpr uint32_t PRODUCERS = 4U;
+    static constexpr uint32_t PUSHES = 20000U;
+
+    MpscQueue<uint32_t> shared(64);
+    std::vector<std::thread> producers;
+    std::vector<uint32_t> seen(PRODUCERS, 0U);
+    uint32_t popped = 0U;
+    bool ordered = true;
+
+    for (uint32_t producer = 0U; producer < PRODUCERS; producer++) {
+        producers.emplace_back([&shared, producer] {
+            for (uint32_t i = 0U; i < PUSHES; i++) {
+                while (!shared.push(producer << 24 | i)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    while (popped < PRODUCERS * PUSHES) {
+        if (!shared.pop(value)) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        uint32_t &count = seen[value >> 24];
+        ordered = ordered && (value & 0xFFFFFFU) == count;
+        count++;
+        popped++;
+    }
+
+    for (auto &producer : producers) {
+        producer.join();
+    }
+
+    REQUIRE(ordered);
+    REQUIRE(shared.empty());
+    REQUIRE(seen == std::vector<uint32_t>(PRODUCERS, PUSHES));
+}